@@ -0,0 +1,459 @@
+#include <string>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+
+#include "zeroconf-detail.hpp"
+#include "zeroconf-arena.hpp"
+#include "zeroconf-responder.hpp"
+
+// Codec microbenchmarks. Prints a table, or one JSON document with --json.
+// The allocation counts come from the replaced global operator new.
+
+namespace
+{
+    std::atomic<size_t> g_allocations(0);
+
+    const uint8_t RealPacket[] =
+    {
+        0x00, 0x00, 0x84, 0x00, 0x00, 0x01, 0x00, 0x05, 0x00, 0x00, 0x00, 0x00, 0x05, 0x5F, 0x68, 0x74,
+        0x74, 0x70, 0x04, 0x5F, 0x74, 0x63, 0x70, 0x05, 0x6C, 0x6F, 0x63, 0x61, 0x6C, 0x00, 0x00, 0x0C,
+        0x00, 0x01, 0xC0, 0x0C, 0x00, 0x0C, 0x00, 0x01, 0x00, 0x00, 0x00, 0x0A, 0x00, 0x10, 0x0D, 0x61,
+        0x70, 0x70, 0x6C, 0x65, 0x20, 0x6D, 0x61, 0x63, 0x62, 0x6F, 0x6F, 0x6B, 0xC0, 0x0C, 0xC0, 0x2E,
+        0x00, 0x10, 0x00, 0x01, 0x00, 0x00, 0x00, 0x0A, 0x00, 0x46, 0x45, 0x4C, 0x6F, 0x72, 0x65, 0x6D,
+        0x20, 0x69, 0x70, 0x73, 0x75, 0x6D, 0x20, 0x64, 0x6F, 0x6C, 0x6F, 0x72, 0x20, 0x73, 0x69, 0x74,
+        0x20, 0x61, 0x6D, 0x65, 0x74, 0x20, 0x63, 0x6F, 0x6E, 0x73, 0x65, 0x63, 0x74, 0x65, 0x74, 0x75,
+        0x72, 0x20, 0x61, 0x64, 0x69, 0x70, 0x69, 0x73, 0x63, 0x69, 0x6E, 0x67, 0x20, 0x65, 0x6C, 0x69,
+        0x74, 0x20, 0x73, 0x65, 0x64, 0x20, 0x64, 0x6F, 0x20, 0x65, 0x69, 0x75, 0x73, 0x6D, 0x6F, 0x64,
+        0xC0, 0x2E, 0x00, 0x21, 0x00, 0x01, 0x00, 0x00, 0x00, 0x0A, 0x00, 0x0E, 0x00, 0x00, 0x00, 0x00,
+        0x22, 0xB3, 0x05, 0x61, 0x70, 0x70, 0x6C, 0x65, 0xC0, 0x17, 0xC0, 0xA2, 0x00, 0x1C, 0x00, 0x01,
+        0x00, 0x00, 0x00, 0x0A, 0x00, 0x10, 0xFD, 0xAD, 0xC9, 0xE2, 0x23, 0x28, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0xC0, 0xA2, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x00, 0x0A,
+        0x00, 0x04, 0xC0, 0xA8, 0x00, 0x01
+    };
+
+    const uint8_t ResponceHeader[] = { 0x00, 0x00, 0x84, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
+
+    void Put16(uint16_t value, std::vector<uint8_t>* result)
+    {
+        result->push_back(static_cast<uint8_t>(value >> 8));
+        result->push_back(static_cast<uint8_t>(value));
+    }
+
+    void SetAncount(uint16_t count, std::vector<uint8_t>* packet)
+    {
+        (*packet)[6] = static_cast<uint8_t>(count >> 8);
+        (*packet)[7] = static_cast<uint8_t>(count);
+    }
+
+    // A records of distinct hosts sharing the .local suffix after the _http._tcp.local PTR question,
+    // as many as fit in one message
+    std::vector<uint8_t> MaxSizePacket()
+    {
+        uint8_t buffer[Zeroconf::Detail::MdnsMessageMaxLength];
+        Zeroconf::Detail::message_builder builder(buffer, sizeof(buffer));
+        builder.Reset(0, Zeroconf::Detail::MdnsResponseFlag);
+        builder.AddQuestion(std::string("_http._tcp.local"), Zeroconf::Detail::MdnsTypePtr);
+
+        const uint8_t Address[] = { 192, 168, 0, 1 };
+        for (size_t count = 0; ; count++)
+        {
+            if (!builder.AddRecord(Zeroconf::Detail::MessageSection::Answer, "host-" + std::to_string(count) + ".local",
+                Zeroconf::Detail::MdnsTypeA, Zeroconf::Detail::MdnsClassIn, 120, Address, sizeof(Address)))
+            {
+                break;
+            }
+        }
+
+        return std::vector<uint8_t>(builder.Data(), builder.Data() + builder.Size());
+    }
+
+    // PTR records whose names are one label plus a pointer to the previous record name,
+    // in chains of eight, so that every name takes several hops to read
+    std::vector<uint8_t> CompressedPacket(std::vector<size_t>* names)
+    {
+        std::vector<uint8_t> result(std::begin(ResponceHeader), std::end(ResponceHeader));
+        size_t question = result.size();
+        Zeroconf::Detail::WriteFqdn("_http._tcp.local", &result);
+        Put16(Zeroconf::Detail::MdnsTypePtr, &result);
+        Put16(Zeroconf::Detail::MdnsClassIn, &result);
+
+        names->clear();
+
+        uint16_t count = 0;
+        size_t prev = question;
+        while (result.size() + 32 < Zeroconf::Detail::MdnsMessageMaxLength)
+        {
+            if (count % 8 == 0)
+                prev = question;
+
+            size_t pos = result.size();
+            result.push_back(2);
+            result.push_back('s');
+            result.push_back(static_cast<uint8_t>('a' + count % 26));
+            Put16(static_cast<uint16_t>(0xC000 | prev), &result);
+
+            const uint8_t Tail[] = { 0x00, 0x0C, 0x00, 0x01, 0x00, 0x00, 0x00, 0x78, 0x00, 0x02 };
+            result.insert(result.end(), std::begin(Tail), std::end(Tail));
+            Put16(static_cast<uint16_t>(0xC000 | pos), &result);
+
+            names->push_back(pos);
+            prev = pos;
+            count++;
+        }
+
+        SetAncount(count, &result);
+        return result;
+    }
+
+    struct result_line
+    {
+        std::string name;
+        size_t iterations;
+        double seconds;
+        size_t allocations;
+    };
+
+    // Runs the step a number of times after a warm up round, the step returns something to keep
+    template <typename Step>
+    result_line Measure(const std::string& name, size_t iterations, Step step)
+    {
+        size_t sink = 0;
+        for (size_t i = 0; i < iterations / 10 + 1; i++)
+            sink += step();
+
+        auto allocations = g_allocations.load(std::memory_order_relaxed);
+        auto start = std::chrono::steady_clock::now();
+
+        for (size_t i = 0; i < iterations; i++)
+            sink += step();
+
+        auto elapsed = std::chrono::steady_clock::now() - start;
+
+        result_line result;
+        result.name = name;
+        result.iterations = iterations;
+        result.seconds = std::chrono::duration<double>(elapsed).count();
+        result.allocations = g_allocations.load(std::memory_order_relaxed) - allocations;
+
+        if (sink == 1)
+            std::cerr << "";
+
+        return result;
+    }
+
+    void PrintTable(const std::vector<result_line>& lines)
+    {
+        std::cout 
+            << std::left << std::setw(28) << "benchmark" 
+            << std::right << std::setw(16) << "packets/s" 
+            << std::setw(14) << "ns/packet" 
+            << std::setw(16) << "allocs/packet" << std::endl;
+
+        for (auto& line: lines)
+        {
+            std::cout 
+                << std::left << std::setw(28) << line.name 
+                << std::right << std::fixed << std::setprecision(0) 
+                << std::setw(16) << line.iterations / line.seconds 
+                << std::setprecision(1) 
+                << std::setw(14) << line.seconds * 1e9 / line.iterations 
+                << std::setprecision(2) 
+                << std::setw(16) << static_cast<double>(line.allocations) / line.iterations << std::endl;
+        }
+    }
+
+    void PrintJson(const std::vector<result_line>& lines)
+    {
+        std::cout << "{\"benchmarks\":[" << std::endl;
+
+        for (size_t i = 0; i < lines.size(); i++)
+        {
+            auto& line = lines[i];
+            std::cout 
+                << "  {\"name\":\"" << line.name << "\""
+                << ",\"iterations\":" << line.iterations
+                << std::fixed << std::setprecision(1)
+                << ",\"packets_per_sec\":" << line.iterations / line.seconds
+                << ",\"ns_per_packet\":" << line.seconds * 1e9 / line.iterations
+                << std::setprecision(3)
+                << ",\"allocs_per_packet\":" << static_cast<double>(line.allocations) / line.iterations
+                << "}" << (i + 1 < lines.size() ? "," : "") << std::endl;
+        }
+
+        std::cout << "]}" << std::endl;
+    }
+}
+
+// Every form of new and delete goes through Allocate and Release, which are kept out of line
+// so that the compiler never sees a free() paired with an operator new it did not expect
+namespace
+{
+#if defined(__GNUC__)
+    __attribute__((noinline))
+#endif
+    void* Allocate(size_t size)
+    {
+        g_allocations.fetch_add(1, std::memory_order_relaxed);
+        return malloc(size ? size : 1);
+    }
+
+#if defined(__GNUC__)
+    __attribute__((noinline))
+#endif
+    void Release(void* p) noexcept
+    {
+        free(p);
+    }
+}
+
+void* operator new(size_t size)
+{
+    if (auto p = Allocate(size))
+        return p;
+
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+    return Allocate(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+    return Allocate(size);
+}
+
+void operator delete(void* p) noexcept
+{
+    Release(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    Release(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    Release(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+    Release(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept
+{
+    Release(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept
+{
+    Release(p);
+}
+
+#if defined(__cpp_aligned_new)
+void* operator new(size_t size, std::align_val_t alignment)
+{
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+
+    auto align = std::max(static_cast<size_t>(alignment), sizeof(void*));
+    if (auto p = aligned_alloc(align, (std::max<size_t>(size, 1) + align - 1) / align * align))
+        return p;
+
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size, std::align_val_t alignment)
+{
+    return operator new(size, alignment);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept
+{
+    Release(p);
+}
+
+void operator delete[](void* p, std::align_val_t) noexcept
+{
+    Release(p);
+}
+
+void operator delete(void* p, size_t, std::align_val_t) noexcept
+{
+    Release(p);
+}
+
+void operator delete[](void* p, size_t, std::align_val_t) noexcept
+{
+    Release(p);
+}
+#endif
+
+int main(int argc, char** argv)
+{
+    bool json = false;
+    size_t iterations = 200000;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--json")
+            json = true;
+        else if (arg == "--iterations" && i + 1 < argc)
+            iterations = std::strtoul(argv[++i], nullptr, 10);
+        else
+        {
+            std::cerr << "Usage: codec_bench [--json] [--iterations N]" << std::endl;
+            return 1;
+        }
+    }
+
+    Zeroconf::Detail::Log::SetLogCallback([](Zeroconf::Detail::Log::LogLevel, const std::string&) {});
+
+    std::vector<uint8_t> real(std::begin(RealPacket), std::end(RealPacket));
+    auto maxSize = MaxSizePacket();
+
+    std::vector<size_t> names;
+    auto compressed = CompressedPacket(&names);
+
+    auto truncated = real;
+    truncated.resize(real.size() / 2);
+
+    auto looped = real;
+    looped[0x91] = 0x90; // the SRV record name points at itself
+
+    std::vector<result_line> lines;
+    Zeroconf::Detail::mdns_responce responce;
+
+    auto parse = [&](const std::vector<uint8_t>& packet)
+    {
+        return [&]() -> size_t
+        {
+            Zeroconf::Detail::Parse(&packet[0], packet.size(), &responce);
+            return responce.records.size();
+        };
+    };
+
+    lines.push_back(Measure("parse/real", iterations, parse(real)));
+    lines.push_back(Measure("parse/max_size", iterations, parse(maxSize)));
+    lines.push_back(Measure("parse/compressed", iterations, parse(compressed)));
+    lines.push_back(Measure("parse/truncated", iterations, parse(truncated)));
+    lines.push_back(Measure("parse/pointer_loop", iterations, parse(looped)));
+
+    // a scan keeping a thousand answers, then the next one
+    sockaddr_storage peer = {0};
+    Zeroconf::Detail::scan_result scanned;
+    lines.push_back(Measure("parse/scan_result", iterations, [&]() -> size_t
+    {
+        if (scanned.Size() == 1000)
+            scanned.Clear();
+
+        Zeroconf::Detail::Parse(peer, &real[0], real.size(), &responce);
+        scanned.Add(responce);
+        return responce.records.size();
+    }));
+
+    // the parser threads of a scan, the pushing thread merges as it goes
+    const size_t Threads[] = { 1, 2, 4 };
+    for (auto threads: Threads)
+    {
+        Zeroconf::Detail::parse_pipeline pipeline(threads);
+        if (!pipeline.Start())
+            break;
+
+        size_t records = 0;
+        auto merge = [&](Zeroconf::Detail::parse_pipeline::slot& item)
+        {
+            records += item.responce.records.size();
+            return true;
+        };
+
+        lines.push_back(Measure("pipeline/" + std::to_string(threads) + "_threads", iterations, [&]() -> size_t
+        {
+            pipeline.Merge(merge, pipeline.Depth() - 1);
+            pipeline.Push(0, peer, &maxSize[0], maxSize.size());
+            return records;
+        }));
+
+        pipeline.Merge(merge, 0);
+    }
+
+    std::string name;
+    lines.push_back(Measure("read_fqdn/compressed", iterations, [&]() -> size_t
+    {
+        size_t total = 0;
+        for (auto pos: names)
+            total += Zeroconf::Detail::ReadFqdn(&compressed[0], compressed.size(), pos, &name);
+
+        return total;
+    }));
+
+    const std::string Names[] = { "_http._tcp.local", "apple macbook._http._tcp.local", "apple.local", "host-1.local" };
+
+    std::vector<uint8_t> encoded;
+    lines.push_back(Measure("write_fqdn/plain", iterations, [&]() -> size_t
+    {
+        encoded.clear();
+        for (auto& item: Names)
+            Zeroconf::Detail::WriteFqdn(item, &encoded);
+
+        return encoded.size();
+    }));
+
+    uint8_t buffer[Zeroconf::Detail::MdnsMessageMaxLength];
+    Zeroconf::Detail::message_builder builder(buffer, sizeof(buffer));
+    lines.push_back(Measure("write_fqdn/compressed", iterations, [&]() -> size_t
+    {
+        builder.Reset(0, 0);
+        for (auto& item: Names)
+            builder.WriteName(item);
+
+        return builder.Size() - 12;
+    }));
+
+    // the responder hot path, answers go to the discard port of the loopback
+    Zeroconf::Detail::service_info service;
+    service.instance = "Office";
+    service.type = "_ipp._tcp.local";
+    service.host = "printer.local";
+    service.port = 631;
+    service.txt.push_back("rp=ipp/print");
+
+    Zeroconf::Detail::responder responder;
+    if (responder.Open(0) && responder.Register(service))
+    {
+        sockaddr_storage peer = {0};
+        auto in = reinterpret_cast<sockaddr_in*>(&peer);
+        in->sin_family = AF_INET;
+        in->sin_port = htons(9);
+        in->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        std::vector<uint8_t> query;
+        Zeroconf::Detail::WriteQuery(service.type, Zeroconf::Detail::MdnsTypePtr, 1, &query);
+
+        lines.push_back(Measure("respond/ptr_query", iterations, [&]() -> size_t
+        {
+            return responder.Handle(peer, &query[0], query.size());
+        }));
+    }
+
+    if (json)
+        PrintJson(lines);
+    else
+        PrintTable(lines);
+
+    return 0;
+}
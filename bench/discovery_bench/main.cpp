@@ -0,0 +1,216 @@
+#include <string>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <cstdlib>
+#include <memory>
+
+#include "zeroconf.hpp"
+#include "zeroconf-simulator.hpp"
+
+// End-to-end discovery against simulated responders on the loopback, from one to many of them.
+// Prints a table, or one JSON document with --json.
+
+namespace
+{
+    const char* Service = "_bench._tcp.local";
+
+    struct result_line
+    {
+        size_t responders;
+        double firstMs;   // time to the first answer, -1 if none came
+        double allMs;     // time to the answer of the last responder, -1 if some never came
+        size_t answers;   // distinct hosts heard
+        size_t sent;      // replies the simulator sent
+        size_t received;  // replies the client took in, repeats included
+        size_t lost;      // replies the simulated responders dropped on purpose
+        double parseUs;   // mean Parse time, from the library metrics
+        double rttP99Ms;  // 99th percentile of the per-responder RTT, bucket bound
+    };
+
+    bool Measure(size_t count, const Zeroconf::Detail::simulator_options& simOptions, std::chrono::milliseconds deadline, size_t parsers, size_t shards, result_line* result)
+    {
+        std::vector<Zeroconf::Detail::simulated_responder> responders;
+        for (size_t i = 0; i < count; i++)
+        {
+            auto host = Zeroconf::Detail::simulator::ResponderAddress(i);
+            responders.push_back(Zeroconf::Detail::SimulatedService(Service, "node-" + std::to_string(i), host));
+        }
+
+        Zeroconf::Detail::simulator sim;
+        if (!sim.Start(responders, simOptions))
+            return false;
+
+        Zeroconf::resolve_options options;
+        options.cachePolicy = Zeroconf::CachePolicy::Bypass;
+        options.destination = sim.Address();
+        options.completion.peers = count;
+        options.completion.deadline = deadline;
+        options.parserThreads = parsers;
+
+        // the sockets of a client are open before the clock starts
+        std::unique_ptr<Zeroconf::client> client;
+        if (shards > 0)
+        {
+            client.reset(new Zeroconf::client(options, shards));
+            if (!client->Open())
+                return false;
+        }
+
+        std::vector<sockaddr_storage> hosts;
+        std::vector<bool> heard(count, false);
+
+        result->responders = count;
+        result->firstMs = result->allMs = -1;
+        result->answers = result->received = 0;
+
+        Zeroconf::ResetMetrics();
+        auto start = std::chrono::steady_clock::now();
+
+        Zeroconf::ResponceCallback callback = [&](Zeroconf::mdns_responce& responce)
+        {
+            auto ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            if (result->firstMs < 0)
+                result->firstMs = ms;
+
+            auto host = ntohl(reinterpret_cast<const sockaddr_in*>(&responce.peer)->sin_addr.s_addr) - INADDR_LOOPBACK - 1;
+            if (host < count && !heard[host])
+            {
+                heard[host] = true;
+                if (++result->answers == count)
+                    result->allMs = ms;
+            }
+
+            return true;
+        };
+
+        bool st = client ? client->Resolve(Service, 0, options, callback) : Zeroconf::Resolve(Service, 0, options, callback);
+
+        // let the late replies land before counting
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        sim.Stop();
+
+        result->sent = sim.Sent();
+        result->lost = sim.Lost();
+
+        auto metrics = Zeroconf::GetMetrics();
+        result->received = static_cast<size_t>(metrics.packetsReceived);
+        result->parseUs = metrics.parse.Mean();
+        result->rttP99Ms = metrics.rtt.Percentile(0.99) / 1000.0;
+        return st;
+    }
+
+    void PrintTable(const std::vector<result_line>& lines)
+    {
+        std::cout 
+            << std::right << std::setw(10) << "responders"
+            << std::setw(12) << "first ms"
+            << std::setw(12) << "all ms"
+            << std::setw(10) << "answers"
+            << std::setw(10) << "sent"
+            << std::setw(10) << "received"
+            << std::setw(10) << "dropped"
+            << std::setw(10) << "lost"
+            << std::setw(10) << "parse us"
+            << std::setw(12) << "rtt p99 ms" << std::endl;
+
+        for (auto& line: lines)
+        {
+            std::cout 
+                << std::setw(10) << line.responders
+                << std::fixed << std::setprecision(2)
+                << std::setw(12) << line.firstMs
+                << std::setw(12) << line.allMs
+                << std::setw(10) << line.answers
+                << std::setw(10) << line.sent
+                << std::setw(10) << line.received
+                << std::setw(10) << line.sent - std::min(line.sent, line.received)
+                << std::setw(10) << line.lost
+                << std::setw(10) << line.parseUs
+                << std::setw(12) << line.rttP99Ms << std::endl;
+        }
+    }
+
+    void PrintJson(const std::vector<result_line>& lines)
+    {
+        std::cout << "{\"runs\":[" << std::endl;
+
+        for (size_t i = 0; i < lines.size(); i++)
+        {
+            auto& line = lines[i];
+            std::cout 
+                << "  {\"responders\":" << line.responders
+                << std::fixed << std::setprecision(3)
+                << ",\"first_ms\":" << line.firstMs
+                << ",\"all_ms\":" << line.allMs
+                << ",\"answers\":" << line.answers
+                << ",\"sent\":" << line.sent
+                << ",\"received\":" << line.received
+                << ",\"dropped\":" << line.sent - std::min(line.sent, line.received)
+                << ",\"lost\":" << line.lost
+                << ",\"parse_us\":" << line.parseUs
+                << ",\"rtt_p99_ms\":" << line.rttP99Ms
+                << "}" << (i + 1 < lines.size() ? "," : "") << std::endl;
+        }
+
+        std::cout << "]}" << std::endl;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    bool json = false;
+    std::vector<size_t> counts = { 1, 10, 100, 1000, 10000 };
+    Zeroconf::Detail::simulator_options simOptions;
+    std::chrono::milliseconds deadline(3000);
+    size_t parsers = 0;
+    size_t shards = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool value = i + 1 < argc;
+
+        if (arg == "--json")
+            json = true;
+        else if (arg == "--responders" && value)
+            counts.assign(1, std::strtoul(argv[++i], nullptr, 10));
+        else if (arg == "--jitter-ms" && value)
+            simOptions.maxDelay = std::chrono::milliseconds(std::strtoul(argv[++i], nullptr, 10));
+        else if (arg == "--loss" && value)
+            simOptions.loss = std::strtod(argv[++i], nullptr);
+        else if (arg == "--burst" && value)
+            simOptions.burst = std::strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--deadline-ms" && value)
+            deadline = std::chrono::milliseconds(std::strtoul(argv[++i], nullptr, 10));
+        else if (arg == "--parsers" && value)
+            parsers = std::strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--shards" && value)
+            shards = std::strtoul(argv[++i], nullptr, 10);
+        else
+        {
+            std::cerr << "Usage: discovery_bench [--json] [--responders N] [--jitter-ms MS] [--loss P] [--burst N] [--deadline-ms MS] [--parsers N] [--shards N]" << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<result_line> lines;
+    for (auto count: counts)
+    {
+        result_line line;
+        if (!Measure(count, simOptions, deadline, parsers, shards, &line))
+        {
+            std::cerr << "Failed to run " << count << " responders" << std::endl;
+            return 1;
+        }
+
+        lines.push_back(line);
+    }
+
+    if (json)
+        PrintJson(lines);
+    else
+        PrintTable(lines);
+
+    return 0;
+}
@@ -43,6 +43,46 @@ void PrintLog(Zeroconf::LogLevel level, const std::string& message)
     }
 }
 
+void PrintData(const Zeroconf::mdns_responce& item, const Zeroconf::mdns_record& rr)
+{
+    char buffer[INET6_ADDRSTRLEN + 1] = {0};
+    std::string name;
+    in_addr addr4;
+    in6_addr addr6;
+    Zeroconf::mdns_srv srv;
+    Zeroconf::mdns_txt txt;
+
+    if (Zeroconf::ReadA(item, rr, &addr4))
+    {
+        inet_ntop(AF_INET, &addr4, buffer, INET6_ADDRSTRLEN);
+        std::cout << " -> " << buffer;
+    }
+    else if (Zeroconf::ReadAaaa(item, rr, &addr6))
+    {
+        inet_ntop(AF_INET6, &addr6, buffer, INET6_ADDRSTRLEN);
+        std::cout << " -> " << buffer;
+    }
+    else if (Zeroconf::ReadPtr(item, rr, &name))
+    {
+        std::cout << " -> " << name;
+    }
+    else if (Zeroconf::ReadSrv(item, rr, &srv))
+    {
+        std::cout << " -> " << srv.target << ":" << srv.port;
+    }
+    else
+    {
+        auto reader = Zeroconf::ReadTxt(item, rr);
+        while (reader.Next(&txt))
+        {
+            std::cout << " [" << txt.key.to_string();
+            if (txt.hasValue)
+                std::cout << "=" << txt.value.to_string();
+            std::cout << "]";
+        }
+    }
+}
+
 void PrintResult(std::vector<Zeroconf::mdns_responce>& result)
 {
     for (size_t i = 0; i < result.size(); i++)
@@ -71,7 +111,9 @@ void PrintResult(std::vector<Zeroconf::mdns_responce>& result)
                     default: std::cout << rr.type;
                 }
                 std::cout << ", size " << rr.len;
-                std::cout << ", " << rr.name << std::endl;
+                std::cout << ", " << rr.name;
+                PrintData(item, rr);
+                std::cout << std::endl;
             }
         }
 
@@ -91,8 +133,9 @@ int main(int argc, char** argv)
     }
 #endif
 
-    static const std::string MdnsQuery = "_http._tcp.local";
-    std::cout << "Query: " << MdnsQuery << std::endl;
+    static constexpr char ServiceName[] = "_http._tcp.local";
+    static constexpr auto MdnsQuery = Zeroconf::EncodeQuery(ServiceName);
+    std::cout << "Query: " << ServiceName << std::endl;
 
     Zeroconf::SetLogCallback(PrintLog);
 
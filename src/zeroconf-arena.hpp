@@ -0,0 +1,323 @@
+#ifndef ZEROCONF_ARENA_HPP
+#define ZEROCONF_ARENA_HPP
+
+//////////////////////////////////////////////////////////////////////////
+// zeroconf-arena.hpp
+
+// (C) Copyright 2016 Yuri Yakovlev <yvzmail@gmail.com>
+// Use, modification and distribution is subject to the GNU General Public License
+
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+#include "zeroconf-util.hpp"
+#include "zeroconf-detail.hpp"
+
+namespace Zeroconf
+{
+    namespace Detail
+    {
+        const size_t ArenaBlockSize = 64 * 1024;
+
+        // Hands out memory from a few large blocks and frees all of it at once, nothing in it
+        // is destroyed one by one. A request bigger than a quarter of a block that does not fit
+        // the current one gets a block of its own.
+        class scan_arena
+        {
+        public:
+            explicit scan_arena(size_t blockSize = ArenaBlockSize)
+                : m_blockSize(blockSize), m_pos(nullptr), m_end(nullptr), m_used(0)
+            {
+            }
+
+            scan_arena(scan_arena&& other)
+                : m_blockSize(other.m_blockSize), m_blocks(std::move(other.m_blocks)), m_pos(other.m_pos), m_end(other.m_end), m_used(other.m_used)
+            {
+                other.Clear();
+            }
+
+            scan_arena& operator=(scan_arena&& other)
+            {
+                if (this != &other)
+                {
+                    m_blockSize = other.m_blockSize;
+                    m_blocks = std::move(other.m_blocks);
+                    m_pos = other.m_pos;
+                    m_end = other.m_end;
+                    m_used = other.m_used;
+                    other.Clear();
+                }
+
+                return *this;
+            }
+
+            scan_arena(const scan_arena&) = delete;
+            scan_arena& operator=(const scan_arena&) = delete;
+
+            // The alignment is at most that of std::max_align_t
+            void* Allocate(size_t size, size_t align)
+            {
+                size_t offset = m_pos != nullptr ? (align - reinterpret_cast<uintptr_t>(m_pos) % align) % align : 0;
+
+                if (m_pos == nullptr || offset + size > static_cast<size_t>(m_end - m_pos))
+                {
+                    if (size > m_blockSize / 4)
+                    {
+                        std::unique_ptr<uint8_t[]> block(new uint8_t[size]);
+                        m_blocks.push_back(std::move(block));
+                        m_used += size;
+                        return m_blocks.back().get();
+                    }
+
+                    std::unique_ptr<uint8_t[]> block(new uint8_t[m_blockSize]);
+                    m_blocks.push_back(std::move(block));
+                    m_pos = m_blocks.back().get();
+                    m_end = m_pos + m_blockSize;
+                    offset = 0;
+                }
+
+                auto result = m_pos + offset;
+                m_pos = result + size;
+                m_used += size;
+                return result;
+            }
+
+            template<typename T>
+            T* Allocate(size_t count)
+            {
+                static_assert(std::is_trivially_destructible<T>::value, "Nothing in the arena is destroyed");
+                return static_cast<T*>(Allocate(count * sizeof(T), alignof(T)));
+            }
+
+            stdext::string_view Copy(const std::string& text)
+            {
+                auto result = static_cast<char*>(Allocate(text.size(), 1));
+                memcpy(result, text.data(), text.size());
+                return stdext::string_view(result, text.size());
+            }
+
+            stdext::array_view<uint8_t> Copy(const std::vector<uint8_t>& data)
+            {
+                auto result = Allocate<uint8_t>(data.size());
+                if (!data.empty())
+                    memcpy(result, &data[0], data.size());
+
+                return stdext::array_view<uint8_t>(result, data.size());
+            }
+
+            void Clear()
+            {
+                m_blocks.clear();
+                m_pos = m_end = nullptr;
+                m_used = 0;
+            }
+
+            size_t Blocks() const { return m_blocks.size(); }
+            size_t Used() const { return m_used; }
+
+        private:
+            size_t m_blockSize;
+            std::vector<std::unique_ptr<uint8_t[]>> m_blocks;
+            uint8_t* m_pos;
+            uint8_t* m_end;
+            size_t m_used;
+        };
+
+        // mdns_record with the name in an arena
+        struct mdns_record_view
+        {
+            uint16_t type;
+            uint16_t rclass;
+            uint32_t ttl;
+            size_t pos;
+            size_t len;
+            size_t rdpos;
+            size_t rdlen;
+            stdext::string_view name;
+        };
+
+        // mdns_responce with the packet, the names and the records in an arena
+        struct mdns_responce_view
+        {
+            sockaddr_storage peer;
+            unsigned interfaceIndex;
+            unsigned count;
+            bool truncated;
+            uint16_t qtype;
+            stdext::string_view qname;
+            stdext::array_view<uint8_t> data;
+            stdext::array_view<mdns_record_view> records;
+        };
+
+        // Responces of a scan kept in an arena: the packets, names and records of all of them take
+        // a few large blocks, freed at once with the result. Moving the result copies no responce.
+        class scan_result
+        {
+        public:
+            typedef std::vector<mdns_responce_view>::const_iterator const_iterator;
+
+            explicit scan_result(size_t blockSize = ArenaBlockSize) : m_arena(blockSize)
+            {
+            }
+
+            scan_result(scan_result&&) = default;
+            scan_result& operator=(scan_result&&) = default;
+
+            // Copies the responce in, returns its number from 0
+            size_t Add(const mdns_responce& responce)
+            {
+                mdns_responce_view view;
+                memcpy(&view.peer, &responce.peer, sizeof(sockaddr_storage));
+                view.interfaceIndex = responce.interfaceIndex;
+                view.count = responce.count;
+                view.truncated = responce.truncated;
+                view.qtype = responce.qtype;
+                view.qname = m_arena.Copy(responce.qname);
+                view.data = m_arena.Copy(responce.data);
+
+                auto records = m_arena.Allocate<mdns_record_view>(responce.records.size());
+                for (size_t i = 0; i < responce.records.size(); i++)
+                {
+                    auto& rr = responce.records[i];
+                    mdns_record_view item = { rr.type, rr.rclass, rr.ttl, rr.pos, rr.len, rr.rdpos, rr.rdlen, m_arena.Copy(rr.name) };
+                    new (&records[i]) mdns_record_view(item);
+                }
+
+                view.records = stdext::array_view<mdns_record_view>(records, responce.records.size());
+
+                m_responces.push_back(view);
+                return m_responces.size() - 1;
+            }
+
+            // One more receipt of the responce number index
+            void Repeated(size_t index)
+            {
+                if (index < m_responces.size())
+                    m_responces[index].count++;
+            }
+
+            void Clear()
+            {
+                m_responces.clear();
+                m_arena.Clear();
+            }
+
+            size_t Size() const { return m_responces.size(); }
+            bool Empty() const { return m_responces.empty(); }
+
+            const mdns_responce_view& operator[](size_t index) const { return m_responces[index]; }
+            const_iterator begin() const { return m_responces.begin(); }
+            const_iterator end() const { return m_responces.end(); }
+
+            const scan_arena& Arena() const { return m_arena; }
+
+        private:
+            scan_arena m_arena;
+            std::vector<mdns_responce_view> m_responces;
+        };
+
+        // An owning copy, for the cache or to outlive the result
+        inline void Copy(const mdns_responce_view& view, mdns_responce* result)
+        {
+            memcpy(&result->peer, &view.peer, sizeof(sockaddr_storage));
+            result->interfaceIndex = view.interfaceIndex;
+            result->count = view.count;
+            result->truncated = view.truncated;
+            result->qtype = view.qtype;
+            result->qname = view.qname.to_string();
+            result->data.assign(view.data.begin(), view.data.end());
+            result->records.resize(view.records.size());
+
+            for (size_t i = 0; i < view.records.size(); i++)
+            {
+                auto& rr = view.records[i];
+                mdns_record item = { rr.type, rr.rclass, rr.ttl, rr.pos, rr.len, rr.rdpos, rr.rdlen, rr.name.to_string() };
+                result->records[i] = std::move(item);
+            }
+        }
+
+        // The positions of the record, all that the readers below look at
+        inline mdns_record Positions(const mdns_record_view& rr)
+        {
+            mdns_record result = { rr.type, rr.rclass, rr.ttl, rr.pos, rr.len, rr.rdpos, rr.rdlen };
+            return result;
+        }
+
+        inline bool ReadA(const mdns_responce_view& responce, const mdns_record_view& rr, in_addr* result)
+        {
+            return !responce.data.empty() && ReadA(responce.data.data(), responce.data.size(), Positions(rr), result);
+        }
+
+        inline bool ReadAaaa(const mdns_responce_view& responce, const mdns_record_view& rr, in6_addr* result)
+        {
+            return !responce.data.empty() && ReadAaaa(responce.data.data(), responce.data.size(), Positions(rr), result);
+        }
+
+        inline bool ReadPtr(const mdns_responce_view& responce, const mdns_record_view& rr, std::string* result)
+        {
+            return !responce.data.empty() && ReadPtr(responce.data.data(), responce.data.size(), Positions(rr), result);
+        }
+
+        inline bool ReadSrv(const mdns_responce_view& responce, const mdns_record_view& rr, mdns_srv* result)
+        {
+            return !responce.data.empty() && ReadSrv(responce.data.data(), responce.data.size(), Positions(rr), result);
+        }
+
+        inline txt_reader ReadTxt(const mdns_responce_view& responce, const mdns_record_view& rr)
+        {
+            static const uint8_t Empty = 0;
+            return responce.data.empty() ?
+                txt_reader(&Empty, 0, Positions(rr)) :
+                txt_reader(responce.data.data(), responce.data.size(), Positions(rr));
+        }
+
+        // The cache keeps a copy of every responce on the heap, which a scan into an arena is meant to
+        // avoid: it is left alone under the default policy, CachePolicy::Refresh still fills it
+        inline resolve_options ArenaOptions(const resolve_options& options)
+        {
+            auto result = options;
+            if (result.cachePolicy == CachePolicy::Default)
+                result.cachePolicy = CachePolicy::Bypass;
+
+            return result;
+        }
+
+        // Collects every distinct responce into the arena of the result, the parsing reuses
+        // one responce for all of them, mdns_responce_view::count tells how many times it came.
+        // See ArenaOptions for the cache.
+        inline bool Resolve(const std::string& serviceName, time_t scanTime, const resolve_options& options, scan_result* result)
+        {
+            result->Clear();
+
+            return Resolve(serviceName, scanTime, ArenaOptions(options), [result](mdns_responce& responce)
+            {
+                result->Add(responce);
+                return true;
+            }, [result](size_t original)
+            {
+                result->Repeated(original);
+            });
+        }
+
+        template<size_t N>
+        inline bool Resolve(const std::array<uint8_t, N>& query, time_t scanTime, const resolve_options& options, scan_result* result)
+        {
+            result->Clear();
+
+            query_packet packet = { query.data(), query.size() };
+
+            return Resolve(packet, scanTime, ArenaOptions(options), [result](mdns_responce& responce)
+            {
+                result->Add(responce);
+                return true;
+            }, [result](size_t original)
+            {
+                result->Repeated(original);
+            });
+        }
+    }
+}
+
+#endif // ZEROCONF_ARENA_HPP
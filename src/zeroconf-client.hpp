@@ -0,0 +1,208 @@
+#ifndef ZEROCONF_CLIENT_HPP
+#define ZEROCONF_CLIENT_HPP
+
+//////////////////////////////////////////////////////////////////////////
+// zeroconf-client.hpp
+
+// (C) Copyright 2016 Yuri Yakovlev <yvzmail@gmail.com>
+// Use, modification and distribution is subject to the GNU General Public License
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "zeroconf-util.hpp"
+#include "zeroconf-detail.hpp"
+
+namespace Zeroconf
+{
+    namespace Detail
+    {
+        // Resolver keeping its sockets open from one scan to the next, instead of opening and closing
+        // them for every scan. Scans may run on several threads at once: each one takes a socket_set
+        // nobody uses and gives it back when done, so the client ends up with as many sets as scans
+        // ever ran at the same time. The replies that come after their scan wait on the sockets,
+        // the next scan on them puts them in the cache first.
+        //
+        // The fan-out, the interfaces and the destination are those of the options the client
+        // is made with, the options of a scan only set the rest. With shards every set has that
+        // many sockets per port, see socket_set.
+        class client
+        {
+        public:
+            explicit client(const resolve_options& options = resolve_options(), size_t shards = 1)
+                : m_options(options), m_shards(shards), m_opened(0), m_late(0)
+            {
+                m_options.sockets = nullptr;
+            }
+
+            client(const client&) = delete;
+            client& operator=(const client&) = delete;
+
+            // Opens the first set of sockets ahead of the first scan, so that a failure shows early
+            bool Open()
+            {
+                std::unique_ptr<socket_set> sockets;
+                if (!Acquire(&sockets))
+                    return false;
+
+                Release(std::move(sockets));
+                return true;
+            }
+
+            // Closes the sockets, not while a scan runs
+            void Close()
+            {
+                std::lock_guard<std::mutex> lock(m_lock);
+                m_idle.clear();
+            }
+
+            size_t Opened() const { return m_opened; } // sets of sockets so far
+            size_t Late() const { return m_late; } // replies that came after their scan
+
+            bool Resolve(const std::string& serviceName, time_t scanTime, const resolve_options& options, const ResponceCallback& callback, const RepeatCallback& repeat = RepeatCallback())
+            {
+                return Scan(options, [&](const resolve_options& scanOptions)
+                {
+                    return Detail::Resolve(serviceName, scanTime, scanOptions, callback, repeat);
+                });
+            }
+
+            bool Resolve(const std::string& serviceName, time_t scanTime, const ResponceCallback& callback)
+            {
+                return Resolve(serviceName, scanTime, m_options, callback);
+            }
+
+            // Collects every distinct responce, mdns_responce::count tells how many times it came
+            bool Resolve(const std::string& serviceName, time_t scanTime, const resolve_options& options, std::vector<mdns_responce>* result)
+            {
+                result->clear();
+
+                return Resolve(serviceName, scanTime, options, [result](mdns_responce& responce)
+                {
+                    result->push_back(std::move(responce));
+                    return true;
+                }, CountRepeats(result));
+            }
+
+            bool Resolve(const std::string& serviceName, time_t scanTime, std::vector<mdns_responce>* result)
+            {
+                return Resolve(serviceName, scanTime, m_options, result);
+            }
+
+            // Sends a query from EncodeQuery as it is
+            template<size_t N>
+            bool Resolve(const std::array<uint8_t, N>& query, time_t scanTime, const resolve_options& options, const ResponceCallback& callback)
+            {
+                return Scan(options, [&](const resolve_options& scanOptions)
+                {
+                    return Detail::Resolve(query, scanTime, scanOptions, callback);
+                });
+            }
+
+        private:
+            template<typename Function>
+            bool Scan(const resolve_options& options, const Function& function)
+            {
+                std::unique_ptr<socket_set> sockets;
+                if (!Acquire(&sockets))
+                    return false;
+
+                Drain(options, sockets.get());
+
+                auto scanOptions = options;
+                scanOptions.sockets = sockets.get();
+
+                // a failed scan may be down to the sockets or to interfaces gone since they were opened,
+                // the set is closed and the next scan opens a new one
+                if (!function(scanOptions))
+                    return false;
+
+                Release(std::move(sockets));
+                return true;
+            }
+
+            // Takes an idle set, or opens one when all of them are busy
+            bool Acquire(std::unique_ptr<socket_set>* result)
+            {
+                {
+                    std::lock_guard<std::mutex> lock(m_lock);
+                    if (!m_idle.empty())
+                    {
+                        *result = std::move(m_idle.back());
+                        m_idle.pop_back();
+                        return true;
+                    }
+                }
+
+                std::vector<mdns_interface> interfaces;
+                if (!FanOutInterfaces(m_options, &interfaces))
+                    return false;
+
+                std::unique_ptr<socket_set> sockets(new socket_set());
+                if (!sockets->Open(interfaces, m_options.destination, m_shards))
+                    return false;
+
+                m_opened++;
+                *result = std::move(sockets);
+                return true;
+            }
+
+            void Release(std::unique_ptr<socket_set> sockets)
+            {
+                std::lock_guard<std::mutex> lock(m_lock);
+                m_idle.push_back(std::move(sockets));
+            }
+
+            // Reads what came on the sockets since their last scan, without waiting, into the cache
+            void Drain(const resolve_options& options, socket_set* sockets)
+            {
+                auto cache = options.cache != nullptr ? options.cache : &DefaultCache();
+                mdns_responce parsed = {0};
+                parse_tally parses;
+
+                for (auto fd: sockets->Fds())
+                {
+                    while (1)
+                    {
+                        fd_set ready;
+                        FD_ZERO(&ready);
+                        FD_SET(fd, &ready);
+
+                        timeval tv = {0};
+                        if (select(fd + 1, &ready, nullptr, nullptr, &tv) <= 0)
+                            break;
+
+                        auto& ring = sockets->Ring(options.maxMessageSize);
+
+                        size_t count = 0;
+                        if (!ring.Fill(fd, &count) || count == 0)
+                            break;
+
+                        for (size_t i = 0; i < count; i++)
+                        {
+                            if (ring.Truncated(i) || !Parse(ring.Peer(i), ring.Data(i), ring.Size(i), &parsed, &parses))
+                                continue;
+
+                            m_late++;
+                            if (options.cachePolicy != CachePolicy::Bypass)
+                                cache->Insert(parsed);
+                        }
+                    }
+                }
+
+                Metrics().Fold(&parses);
+            }
+
+            resolve_options m_options;
+            size_t m_shards;
+            std::atomic<size_t> m_opened;
+            std::atomic<size_t> m_late;
+            std::mutex m_lock;
+            std::vector<std::unique_ptr<socket_set>> m_idle;
+        };
+    }
+}
+
+#endif // ZEROCONF_CLIENT_HPP
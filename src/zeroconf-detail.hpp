@@ -8,31 +8,68 @@
 // Use, modification and distribution is subject to the GNU General Public License
 
 #include <vector>
+#include <array>
+#include <stdexcept>
 #include <memory>
 #include <chrono>
+#include <functional>
+#include <cctype>
+#include <map>
+#include <queue>
+#include <mutex>
+#include <condition_variable>
+#include <tuple>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 
 #ifdef WIN32
 #define WIN32_LEAN_AND_MEAN
 #include <winsock2.h>
+#include <ws2tcpip.h>
 #else
 #include <error.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/socket.h>
+#include <sys/select.h>
 #include <netinet/in.h>
+#include <net/if.h>
+#include <ifaddrs.h>
 #endif
 
 #include "zeroconf-util.hpp"
+#include "zeroconf-metrics.hpp"
 
 namespace Zeroconf
 {
     namespace Detail
     {
-        const size_t MdnsMessageMaxLength = 512;
-        const size_t MdnsRecordHeaderLength = 12;
+        const size_t MdnsMessageMaxLength = 512; // of the queries, so that they fit any link
+        const size_t MdnsMaxMessageSize = 9000;  // of what is received (RFC 6762 17)
+        const size_t MdnsReceiveBatchSize = 32;
+        const size_t MdnsRecordHeaderLength = 10; // type, class, ttl, length
+        const size_t MdnsMaxNameLength = 255;
+        const size_t MdnsMaxCompressionHops = 16;
+        const size_t MdnsMaxLabelLength = 63;
+        const size_t MdnsMaxPointerOffset = 0x3FFF;
     
         const uint8_t MdnsOffsetToken = 0xC0;
         const uint16_t MdnsResponseFlag = 0x8400;
+        const uint16_t MdnsTruncatedFlag = 0x0200;
+
+        const uint16_t MdnsTypeA = 1;
+        const uint16_t MdnsTypePtr = 12;
+        const uint16_t MdnsTypeTxt = 16;
+        const uint16_t MdnsTypeAaaa = 28;
+        const uint16_t MdnsTypeSrv = 33;
+        const uint16_t MdnsTypeAny = 255;
+
+        const uint16_t MdnsClassIn = 1;
+        const uint16_t MdnsClassMask = 0x7FFF;
+        const uint16_t MdnsCacheFlushBit = 0x8000;
 
         const uint32_t SockTrue = 1;
 
@@ -61,20 +98,55 @@ namespace Zeroconf
         struct mdns_record
         {
             uint16_t type;
+            uint16_t rclass;
+            uint32_t ttl;
             size_t pos;
             size_t len;
+            size_t rdpos;
+            size_t rdlen;
             std::string name;
         };
 
         struct mdns_responce
         {
             sockaddr_storage peer;
+            unsigned interfaceIndex; // interface the query went out on, 0 for the broadcast
+            unsigned count; // times it was received within the scan, repeats included
+            bool truncated; // the TC bit, more records follow in other packets
             uint16_t qtype;
             std::string qname;
             std::vector<uint8_t> data;
             std::vector<mdns_record> records;
         };
 
+        struct mdns_question
+        {
+            std::string name;
+            uint16_t qtype;
+        };
+
+        struct mdns_known_answer
+        {
+            std::shared_ptr<const mdns_responce> source;
+            size_t index; // of the record in the source
+            uint32_t ttl; // what is left of it
+        };
+
+        struct mdns_srv
+        {
+            uint16_t priority;
+            uint16_t weight;
+            uint16_t port;
+            std::string target;
+        };
+
+        struct mdns_txt
+        {
+            stdext::string_view key;
+            stdext::string_view value;
+            bool hasValue;
+        };
+
         inline int GetSocketError()
         {
 #ifdef WIN32
@@ -93,6 +165,22 @@ namespace Zeroconf
 #endif
         }
 
+        // The receive paths wait with select, which can't take a descriptor past FD_SETSIZE.
+        // A process with that many files open gets an error instead of a write past the fd_set.
+        inline bool Selectable(int fd)
+        {
+#ifndef WIN32
+            if (fd >= FD_SETSIZE)
+            {
+                Log::Error("Socket ", fd, " is past FD_SETSIZE (", FD_SETSIZE, "), select can't wait on it");
+                return false;
+            }
+#else
+            (void)fd;
+#endif
+            return true;
+        }
+
         inline void WriteFqdn(const std::string& name, std::vector<uint8_t>* result)
         {
             size_t len = 0;
@@ -126,278 +214,3164 @@ namespace Zeroconf
             }
         }
 
-        inline size_t ReadFqdn(const std::vector<uint8_t>& data, size_t offset, std::string* result)
+        // DNS names compare case-insensitively (RFC 4343)
+        inline bool NameEquals(const std::string& a, const std::string& b)
         {
-            result->clear();
+            if (a.size() != b.size())
+                return false;
 
-            size_t pos = offset;
-            while (1)
+            for (size_t i = 0; i < a.size(); i++)
             {
-                if (pos >= data.size())
-                    return 0;
-
-                uint8_t len = data[pos++];
-                
-                if (pos + len > data.size())
-                    return 0;
-
-                if (len == 0)
-                    break;
-
-                if (!result->empty())
-                    result->append(".");
-        
-                result->append(reinterpret_cast<const char*>(&data[pos]), len);
-                pos += len;
+                if (tolower(static_cast<unsigned char>(a[i])) != tolower(static_cast<unsigned char>(b[i])))
+                    return false;
             }
 
-            return pos - offset;
+            return true;
         }
 
-        inline bool CreateSocket(int* result)
+        const size_t MdnsMaxSuffixes = 64;
+
+        enum class MessageSection { Answer, Authority, Additional };
+
+        // Writes a DNS message into a buffer owned by the caller. The names are compressed against
+        // the suffixes written before, which the builder finds through a fixed table of offsets
+        // into the message itself, so building allocates nothing. A write that does not fit fails
+        // and leaves the message as it was, Mark and Rollback undo several writes at once.
+        class message_builder
         {
-            int fd = socket(AF_INET, SOCK_DGRAM, 0);
-            if (fd < 0)
+        public:
+            struct mark
             {
-                Log::Error("Failed to create socket with code " + std::to_string(GetSocketError()));
-                return false;
+                size_t size;
+                size_t suffixes;
+                uint16_t counts[4];
+            };
+
+            message_builder(uint8_t* buffer, size_t capacity) : m_buffer(buffer), m_capacity(capacity), m_size(0), m_suffixes(0), m_record(0)
+            {
+                Reset(0, 0);
             }
 
-            int st = setsockopt(fd, SOL_SOCKET, SO_BROADCAST, reinterpret_cast<const char*>(&SockTrue), sizeof(SockTrue));
-            if (st < 0)
+            // Starts over with an empty message
+            void Reset(uint16_t id, uint16_t flags)
             {
-                CloseSocket(fd);
-                Log::Error("Failed to set socket option SO_BROADCAST with code " + std::to_string(GetSocketError()));
-                return false;
+                m_size = 0;
+                m_suffixes = 0;
+                m_record = 0;
+                memset(m_counts, 0, sizeof(m_counts));
+
+                if (m_capacity < 12)
+                    return;
+
+                memset(m_buffer, 0, 12);
+                Put16(0, id);
+                Put16(2, flags);
+                m_size = 12;
             }
 
-            *result = fd;
-            return true;
-        }
+            const uint8_t* Data() const { return m_buffer; }
+            size_t Size() const { return m_size; }
+            size_t Capacity() const { return m_capacity; }
 
-        inline bool Send(int fd, const std::vector<uint8_t>& data)
-        {
-            sockaddr_in broadcastAddr = {0};
-            broadcastAddr.sin_family = AF_INET;
-            broadcastAddr.sin_port = htons(5353);
-            broadcastAddr.sin_addr.s_addr = INADDR_BROADCAST;
+            uint16_t Questions() const { return m_counts[0]; }
+            uint16_t Records(MessageSection section) const { return m_counts[1 + static_cast<int>(section)]; }
 
-            auto st = sendto(
-                fd, 
-                reinterpret_cast<const char*>(&data[0]), 
-                data.size(), 
-                0, 
-                reinterpret_cast<const sockaddr*>(&broadcastAddr), 
-                sizeof(broadcastAddr));
+            void SetFlags(uint16_t flags)
+            {
+                if (m_size >= 12)
+                    Put16(2, flags);
+            }
 
-            // todo: st == data.size() ???
-            if (st < 0)
+            uint16_t Flags() const
             {
-                Log::Error("Failed to send the query with code " + std::to_string(GetSocketError()));
-                return false; 
+                return m_size >= 12 ? static_cast<uint16_t>((m_buffer[2] << 8) | m_buffer[3]) : 0;
             }
 
-            return true;
-        }
+            mark Mark() const
+            {
+                mark result = { m_size, m_suffixes };
+                memcpy(result.counts, m_counts, sizeof(m_counts));
+                return result;
+            }
 
-        inline bool Receive(int fd, time_t scanTime, std::vector<raw_responce>* result)
-        {
-            auto start = std::chrono::system_clock::now();
+            void Rollback(const mark& m)
+            {
+                m_size = m.size;
+                m_suffixes = m.suffixes;
+                memcpy(m_counts, m.counts, sizeof(m_counts));
+                WriteCounts();
+            }
 
-            while (1)
+            // Questions go before any record
+            bool AddQuestion(const stdext::string_view& name, uint16_t qtype, uint16_t qclass = MdnsClassIn)
             {
-                auto now = std::chrono::system_clock::now();
-                if (now - start > std::chrono::seconds(scanTime))
-                    break;
+                auto m = Mark();
 
-                fd_set fds;
-                FD_ZERO(&fds);
-                FD_SET(fd, &fds);
+                if (!WriteName(name) || !Write16(qtype) || !Write16(qclass))
+                {
+                    Rollback(m);
+                    return false;
+                }
 
-                timeval tv = {0};
-                tv.tv_sec = static_cast<long>(scanTime);
+                m_counts[0]++;
+                WriteCounts();
+                return true;
+            }
 
-                int st = select(fd+1, &fds, nullptr, nullptr, &tv);
+            // Writes the record up to its data, which the following writes fill until EndRecord
+            bool BeginRecord(const stdext::string_view& name, uint16_t type, uint16_t rclass, uint32_t ttl)
+            {
+                auto m = Mark();
 
-                if (st < 0)
+                if (!WriteName(name) || !Write16(type) || !Write16(rclass) || 
+                    !Write16(static_cast<uint16_t>(ttl >> 16)) || !Write16(static_cast<uint16_t>(ttl)) || !Write16(0))
                 {
-                    Log::Error("Failed to wait on socket with code " + std::to_string(GetSocketError()));
-                    return false; 
+                    Rollback(m);
+                    return false;
                 }
 
-                if (st > 0)
-                {
-#ifdef WIN32
-                    int salen = sizeof(sockaddr_storage);
-#else
-                    unsigned int salen = sizeof(sockaddr_storage);
-#endif
+                m_record = m_size;
+                return true;
+            }
 
-                    raw_responce item;
-                    item.data.resize(MdnsMessageMaxLength);                    
+            // Sets the data length and counts the record in the section
+            void EndRecord(MessageSection section)
+            {
+                size_t rdlen = m_size - m_record;
+                Put16(m_record - 2, static_cast<uint16_t>(rdlen));
 
-                    auto cb = recvfrom(
-                        fd, 
-                        reinterpret_cast<char*>(&item.data[0]), 
-                        item.data.size(), 
-                        0, 
-                        reinterpret_cast<sockaddr*>(&item.peer), 
-                        &salen);
+                m_counts[1 + static_cast<int>(section)]++;
+                WriteCounts();
+            }
 
-                    if (cb < 0)
-                    {
-                        Log::Error("Failed to receive with code " + std::to_string(GetSocketError()));
-                        return false; 
-                    }
+            bool AddRecord(
+                MessageSection section, 
+                const stdext::string_view& name, 
+                uint16_t type, 
+                uint16_t rclass, 
+                uint32_t ttl, 
+                const uint8_t* rdata, 
+                size_t rdlen)
+            {
+                auto m = Mark();
 
-                    item.data.resize((size_t)cb);
-                    result->push_back(item);
+                if (!BeginRecord(name, type, rclass, ttl) || !WriteBytes(rdata, rdlen))
+                {
+                    Rollback(m);
+                    return false;
                 }
-            }
 
-            return true;
-        }
-
-        inline bool Parse(const raw_responce& input, mdns_responce* result)
-        {
-            // Structure:
-            //   header (12b) 
-            //   qname fqdn
-            //   qtype (2b)
-            //   qclass (2b)
-            //   0xc0
-            //   name offset (1b)
-            //   DNS RR
-            //
-            // Note:
-            //   GCC has bug in is.ignore(n)
+                EndRecord(section);
+                return true;
+            }
 
-            if (input.data.empty())
-                return false;
+            bool Write16(uint16_t value)
+            {
+                if (m_capacity - m_size < 2)
+                    return false;
 
-            result->qname.clear();
-            result->records.clear();
+                Put16(m_size, value);
+                m_size += 2;
+                return true;
+            }
 
-            memcpy(&result->peer, &input.peer, sizeof(sockaddr_storage));
-            result->data = input.data;
+            bool WriteBytes(const uint8_t* data, size_t size)
+            {
+                if (m_capacity - m_size < size)
+                    return false;
 
-            stdext::membuf buf(&input.data[0], input.data.size());
-            std::istream is(&buf);
+                if (size != 0)
+                    memcpy(m_buffer + m_size, data, size);
 
-            const auto Flags = std::istream::failbit | std::istream::badbit | std::istream::eofbit;
-            is.exceptions(Flags);
+                m_size += size;
+                return true;
+            }
 
-            try
+            // Writes the name, pointing to the longest suffix already in the message. Fails on empty
+            // names, labels longer than 63 bytes and names longer than 255 bytes.
+            bool WriteName(const stdext::string_view& name)
             {
-                uint8_t u8;
-                uint16_t u16;
+                uint8_t starts[MdnsMaxNameLength];
+                uint8_t lengths[MdnsMaxNameLength];
+                size_t count = 0;
+                size_t encoded = 1;
 
-                is.ignore(); // id
-                is.ignore();
-    
-                is.read(reinterpret_cast<char*>(&u16), 2); // flags
-                if (ntohs(u16) != MdnsResponseFlag)
-                {
-                    Log::Warning("Found unexpected Flags value while parsing responce");
+                if (name.size() > MdnsMaxNameLength)
                     return false;
-                }
 
-                for (auto i = 0; i < 8; i++)
-                    is.ignore(); // qdcount, ancount, nscount, arcount
-
-                size_t cb = ReadFqdn(input.data, static_cast<size_t>(is.tellg()), &result->qname);
-                if (cb == 0)
+                for (size_t i = 0; i < name.size(); )
                 {
-                    Log::Error("Failed to parse query name");
-                    return false;
+                    size_t next = i;
+                    while (next < name.size() && name[next] != '.')
+                        next++;
+
+                    if (next - i > MdnsMaxLabelLength)
+                        return false;
+
+                    if (next > i)
+                    {
+                        starts[count] = static_cast<uint8_t>(i);
+                        lengths[count] = static_cast<uint8_t>(next - i);
+                        encoded += next - i + 1;
+                        count++;
+                    }
+
+                    i = next + 1;
                 }
 
-                for (auto i = 0; i < cb; i++)
-                    is.ignore(); // qname
-        
-                is.read(reinterpret_cast<char*>(&u16), 2); // qtype
-                result->qtype = ntohs(u16);
+                if (count == 0 || encoded > MdnsMaxNameLength)
+                    return false;
 
-                is.ignore(); // qclass
-                is.ignore();
+                size_t size = m_size;
+                size_t suffixes = m_suffixes;
 
-                while (1)
+                for (size_t i = 0; i < count; i++)
                 {
-                    is.exceptions(std::istream::goodbit);
-                    if (is.peek() == EOF)
-                        break;
-                    is.exceptions(Flags);
-
-                    mdns_record rr = {0};
-                    rr.pos = static_cast<size_t>(is.tellg());
+                    for (size_t j = 0; j < m_suffixes; j++)
+                    {
+                        if (!SuffixEquals(name, starts + i, lengths + i, count - i, m_offsets[j]))
+                            continue;
+
+                        if (m_capacity - m_size < 2)
+                        {
+                            m_size = size;
+                            m_suffixes = suffixes;
+                            return false;
+                        }
+
+                        Put16(m_size, static_cast<uint16_t>((MdnsOffsetToken << 8) | m_offsets[j]));
+                        m_size += 2;
+                        return true;
+                    }
 
-                    is.read(reinterpret_cast<char*>(&u8), 1); // offset token
-                    if (u8 != MdnsOffsetToken)
+                    if (m_capacity - m_size < 1u + lengths[i] + 1u)
                     {
-                        Log::Warning("Found incorrect offset token while parsing responce");
+                        m_size = size;
+                        m_suffixes = suffixes;
                         return false;
                     }
 
-                    is.read(reinterpret_cast<char*>(&u8), 1); // offset value
-                    if ((size_t)u8 >= input.data.size() || (size_t)u8 + input.data[u8] >= input.data.size())
+                    if (m_size <= MdnsMaxPointerOffset && m_suffixes < MdnsMaxSuffixes)
+                        m_offsets[m_suffixes++] = static_cast<uint16_t>(m_size);
+
+                    m_buffer[m_size++] = lengths[i];
+                    memcpy(m_buffer + m_size, name.data() + starts[i], lengths[i]);
+                    m_size += lengths[i];
+                }
+
+                m_buffer[m_size++] = 0;
+                return true;
+            }
+
+        private:
+            void Put16(size_t pos, uint16_t value)
+            {
+                m_buffer[pos] = static_cast<uint8_t>(value >> 8);
+                m_buffer[pos + 1] = static_cast<uint8_t>(value);
+            }
+
+            void WriteCounts()
+            {
+                if (m_size < 12)
+                    return;
+
+                for (int i = 0; i < 4; i++)
+                    Put16(4 + i * 2, m_counts[i]);
+            }
+
+            // Whether the labels match the name written at the offset, which only points backwards
+            bool SuffixEquals(const stdext::string_view& name, const uint8_t* starts, const uint8_t* lengths, size_t count, size_t offset) const
+            {
+                for (size_t i = 0; ; )
+                {
+                    uint8_t length = m_buffer[offset];
+
+                    if ((length & MdnsOffsetToken) == MdnsOffsetToken)
                     {
-                        Log::Warning("Failed to parse record name");
+                        offset = ((length & ~MdnsOffsetToken) << 8) | m_buffer[offset + 1];
+                        continue;
+                    }
+
+                    if (length == 0 || i == count)
+                        return length == 0 && i == count;
+
+                    if (length != lengths[i])
                         return false;
+
+                    for (size_t k = 0; k < length; k++)
+                    {
+                        if (tolower(m_buffer[offset + 1 + k]) != tolower(static_cast<unsigned char>(name[starts[i] + k])))
+                            return false;
                     }
 
-                    rr.name = std::string(reinterpret_cast<const char*>(&input.data[u8 + 1]), input.data[u8]);
+                    offset += 1 + length;
+                    i++;
+                }
+            }
+
+            uint8_t* m_buffer;
+            size_t m_capacity;
+            size_t m_size;
+            size_t m_suffixes;
+            size_t m_record;
+            uint16_t m_counts[4];
+            uint16_t m_offsets[MdnsMaxSuffixes];
+        };
+
+        // Leaves the result empty when the name cannot be encoded
+        inline void WriteQuery(const std::string& name, uint16_t qtype, uint16_t id, std::vector<uint8_t>* result)
+        {
+            uint8_t buffer[12 + MdnsMaxNameLength + 4];
+            message_builder builder(buffer, sizeof(buffer));
+            builder.Reset(id, 0);
+
+            result->clear();
+            if (builder.AddQuestion(name, qtype))
+                result->assign(builder.Data(), builder.Data() + builder.Size());
+        }
+
+        // A query encoded elsewhere, such as by EncodeQuery
+        struct query_packet
+        {
+            const uint8_t* data;
+            size_t size;
+        };
+
+        template<size_t... I> struct index_list {};
+        template<size_t N, size_t... I> struct make_index_list : make_index_list<N - 1, N - 1, I...> {};
+        template<size_t... I> struct make_index_list<0, I...> { typedef index_list<I...> type; };
+
+        // Length of the label starting at pos
+        constexpr size_t LabelLength(const char* name, size_t size, size_t pos)
+        {
+            return pos < size && name[pos] != '.' ? 1 + LabelLength(name, size, pos + 1) : 0;
+        }
+
+        // Every label from pos on has 1 to 63 bytes, so a trailing dot is not allowed either
+        constexpr bool ValidLabels(const char* name, size_t size, size_t pos)
+        {
+            return LabelLength(name, size, pos) != 0 && LabelLength(name, size, pos) <= MdnsMaxLabelLength &&
+                (pos + LabelLength(name, size, pos) == size || ValidLabels(name, size, pos + LabelLength(name, size, pos) + 1));
+        }
+
+        // Byte i of the query: the header with one question, the labels, QTYPE and QCLASS IN
+        constexpr uint8_t QueryByte(const char* name, size_t size, uint16_t qtype, size_t i)
+        {
+            return static_cast<uint8_t>(
+                i == 5 ? 1 :
+                i < 12 ? 0 :
+                i == 12 ? LabelLength(name, size, 0) :
+                i < 13 + size ? (name[i - 13] == '.' ? LabelLength(name, size, i - 12) : name[i - 13]) :
+                i == 13 + size ? 0 :
+                i == 14 + size ? qtype >> 8 :
+                i == 15 + size ? qtype & 0xFF :
+                i == 16 + size ? 0 : MdnsClassIn);
+        }
+
+        template<size_t N, size_t... I>
+        constexpr std::array<uint8_t, sizeof...(I)> EncodeQuery(const char (&name)[N], uint16_t qtype, index_list<I...>)
+        {
+            return ValidLabels(name, N - 1, 0) ? 
+                std::array<uint8_t, sizeof...(I)>{{ QueryByte(name, N - 1, qtype, I)... }} : 
+                throw std::invalid_argument("Invalid query name");
+        }
+
+        // Encodes the query for a name known at compile time, as WriteQuery does with ID 0.
+        // Used in a constant expression, a malformed name fails to compile.
+        template<size_t N>
+        constexpr std::array<uint8_t, N + 17> EncodeQuery(const char (&name)[N], uint16_t qtype = MdnsTypePtr)
+        {
+            static_assert(N + 1 <= MdnsMaxNameLength, "The query name is too long");
+            return EncodeQuery(name, qtype, typename make_index_list<N + 17>::type());
+        }
+
+        inline size_t ReadFqdn(const uint8_t* data, size_t size, size_t offset, std::string* result)
+        {
+            // Follows compression pointers (RFC 1035 4.1.4) anywhere in the message.
+            // Every pointer must land before the start of the labels it was reached from,
+            // which rules out loops, and the number of hops is capped on top of that.
+            //
+            // Returns the number of bytes the name occupies at the offset, 0 on failure.
+            // The result is cleared but keeps its capacity, so it can be reused across calls.
+
+            result->clear();
+
+            size_t pos = offset;
+            size_t start = offset; // start of the current run of labels
+            size_t end = 0; // end of the name at the original offset, once a pointer is taken
+            size_t hops = 0;
+            size_t length = 0;
 
-                    is.read(reinterpret_cast<char*>(&u16), 2); // type
-                    rr.type = ntohs(u16);
+            while (1)
+            {
+                if (pos >= size)
+                    return 0;
 
-                    for (auto i = 0; i < 6; i++)
-                        is.ignore(); // qclass, ttl
+                uint8_t len = data[pos++];
+                
+                if ((len & MdnsOffsetToken) == MdnsOffsetToken)
+                {
+                    if (pos >= size || ++hops > MdnsMaxCompressionHops)
+                        return 0;
 
-                    is.read(reinterpret_cast<char*>(&u16), 2); // length
+                    size_t target = (static_cast<size_t>(len & ~MdnsOffsetToken) << 8) | data[pos++];
+                    if (target >= start)
+                        return 0;
 
-                    for (auto i = 0; i < ntohs(u16); i++)
-                        is.ignore(); // data
+                    if (end == 0)
+                        end = pos;
 
-                    rr.len = MdnsRecordHeaderLength + ntohs(u16);
-                    result->records.push_back(rr);
+                    pos = start = target;
+                    continue;
                 }
+
+                if ((len & MdnsOffsetToken) != 0)
+                    return 0; // reserved label type
+
+                if (pos + len > size)
+                    return 0;
+
+                if (len == 0)
+                    break;
+
+                length += len + 1;
+                if (length >= MdnsMaxNameLength) // including the trailing zero
+                    return 0;
+
+                if (!result->empty())
+                    result->append(".");
+        
+                result->append(reinterpret_cast<const char*>(&data[pos]), len);
+                pos += len;
+            }
+
+            return (end != 0 ? end : pos) - offset;
+        }
+
+        inline size_t ReadFqdn(const std::vector<uint8_t>& data, size_t offset, std::string* result)
+        {
+            if (data.empty())
+            {
+                result->clear();
+                return 0;
             }
-            catch (const std::istream::failure& ex)
+
+            return ReadFqdn(&data[0], data.size(), offset, result);
+        }
+
+        // Lets more sockets bind the same port, the kernel spreads the datagrams over them by peer
+        inline bool ReusePort(int fd)
+        {
+#ifdef SO_REUSEPORT
+            if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, reinterpret_cast<const char*>(&SockTrue), sizeof(SockTrue)) < 0)
             {
-                Log::Warning(std::string("Stream error while parsing responce: ") + ex.what());
+                Log::Error("Failed to set socket option SO_REUSEPORT with code ", GetSocketError());
                 return false;
             }
 
             return true;
+#else
+            Log::Error("Sharing a port between sockets is not supported on this platform");
+            return false;
+#endif
         }
 
-        inline bool Resolve(const std::string& serviceName, time_t scanTime, std::vector<mdns_responce>* result)
+        // Port the socket is bound to, 0 when it is not
+        inline uint16_t LocalPort(int fd)
         {
-            result->clear();
-
-            std::vector<uint8_t> query;
-            query.insert(query.end(), std::begin(MdnsQueryHeader), std::end(MdnsQueryHeader));
-            WriteFqdn(serviceName, &query);
-            query.insert(query.end(), std::begin(MdnsQueryFooter), std::end(MdnsQueryFooter));
+            sockaddr_storage local = {0};
+            socklen_t salen = sizeof(local);
+            if (getsockname(fd, reinterpret_cast<sockaddr*>(&local), &salen) < 0)
+            {
+                Log::Error("Failed to get socket address with code ", GetSocketError());
+                return 0;
+            }
 
-            int fd = 0;
-            if (!CreateSocket(&fd))
-                return false;
+            if (local.ss_family == AF_INET6)
+                return ntohs(reinterpret_cast<const sockaddr_in6&>(local).sin6_port);
 
-            std::shared_ptr<void> guard(0, [fd](void*) { CloseSocket(fd); });
+            return ntohs(reinterpret_cast<const sockaddr_in&>(local).sin_port);
+        }
 
-            if (!Send(fd, query))
+        // Socket for the broadcast. A shared one is bound to the port right away, any port when it's 0,
+        // so that more sockets can bind it after it. An unshared one gets an ephemeral port with the first send.
+        inline bool CreateSocket(uint16_t port, bool shared, int* result)
+        {
+            int fd = socket(AF_INET, SOCK_DGRAM, 0);
+            if (fd < 0)
+            {
+                Log::Error("Failed to create socket with code ", GetSocketError());
                 return false;
-            
-            std::vector<raw_responce> responces;
-            if (!Receive(fd, scanTime, &responces))
+            }
+
+            if (!Selectable(fd))
+            {
+                CloseSocket(fd);
                 return false;
-            
-            for (auto& raw: responces)
+            }
+
+            int st = setsockopt(fd, SOL_SOCKET, SO_BROADCAST, reinterpret_cast<const char*>(&SockTrue), sizeof(SockTrue));
+            if (st < 0)
             {
-                mdns_responce parsed = {0};
-                if (Parse(raw, &parsed))
-                    result->push_back(parsed);
+                CloseSocket(fd);
+                Log::Error("Failed to set socket option SO_BROADCAST with code ", GetSocketError());
+                return false;
+            }
+
+            if (shared)
+            {
+                if (!ReusePort(fd))
+                {
+                    CloseSocket(fd);
+                    return false;
+                }
+
+                sockaddr_in local = {0};
+                local.sin_family = AF_INET;
+                local.sin_port = htons(port);
+                local.sin_addr.s_addr = htonl(INADDR_ANY);
+
+                if (bind(fd, reinterpret_cast<const sockaddr*>(&local), sizeof(local)) < 0)
+                {
+                    CloseSocket(fd);
+                    Log::Error("Failed to bind socket to port ", port, " with code ", GetSocketError());
+                    return false;
+                }
+            }
+
+            *result = fd;
+            return true;
+        }
+
+        inline bool CreateSocket(int* result)
+        {
+            return CreateSocket(0, false, result);
+        }
+
+        inline sockaddr_storage BroadcastAddress()
+        {
+            sockaddr_storage result = {0};
+
+            auto addr = reinterpret_cast<sockaddr_in*>(&result);
+            addr->sin_family = AF_INET;
+            addr->sin_port = htons(5353);
+            addr->sin_addr.s_addr = INADDR_BROADCAST;
+
+            return result;
+        }
+
+        inline bool Send(int fd, const uint8_t* data, size_t size, const sockaddr_storage& destination)
+        {
+            auto salen = destination.ss_family == AF_INET6 ? sizeof(sockaddr_in6) : sizeof(sockaddr_in);
+            auto start = metrics::Now();
+
+            auto st = sendto(
+                fd, 
+                reinterpret_cast<const char*>(data), 
+                static_cast<int>(size), 
+                0, 
+                reinterpret_cast<const sockaddr*>(&destination), 
+                static_cast<int>(salen));
+
+            // todo: st == data.size() ???
+            if (st < 0)
+            {
+                Metrics().SendFailed();
+                Log::Error("Failed to send the query with code ", GetSocketError());
+                return false; 
+            }
+
+            Metrics().Sent(size, metrics::Now() - start);
+            return true;
+        }
+
+        inline bool Send(int fd, const std::vector<uint8_t>& data)
+        {
+            return Send(fd, &data[0], data.size(), BroadcastAddress());
+        }
+
+        struct mdns_interface
+        {
+            unsigned index;
+            std::string name;
+            sockaddr_storage address; // IPv4 address or IPv6 link-local address, the family tells which
+        };
+
+        // Lists the multicast capable interfaces that are up, except the loopback,
+        // with one IPv4 and one IPv6 link-local entry at most per interface
+        inline bool ListInterfaces(std::vector<mdns_interface>* result)
+        {
+            result->clear();
+
+#ifdef WIN32
+            Log::Error("Listing interfaces is not supported on this platform");
+            return false;
+#else
+            ifaddrs* list = nullptr;
+            if (getifaddrs(&list) < 0)
+            {
+                Log::Error("Failed to list interfaces with code ", GetSocketError());
+                return false;
+            }
+
+            std::shared_ptr<ifaddrs> guard(list, freeifaddrs);
+
+            for (auto it = list; it != nullptr; it = it->ifa_next)
+            {
+                if (it->ifa_addr == nullptr || (it->ifa_flags & IFF_UP) == 0 || (it->ifa_flags & IFF_MULTICAST) == 0 || (it->ifa_flags & IFF_LOOPBACK) != 0)
+                    continue;
+
+                auto family = it->ifa_addr->sa_family;
+                if (family != AF_INET && family != AF_INET6)
+                    continue;
+
+                if (family == AF_INET6 && !IN6_IS_ADDR_LINKLOCAL(&reinterpret_cast<const sockaddr_in6*>(it->ifa_addr)->sin6_addr))
+                    continue;
+
+                auto index = if_nametoindex(it->ifa_name);
+                if (index == 0)
+                    continue;
+
+                auto known = std::find_if(result->begin(), result->end(), [&](const mdns_interface& item)
+                {
+                    return item.index == index && item.address.ss_family == family;
+                });
+
+                if (known != result->end())
+                    continue;
+
+                mdns_interface item;
+                item.index = index;
+                item.name = it->ifa_name;
+                memset(&item.address, 0, sizeof(sockaddr_storage));
+                memcpy(&item.address, it->ifa_addr, family == AF_INET ? sizeof(sockaddr_in) : sizeof(sockaddr_in6));
+
+                result->push_back(item);
+            }
+
+            return true;
+#endif
+        }
+
+        // The mDNS group of the family, ff02::fb is scoped to the interface
+        inline sockaddr_storage MulticastAddress(int family, unsigned index)
+        {
+            sockaddr_storage result = {0};
+
+            if (family == AF_INET6)
+            {
+                const uint8_t Group[] = { 0xff, 0x02, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xfb };
+
+                auto addr = reinterpret_cast<sockaddr_in6*>(&result);
+                addr->sin6_family = AF_INET6;
+                addr->sin6_port = htons(5353);
+                addr->sin6_scope_id = index;
+                memcpy(&addr->sin6_addr, Group, sizeof(Group));
+            }
+            else
+            {
+                auto addr = reinterpret_cast<sockaddr_in*>(&result);
+                addr->sin_family = AF_INET;
+                addr->sin_port = htons(5353);
+                addr->sin_addr.s_addr = htonl(0xE00000FB); // 224.0.0.251
+            }
+
+            return result;
+        }
+
+        // Socket sending to the mDNS group through the interface. It's bound to the interface address,
+        // so the unicast replies to its port come back on the same interface. The port is an ephemeral
+        // one when 0, a shared socket lets more sockets bind it after it.
+        inline bool CreateSocket(const mdns_interface& itf, uint16_t port, bool shared, int* result)
+        {
+            auto family = itf.address.ss_family;
+
+            int fd = socket(family, SOCK_DGRAM, 0);
+            if (fd < 0)
+            {
+                Log::Error("Failed to create socket with code ", GetSocketError());
+                return false;
+            }
+
+            if (!Selectable(fd))
+            {
+                CloseSocket(fd);
+                return false;
+            }
+
+            std::string option;
+            int st = 0;
+            int hops = 255;
+
+            if (family == AF_INET6)
+            {
+                st = setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, reinterpret_cast<const char*>(&SockTrue), sizeof(SockTrue));
+                option = "IPV6_V6ONLY";
+
+                if (st >= 0)
+                {
+                    st = setsockopt(fd, IPPROTO_IPV6, IPV6_MULTICAST_IF, reinterpret_cast<const char*>(&itf.index), sizeof(itf.index));
+                    option = "IPV6_MULTICAST_IF";
+                }
+
+                if (st >= 0)
+                {
+                    st = setsockopt(fd, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, reinterpret_cast<const char*>(&hops), sizeof(hops));
+                    option = "IPV6_MULTICAST_HOPS";
+                }
+            }
+            else
+            {
+                auto addr = reinterpret_cast<const sockaddr_in*>(&itf.address);
+
+                st = setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF, reinterpret_cast<const char*>(&addr->sin_addr), sizeof(in_addr));
+                option = "IP_MULTICAST_IF";
+
+                if (st >= 0)
+                {
+                    st = setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, reinterpret_cast<const char*>(&hops), sizeof(hops));
+                    option = "IP_MULTICAST_TTL";
+                }
+            }
+
+            if (st < 0)
+            {
+                CloseSocket(fd);
+                Log::Error("Failed to set socket option ", option, " with code ", GetSocketError());
+                return false;
+            }
+
+            if (shared && !ReusePort(fd))
+            {
+                CloseSocket(fd);
+                return false;
+            }
+
+            sockaddr_storage local = itf.address;
+            if (family == AF_INET6)
+            {
+                reinterpret_cast<sockaddr_in6*>(&local)->sin6_port = htons(port);
+                reinterpret_cast<sockaddr_in6*>(&local)->sin6_scope_id = itf.index;
+            }
+            else
+            {
+                reinterpret_cast<sockaddr_in*>(&local)->sin_port = htons(port);
+            }
+
+            auto salen = family == AF_INET6 ? sizeof(sockaddr_in6) : sizeof(sockaddr_in);
+            if (bind(fd, reinterpret_cast<const sockaddr*>(&local), static_cast<int>(salen)) < 0)
+            {
+                CloseSocket(fd);
+                Log::Error("Failed to bind socket to interface ", itf.name, " with code ", GetSocketError());
+                return false;
+            }
+
+            *result = fd;
+            return true;
+        }
+
+        inline bool CreateSocket(const mdns_interface& itf, int* result)
+        {
+            return CreateSocket(itf, 0, false, result);
+        }
+
+        // Fixed set of reusable receive buffers, filled by a single recvmmsg call on Linux
+        // and one recvfrom call elsewhere. The slots are reused by every batch.
+        // A datagram longer than a slot is cut and marked as truncated.
+        class receive_ring
+        {
+        public:
+            explicit receive_ring(size_t count = MdnsReceiveBatchSize, size_t length = MdnsMaxMessageSize)
+                : m_count(count), m_length(length), m_buffer(count * length + 1), m_peers(count), m_sizes(count), m_truncated(count)
+            {
+#if defined(__linux__)
+                m_vectors.resize(count);
+                m_headers.resize(count);
+
+                for (size_t i = 0; i < count; i++)
+                {
+                    m_vectors[i].iov_base = &m_buffer[i * length];
+                    m_vectors[i].iov_len = length;
+
+                    memset(&m_headers[i], 0, sizeof(mmsghdr));
+                    m_headers[i].msg_hdr.msg_name = &m_peers[i];
+                    m_headers[i].msg_hdr.msg_iov = &m_vectors[i];
+                    m_headers[i].msg_hdr.msg_iovlen = 1;
+                }
+#endif
+            }
+
+            receive_ring(const receive_ring&) = delete;
+            receive_ring& operator=(const receive_ring&) = delete;
+
+            size_t Capacity() const { return m_count; }
+            const sockaddr_storage& Peer(size_t i) const { return m_peers[i]; }
+            const uint8_t* Data(size_t i) const { return &m_buffer[i * m_length]; }
+            size_t Size(size_t i) const { return m_sizes[i]; }
+            size_t Length() const { return m_length; }
+            bool Truncated(size_t i) const { return m_truncated[i] != 0; }
+
+            // Reads the datagrams waiting on the socket into the slots
+            bool Fill(int fd, size_t* count)
+            {
+                *count = 0;
+
+#if defined(__linux__)
+                for (size_t i = 0; i < m_count; i++)
+                    m_headers[i].msg_hdr.msg_namelen = sizeof(sockaddr_storage);
+
+                int st = recvmmsg(fd, &m_headers[0], static_cast<unsigned int>(m_count), MSG_DONTWAIT, nullptr);
+                if (st < 0)
+                    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+
+                for (int i = 0; i < st; i++)
+                {
+                    m_sizes[i] = m_headers[i].msg_len;
+                    m_truncated[i] = (m_headers[i].msg_hdr.msg_flags & MSG_TRUNC) != 0;
+                }
+
+                *count = static_cast<size_t>(st);
+#else
+#ifdef WIN32
+                int salen = sizeof(sockaddr_storage);
+#else
+                socklen_t salen = sizeof(sockaddr_storage);
+#endif
+
+                // one byte more than the slot tells a longer datagram
+                auto cb = recvfrom(
+                    fd, 
+                    reinterpret_cast<char*>(&m_buffer[0]), 
+                    static_cast<int>(m_length + 1), 
+                    0, 
+                    reinterpret_cast<sockaddr*>(&m_peers[0]), 
+                    &salen);
+
+#ifdef WIN32
+                if (cb < 0 && WSAGetLastError() == WSAEMSGSIZE)
+                    cb = static_cast<int>(m_length + 1);
+#endif
+
+                if (cb < 0)
+                    return false;
+
+                m_sizes[0] = std::min(static_cast<size_t>(cb), m_length);
+                m_truncated[0] = static_cast<size_t>(cb) > m_length;
+                *count = 1;
+#endif
+                return true;
+            }
+
+        private:
+            size_t m_count;
+            size_t m_length;
+            std::vector<uint8_t> m_buffer;
+            std::vector<sockaddr_storage> m_peers;
+            std::vector<size_t> m_sizes;
+            std::vector<uint8_t> m_truncated;
+#if defined(__linux__)
+            std::vector<iovec> m_vectors;
+            std::vector<mmsghdr> m_headers;
+#endif
+        };
+
+        // Sockets of a scan: one for the broadcast, or one per interface of the fan-out. With shards
+        // each of them gets more sockets bound to its port through SO_REUSEPORT, the kernel spreads
+        // the replies over them by peer, and each one has a receive buffer of its own. Only the first
+        // socket of a port sends. The set may serve any number of scans one after another, and keeps
+        // the receive_ring and the query packets for the next one.
+        class socket_set
+        {
+        public:
+            socket_set() : m_scans(0)
+            {
+            }
+
+            ~socket_set()
+            {
+                Close();
+            }
+
+            socket_set(const socket_set&) = delete;
+            socket_set& operator=(const socket_set&) = delete;
+
+            // Sends to the destination when the list of interfaces is empty, otherwise to the mDNS
+            // group on each of them. A failing interface leaves the others to work.
+            bool Open(const std::vector<mdns_interface>& interfaces, const sockaddr_storage& destination, size_t shards = 1)
+            {
+                Close();
+
+                shards = std::max<size_t>(shards, 1);
+
+                if (interfaces.empty())
+                    return OpenShards(nullptr, destination, shards);
+
+                for (auto& itf: interfaces)
+                {
+                    if (!OpenShards(&itf, MulticastAddress(itf.address.ss_family, itf.index), shards))
+                        Log::Warning("Skipping interface ", itf.name);
+                }
+
+                return !m_fds.empty();
+            }
+
+            void Close()
+            {
+                for (auto fd: m_fds)
+                    CloseSocket(fd);
+
+                m_fds.clear();
+                m_indexes.clear();
+                m_destinations.clear();
+                m_scans = 0;
+            }
+
+            bool IsOpen() const { return !m_fds.empty(); }
+            const std::vector<int>& Fds() const { return m_fds; }
+
+            // Interface of the socket, 0 for the broadcast
+            unsigned Index(size_t i) const { return m_indexes[i]; }
+
+            bool Sends(size_t i) const { return m_destinations[i].ss_family != AF_UNSPEC; }
+            const sockaddr_storage& Destination(size_t i) const { return m_destinations[i]; }
+
+            // Scans run on the set so far, the sockets of a later one may still get replies to an earlier one
+            size_t Scans() const { return m_scans; }
+            void Scanned() { m_scans++; }
+
+            // Made on the first use and again only for another length
+            receive_ring& Ring(size_t length)
+            {
+                if (!m_ring || m_ring->Length() != length)
+                    m_ring.reset(new receive_ring(MdnsReceiveBatchSize, length));
+
+                return *m_ring;
+            }
+
+            std::vector<std::vector<uint8_t>>& Queries() { return m_queries; }
+
+        private:
+            bool OpenShards(const mdns_interface* itf, const sockaddr_storage& destination, size_t shards)
+            {
+                size_t first = m_fds.size();
+                uint16_t port = 0;
+                bool shared = shards > 1;
+
+                for (size_t i = 0; i < shards; i++)
+                {
+                    int fd = -1;
+                    bool st = itf != nullptr ? CreateSocket(*itf, port, shared, &fd) : CreateSocket(port, shared, &fd);
+
+                    // the others bind the port the first one got
+                    if (st && shared && i == 0)
+                    {
+                        port = LocalPort(fd);
+                        st = port != 0;
+                        if (!st)
+                            CloseSocket(fd);
+                    }
+
+                    if (!st)
+                    {
+                        for (size_t j = first; j < m_fds.size(); j++)
+                            CloseSocket(m_fds[j]);
+
+                        m_fds.resize(first);
+                        m_indexes.resize(first);
+                        m_destinations.resize(first);
+                        return false;
+                    }
+
+                    sockaddr_storage none = {0};
+                    none.ss_family = AF_UNSPEC;
+
+                    m_fds.push_back(fd);
+                    m_indexes.push_back(itf != nullptr ? itf->index : 0);
+                    m_destinations.push_back(i == 0 ? destination : none);
+                }
+
+                return true;
+            }
+
+            std::vector<int> m_fds;
+            std::vector<unsigned> m_indexes;
+            std::vector<sockaddr_storage> m_destinations; // AF_UNSPEC for the sockets that only receive
+            size_t m_scans;
+            std::unique_ptr<receive_ring> m_ring;
+            std::vector<std::vector<uint8_t>> m_queries;
+        };
+
+        const std::chrono::milliseconds MdnsRetransmitInterval(1000);
+
+        struct completion_policy
+        {
+            completion_policy() : peers(0), quietPeriod(0), deadline(0), retransmit(MdnsRetransmitInterval) {}
+
+            size_t peers;                          // done once that many distinct hosts answered, 0 for no limit
+            std::chrono::milliseconds quietPeriod; // done after that long without packets, 0 to wait the whole scan
+            std::chrono::milliseconds deadline;    // replaces the scan time when not 0
+            std::chrono::milliseconds retransmit;  // first re-send of the query, doubled after each (RFC 6762 5.2), 0 to send once
+        };
+
+        // Progress of a scan against its completion policy. The quiet period runs from the start
+        // of the scan and restarts with every packet, each check costs a few comparisons.
+        // Re-sends are due 1s, 3s, 7s... into the scan, and only while it's still going
+        class scan_state
+        {
+        public:
+            typedef std::chrono::steady_clock clock;
+
+            explicit scan_state(time_t scanTime, const completion_policy& policy = completion_policy(), clock::time_point now = clock::now())
+                : m_policy(policy), m_last(now), m_interval(policy.retransmit), m_resend(now + policy.retransmit), m_done(false)
+            {
+                if (policy.deadline.count() > 0)
+                    m_end = now + policy.deadline;
+                else
+                    m_end = now + std::chrono::seconds(scanTime);
+            }
+
+            // Time left until the scan is over unless a packet comes, rounded up, 0 once it's over
+            std::chrono::milliseconds Left(clock::time_point now = clock::now()) const
+            {
+                auto end = m_end;
+                if (m_policy.quietPeriod.count() > 0 && m_last + m_policy.quietPeriod < end)
+                    end = m_last + m_policy.quietPeriod;
+
+                if (m_done || end <= now)
+                    return std::chrono::milliseconds(0);
+
+                auto left = std::chrono::duration_cast<std::chrono::milliseconds>(end - now);
+                return end - now > left ? left + std::chrono::milliseconds(1) : left;
+            }
+
+            bool Done(clock::time_point now = clock::now()) const
+            {
+                return Left(now).count() == 0;
+            }
+
+            // Time until the query is due again, rounded up, max when no more re-sends fit in the scan
+            std::chrono::milliseconds UntilRetransmit(clock::time_point now = clock::now()) const
+            {
+                if (m_interval.count() <= 0 || m_resend >= m_end || Done(now))
+                    return std::chrono::milliseconds::max();
+
+                if (m_resend <= now)
+                    return std::chrono::milliseconds(0);
+
+                auto left = std::chrono::duration_cast<std::chrono::milliseconds>(m_resend - now);
+                return m_resend - now > left ? left + std::chrono::milliseconds(1) : left;
+            }
+
+            // Backs off, the next re-send is twice as far
+            void Retransmitted(clock::time_point now = clock::now())
+            {
+                m_interval *= 2;
+                m_resend = now + m_interval;
+            }
+
+            // Any datagram restarts the quiet period
+            void Received(clock::time_point now = clock::now())
+            {
+                m_last = now;
+            }
+
+            // Counts the host of a valid responce, returns false when that completes the scan
+            bool Answered(const sockaddr_storage& peer)
+            {
+                if (m_policy.peers == 0 || m_done)
+                    return !m_done;
+
+                if (!m_peers.insert(HostKey(peer)).second)
+                    return true;
+
+                m_done = m_peers.size() >= m_policy.peers;
+
+                return !m_done;
+            }
+
+        private:
+            // The address bytes, any port, as scan_timer keys the peers
+            static std::string HostKey(const sockaddr_storage& peer)
+            {
+                if (peer.ss_family == AF_INET)
+                {
+                    auto& addr = reinterpret_cast<const sockaddr_in&>(peer).sin_addr;
+                    return std::string(reinterpret_cast<const char*>(&addr), sizeof(addr));
+                }
+
+                if (peer.ss_family == AF_INET6)
+                {
+                    auto& addr = reinterpret_cast<const sockaddr_in6&>(peer).sin6_addr;
+                    return std::string(reinterpret_cast<const char*>(&addr), sizeof(addr));
+                }
+
+                return std::string(reinterpret_cast<const char*>(&peer), sizeof(peer));
+            }
+
+            completion_policy m_policy;
+            clock::time_point m_end;
+            clock::time_point m_last;
+            std::chrono::milliseconds m_interval;
+            clock::time_point m_resend;
+            bool m_done;
+            std::unordered_set<std::string> m_peers;
+        };
+
+        // Returns false to end the scan
+        typedef std::function<bool(const sockaddr_storage& peer, const uint8_t* data, size_t size)> ReceiveCallback;
+
+        // Returns false to end the scan, source is the position of the socket in the list
+        typedef std::function<bool(size_t source, const sockaddr_storage& peer, const uint8_t* data, size_t size)> ReceiveFromCallback;
+
+        // Sends the query again, returns false on failure
+        typedef std::function<bool()> RetransmitCallback;
+
+        // Called when the wake-up descriptor turns readable, returns false to end the scan
+        typedef std::function<bool()> WakeCallback;
+
+        inline void RecordReceived(const receive_ring& ring, size_t count, metrics::clock::duration duration)
+        {
+            size_t bytes = 0;
+            for (size_t i = 0; i < count; i++)
+                bytes += ring.Size(i);
+
+            Metrics().Received(count, bytes, duration);
+        }
+
+        // Waits on all the sockets at once and hands every datagram to the callback straight from the ring,
+        // the data is valid during the call only. The query is re-sent through retransmit when the scan says so.
+        // The wake-up descriptor, if any, is not read from, it only gets woken called.
+        inline bool Receive(const std::vector<int>& fds, scan_state* scan, receive_ring* ring, const ReceiveFromCallback& callback,
+            const RetransmitCallback& retransmit = RetransmitCallback(), int wakeFd = -1, const WakeCallback& woken = WakeCallback())
+        {
+            int maxfd = wakeFd;
+            for (auto fd: fds)
+                maxfd = std::max(maxfd, fd);
+
+            while (1)
+            {
+                auto left = scan->Left().count();
+                if (left == 0)
+                    break;
+
+                if (retransmit)
+                {
+                    if (scan->UntilRetransmit().count() == 0)
+                    {
+                        if (!retransmit())
+                            return false;
+
+                        scan->Retransmitted();
+                    }
+
+                    left = std::min(left, scan->UntilRetransmit().count());
+                }
+
+                fd_set ready;
+                FD_ZERO(&ready);
+                for (auto fd: fds)
+                    FD_SET(fd, &ready);
+
+                if (wakeFd >= 0)
+                    FD_SET(wakeFd, &ready);
+
+                timeval tv = {0};
+                tv.tv_sec = static_cast<long>(left / 1000);
+                tv.tv_usec = static_cast<long>(left % 1000) * 1000;
+
+                auto start = metrics::Now();
+                int st = select(maxfd+1, &ready, nullptr, nullptr, &tv);
+                Metrics().Waited(metrics::Now() - start);
+
+                if (st < 0)
+                {
+                    Log::Error("Failed to wait on socket with code ", GetSocketError());
+                    return false; 
+                }
+
+                if (wakeFd >= 0 && FD_ISSET(wakeFd, &ready) && !woken())
+                    return true;
+
+                for (size_t source = 0; st > 0 && source < fds.size(); source++)
+                {
+                    if (!FD_ISSET(fds[source], &ready))
+                        continue;
+
+                    start = metrics::Now();
+
+                    size_t count = 0;
+                    if (!ring->Fill(fds[source], &count))
+                    {
+                        Log::Error("Failed to receive with code ", GetSocketError());
+                        return false; 
+                    }
+
+                    RecordReceived(*ring, count, metrics::Now() - start);
+
+                    if (count > 0)
+                        scan->Received();
+
+                    for (size_t i = 0; i < count; i++)
+                    {
+                        // what was cut off can't be parsed
+                        if (ring->Truncated(i))
+                        {
+                            Log::Warning("Dropped a datagram longer than ", ring->Length(), " bytes");
+                            Metrics().Rejected(ParseFailure::Truncated, metrics::clock::duration::zero());
+                            continue;
+                        }
+
+                        if (!callback(source, ring->Peer(i), ring->Data(i), ring->Size(i)))
+                            return true;
+                    }
+                }
+            }
+
+            return true;
+        }
+
+        inline bool Receive(int fd, scan_state* scan, receive_ring* ring, const ReceiveCallback& callback)
+        {
+            return Receive(std::vector<int>(1, fd), scan, ring, [&](size_t, const sockaddr_storage& peer, const uint8_t* data, size_t size)
+            {
+                return callback(peer, data, size);
+            });
+        }
+
+        inline bool Receive(int fd, time_t scanTime, receive_ring* ring, const ReceiveCallback& callback)
+        {
+            scan_state scan(scanTime);
+            return Receive(fd, &scan, ring, callback);
+        }
+
+        inline bool Receive(int fd, time_t scanTime, std::vector<raw_responce>* result)
+        {
+            receive_ring ring;
+
+            return Receive(fd, scanTime, &ring, [result](const sockaddr_storage& peer, const uint8_t* data, size_t size)
+            {
+                result->emplace_back();
+
+                auto& item = result->back();
+                memcpy(&item.peer, &peer, sizeof(sockaddr_storage));
+                item.data.assign(data, data + size);
+                return true;
+            });
+        }
+
+        // The outcome and the time it took go to the tally, if there is one
+        inline bool Parse(const uint8_t* data, size_t size, mdns_responce* result, parse_tally* tally = nullptr)
+        {
+            // Structure:
+            //   header (12b) 
+            //   qname fqdn
+            //   qtype (2b)
+            //   qclass (2b)
+            //   more questions, if qdcount > 1
+            //   DNS RR (name fqdn, usually compressed)
+            //
+            // Note:
+            //   The buffer is only borrowed for the duration of the call.
+            //   The records of the result are overwritten in place, so a responce parsed
+            //   into over and over reuses the buffers of the names.
+
+            auto start = tally != nullptr ? metrics::Now() : metrics::clock::time_point();
+            size_t count = 0;
+
+            auto fail = [start, &count, result, tally](ParseFailure reason)
+            {
+                result->records.resize(count);
+                if (tally != nullptr)
+                    tally->Rejected(reason, metrics::Now() - start);
+
+                return false;
+            };
+
+            if (size == 0)
+                return fail(ParseFailure::Truncated);
+
+            result->qname.clear();
+
+            auto truncated = [&fail]()
+            {
+                Log::Warning("Unexpected end of packet while parsing responce");
+                return fail(ParseFailure::Truncated);
+            };
+
+            stdext::byte_reader reader(data, size);
+
+            uint16_t u16;
+
+            if (!reader.skip(2)) // id
+                return truncated();
+
+            if (!reader.read(&u16)) // flags
+                return truncated();
+
+            if ((u16 & ~MdnsTruncatedFlag) != MdnsResponseFlag)
+            {
+                Log::Warning("Found unexpected Flags value while parsing responce");
+                return fail(ParseFailure::Flags);
+            }
+
+            result->truncated = (u16 & MdnsTruncatedFlag) != 0;
+
+            uint16_t qdcount;
+            if (!reader.read(&qdcount) || !reader.skip(6)) // qdcount, ancount, nscount, arcount
+                return truncated();
+
+            size_t cb = ReadFqdn(data, size, reader.tell(), &result->qname);
+            if (cb == 0)
+            {
+                Log::Error("Failed to parse query name");
+                return fail(ParseFailure::QueryName);
+            }
+
+            reader.skip(cb); // qname
+
+            if (!reader.read(&u16)) // qtype
+                return truncated();
+
+            result->qtype = u16;
+
+            if (!reader.skip(2)) // qclass
+                return truncated();
+
+            // the first question is always there, the others are only skipped
+            if (qdcount > 1)
+            {
+                std::string qname;
+                for (uint16_t i = 1; i < qdcount; i++)
+                {
+                    cb = ReadFqdn(data, size, reader.tell(), &qname);
+                    if (cb == 0)
+                    {
+                        Log::Error("Failed to parse query name");
+                        return fail(ParseFailure::QueryName);
+                    }
+
+                    if (!reader.skip(cb + 4)) // qname, qtype, qclass
+                        return truncated();
+                }
+            }
+
+            while (!reader.eof())
+            {
+                if (count == result->records.size())
+                    result->records.emplace_back();
+
+                auto& rr = result->records[count];
+                rr.pos = reader.tell();
+
+                cb = ReadFqdn(data, size, rr.pos, &rr.name);
+                if (cb == 0)
+                {
+                    Log::Warning("Failed to parse record name");
+                    return fail(ParseFailure::RecordName);
+                }
+
+                reader.skip(cb); // name
+
+                uint16_t rdlength;
+                if (!reader.read(&rr.type) || !reader.read(&rr.rclass) || !reader.read(&rr.ttl) || !reader.read(&rdlength))
+                    return truncated();
+
+                rr.rdpos = reader.tell();
+                rr.rdlen = rdlength;
+
+                if (!reader.skip(rdlength)) // data
+                    return truncated();
+
+                rr.len = cb + MdnsRecordHeaderLength + rdlength;
+                count++;
+            }
+
+            result->records.resize(count);
+
+            if (tally != nullptr)
+                tally->Parsed(metrics::Now() - start);
+
+            return true;
+        }
+
+        inline bool Parse(const sockaddr_storage& peer, const uint8_t* data, size_t size, mdns_responce* result, parse_tally* tally = nullptr)
+        {
+            if (size == 0)
+                return false;
+
+            memcpy(&result->peer, &peer, sizeof(sockaddr_storage));
+            result->interfaceIndex = 0;
+            result->count = 1;
+            result->data.assign(data, data + size);
+
+            return Parse(&result->data[0], result->data.size(), result, tally);
+        }
+
+        inline bool Parse(const raw_responce& input, mdns_responce* result)
+        {
+            if (input.data.empty())
+                return false;
+
+            return Parse(input.peer, &input.data[0], input.data.size(), result);
+        }
+
+        // Takes over the buffer of the raw responce instead of copying it
+        inline bool Parse(raw_responce&& input, mdns_responce* result)
+        {
+            if (input.data.empty())
+                return false;
+
+            memcpy(&result->peer, &input.peer, sizeof(sockaddr_storage));
+            result->interfaceIndex = 0;
+            result->count = 1;
+            result->data.swap(input.data);
+
+            return Parse(&result->data[0], result->data.size(), result);
+        }
+
+        // Typed views of the record data, decoded on demand from the packet bytes
+
+        inline bool ReadA(const uint8_t* data, size_t size, const mdns_record& rr, in_addr* result)
+        {
+            if (rr.type != MdnsTypeA || rr.rdlen != sizeof(in_addr) || rr.rdpos + rr.rdlen > size)
+                return false;
+
+            memcpy(result, &data[rr.rdpos], sizeof(in_addr));
+            return true;
+        }
+
+        inline bool ReadAaaa(const uint8_t* data, size_t size, const mdns_record& rr, in6_addr* result)
+        {
+            if (rr.type != MdnsTypeAaaa || rr.rdlen != sizeof(in6_addr) || rr.rdpos + rr.rdlen > size)
+                return false;
+
+            memcpy(result, &data[rr.rdpos], sizeof(in6_addr));
+            return true;
+        }
+
+        inline bool ReadPtr(const uint8_t* data, size_t size, const mdns_record& rr, std::string* result)
+        {
+            if (rr.type != MdnsTypePtr || rr.rdpos + rr.rdlen > size)
+                return false;
+
+            size_t cb = ReadFqdn(data, size, rr.rdpos, result);
+            return cb != 0 && cb <= rr.rdlen;
+        }
+
+        inline bool ReadSrv(const uint8_t* data, size_t size, const mdns_record& rr, mdns_srv* result)
+        {
+            if (rr.type != MdnsTypeSrv || rr.rdpos + rr.rdlen > size)
+                return false;
+
+            stdext::byte_reader reader(data, rr.rdpos + rr.rdlen);
+            reader.seek(rr.rdpos);
+
+            if (!reader.read(&result->priority) || !reader.read(&result->weight) || !reader.read(&result->port))
+                return false;
+
+            size_t cb = ReadFqdn(data, size, reader.tell(), &result->target);
+            return cb != 0 && cb <= reader.remaining();
+        }
+
+        // Walks the key/value strings of a TXT record (RFC 6763 6.3), empty strings are skipped
+        class txt_reader
+        {
+        public:
+            txt_reader(const uint8_t* data, size_t size, const mdns_record& rr)
+                : m_data(data), m_pos(rr.rdpos), m_end(rr.rdpos + rr.rdlen)
+            {
+                if (rr.type != MdnsTypeTxt || m_end > size)
+                    m_pos = m_end;
+            }
+
+            bool Next(mdns_txt* result)
+            {
+                while (m_pos < m_end)
+                {
+                    size_t len = m_data[m_pos++];
+                    if (m_pos + len > m_end)
+                    {
+                        m_pos = m_end;
+                        return false;
+                    }
+
+                    auto p = reinterpret_cast<const char*>(&m_data[m_pos]);
+                    m_pos += len;
+
+                    if (len == 0)
+                        continue;
+
+                    auto eq = static_cast<const char*>(memchr(p, '=', len));
+                    if (eq == nullptr)
+                    {
+                        result->key = stdext::string_view(p, len);
+                        result->value = stdext::string_view();
+                        result->hasValue = false;
+                    }
+                    else
+                    {
+                        result->key = stdext::string_view(p, eq - p);
+                        result->value = stdext::string_view(eq + 1, p + len - eq - 1);
+                        result->hasValue = true;
+                    }
+
+                    return true;
+                }
+
+                return false;
+            }
+
+        private:
+            const uint8_t* m_data;
+            size_t m_pos;
+            size_t m_end;
+        };
+
+        inline bool ReadA(const mdns_responce& responce, const mdns_record& rr, in_addr* result)
+        {
+            return !responce.data.empty() && ReadA(&responce.data[0], responce.data.size(), rr, result);
+        }
+
+        inline bool ReadAaaa(const mdns_responce& responce, const mdns_record& rr, in6_addr* result)
+        {
+            return !responce.data.empty() && ReadAaaa(&responce.data[0], responce.data.size(), rr, result);
+        }
+
+        inline bool ReadPtr(const mdns_responce& responce, const mdns_record& rr, std::string* result)
+        {
+            return !responce.data.empty() && ReadPtr(&responce.data[0], responce.data.size(), rr, result);
+        }
+
+        inline bool ReadSrv(const mdns_responce& responce, const mdns_record& rr, mdns_srv* result)
+        {
+            return !responce.data.empty() && ReadSrv(&responce.data[0], responce.data.size(), rr, result);
+        }
+
+        inline txt_reader ReadTxt(const mdns_responce& responce, const mdns_record& rr)
+        {
+            static const uint8_t Empty = 0;
+            return responce.data.empty() ? 
+                txt_reader(&Empty, 0, rr) : 
+                txt_reader(&responce.data[0], responce.data.size(), rr);
+        }
+
+        // Writes the record as it is in the responce with the given TTL and class to the section, the names
+        // of the record and of PTR and SRV targets are compressed against the message so far
+        inline bool WriteRecord(
+            const mdns_responce& responce, 
+            const mdns_record& rr, 
+            uint32_t ttl, 
+            uint16_t rclass,
+            MessageSection section,
+            message_builder* builder)
+        {
+            if (responce.data.empty() || rr.rdpos + rr.rdlen > responce.data.size())
+                return false;
+
+            auto mark = builder->Mark();
+
+            if (!builder->BeginRecord(rr.name, rr.type, rclass, ttl))
+                return false;
+
+            bool written = false;
+            std::string name;
+            mdns_srv srv;
+
+            if (ReadPtr(responce, rr, &name))
+            {
+                written = builder->WriteName(name);
+            }
+            else if (ReadSrv(responce, rr, &srv))
+            {
+                written = builder->Write16(srv.priority) && builder->Write16(srv.weight) && 
+                    builder->Write16(srv.port) && builder->WriteName(srv.target);
+            }
+            else
+            {
+                written = builder->WriteBytes(&responce.data[rr.rdpos], rr.rdlen);
+            }
+
+            if (!written)
+            {
+                builder->Rollback(mark);
+                return false;
+            }
+
+            builder->EndRecord(section);
+            return true;
+        }
+
+        // Without the cache-flush bit, as in a known answer
+        inline bool WriteRecord(
+            const mdns_responce& responce, 
+            const mdns_record& rr, 
+            uint32_t ttl, 
+            MessageSection section,
+            message_builder* builder)
+        {
+            return WriteRecord(responce, rr, ttl, static_cast<uint16_t>(rr.rclass & MdnsClassMask), section, builder);
+        }
+
+        // Packs the questions into as few packets of at most maxLength bytes as possible, and never more
+        // than MdnsMessageMaxLength, every packet compressing its names on its own. The packets are built
+        // on the stack, a write that fails means the packet is full. The known answers (RFC 6762 7.1)
+        // follow the questions, when they do not fit the packet gets the TC bit and they continue
+        // in the next one (RFC 6762 7.2). A known answer that does not fit even an empty packet is left out.
+        inline bool WriteQueries(
+            const std::vector<mdns_question>& questions, 
+            const std::vector<mdns_known_answer>& knownAnswers,
+            uint16_t id, 
+            size_t maxLength, 
+            std::vector<std::vector<uint8_t>>* result)
+        {
+            if (questions.empty())
+            {
+                result->clear();
+                return true;
+            }
+
+            uint8_t buffer[MdnsMessageMaxLength];
+            message_builder builder(buffer, std::min(maxLength, sizeof(buffer)));
+
+            // the packets already in the result are written over, keeping their storage
+            size_t packets = 0;
+            auto start = [&]()
+            {
+                if (builder.Size() > 12)
+                {
+                    if (packets == result->size())
+                        result->emplace_back();
+
+                    (*result)[packets++].assign(builder.Data(), builder.Data() + builder.Size());
+                }
+
+                builder.Reset(id, 0);
+            };
+
+            start();
+
+            // a failed write leaves the packet as it was, what does not fit starts the next one
+            for (auto& q: questions)
+            {
+                if (builder.AddQuestion(q.name, q.qtype))
+                    continue;
+
+                start();
+
+                if (!builder.AddQuestion(q.name, q.qtype))
+                {
+                    Log::Error("Failed to encode query name ", q.name);
+                    result->clear();
+                    return false;
+                }
+            }
+
+            for (auto& ka: knownAnswers)
+            {
+                auto& source = *ka.source;
+                auto& rr = source.records[ka.index];
+
+                // skip the broken one
+                if (source.data.empty() || rr.rdpos + rr.rdlen > source.data.size())
+                    continue;
+
+                if (WriteRecord(source, rr, ka.ttl, MessageSection::Answer, &builder))
+                    continue;
+
+                builder.SetFlags(builder.Flags() | MdnsTruncatedFlag);
+                start();
+
+                if (!WriteRecord(source, rr, ka.ttl, MessageSection::Answer, &builder))
+                    Log::Warning("Skipping known answer ", rr.name, " too long for a query");
+            }
+
+            start();
+            result->resize(packets);
+
+            // nothing came after the last one after all
+            if (!result->empty())
+                result->back()[2] &= ~static_cast<uint8_t>(MdnsTruncatedFlag >> 8);
+
+            return true;
+        }
+
+        inline bool WriteQueries(
+            const std::vector<mdns_question>& questions, 
+            uint16_t id, 
+            size_t maxLength, 
+            std::vector<std::vector<uint8_t>>* result)
+        {
+            return WriteQueries(questions, std::vector<mdns_known_answer>(), id, maxLength, result);
+        }
+
+        // Whether the responce holds records of the name and type, or repeats them as its question
+        inline bool Answers(const mdns_responce& responce, const std::string& name, uint16_t qtype)
+        {
+            if (responce.qtype == qtype && NameEquals(responce.qname, name))
+                return true;
+
+            for (auto& rr: responce.records)
+            {
+                if ((qtype == MdnsTypeAny || rr.type == qtype) && NameEquals(rr.name, name))
+                    return true;
+            }
+
+            return false;
+        }
+
+        // Compares the data of two records, following the names inside of it
+        inline bool SameRecordData(const mdns_responce& a, const mdns_record& ra, const mdns_responce& b, const mdns_record& rb)
+        {
+            if (ra.type != rb.type || ra.rdpos + ra.rdlen > a.data.size() || rb.rdpos + rb.rdlen > b.data.size())
+                return false;
+
+            std::string na, nb;
+
+            switch (ra.type)
+            {
+                case MdnsTypePtr:
+                    return ReadPtr(a, ra, &na) && ReadPtr(b, rb, &nb) && NameEquals(na, nb);
+
+                case MdnsTypeSrv:
+                {
+                    mdns_srv sa, sb;
+                    return ReadSrv(a, ra, &sa) && ReadSrv(b, rb, &sb) && 
+                        sa.priority == sb.priority && sa.weight == sb.weight && sa.port == sb.port && 
+                        NameEquals(sa.target, sb.target);
+                }
+
+                default:
+                    return ra.rdlen == rb.rdlen && (ra.rdlen == 0 || memcmp(&a.data[ra.rdpos], &b.data[rb.rdpos], ra.rdlen) == 0);
+            }
+        }
+
+        // FNV-1a, good enough to tell packets and records apart within a scan
+        inline uint64_t Hash(const void* data, size_t size, uint64_t hash = 0xCBF29CE484222325ULL)
+        {
+            auto bytes = static_cast<const uint8_t*>(data);
+            for (size_t i = 0; i < size; i++)
+                hash = (hash ^ bytes[i]) * 0x100000001B3ULL;
+
+            return hash;
+        }
+
+        inline uint64_t HashName(const std::string& name, uint64_t hash)
+        {
+            for (auto c: name)
+            {
+                uint8_t lower = static_cast<uint8_t>(tolower(static_cast<unsigned char>(c)));
+                hash = Hash(&lower, 1, hash);
+            }
+
+            return Hash("", 1, hash); // terminator, so that names do not run into what follows
+        }
+
+        // Hashes what SameRecordData compares, along with the name, type and class. Of the TTL only
+        // a goodbye (TTL 0) counts, so that it is never taken for the record it takes back.
+        inline uint64_t HashRecord(const mdns_responce& responce, const mdns_record& rr)
+        {
+            const uint16_t Key[] = { rr.type, static_cast<uint16_t>(rr.rclass & MdnsClassMask), static_cast<uint16_t>(rr.ttl == 0) };
+            uint64_t hash = Hash(Key, sizeof(Key), HashName(rr.name, Hash(nullptr, 0)));
+
+            std::string name;
+            mdns_srv srv;
+
+            if (rr.type == MdnsTypePtr && ReadPtr(responce, rr, &name))
+                return HashName(name, hash);
+
+            if (rr.type == MdnsTypeSrv && ReadSrv(responce, rr, &srv))
+            {
+                const uint16_t Fields[] = { srv.priority, srv.weight, srv.port };
+                return HashName(srv.target, Hash(Fields, sizeof(Fields), hash));
+            }
+
+            if (rr.rdpos + rr.rdlen > responce.data.size() || rr.rdlen == 0)
+                return hash;
+
+            return Hash(&responce.data[rr.rdpos], rr.rdlen, hash);
+        }
+
+        const size_t NoAnswer = static_cast<size_t>(-1);
+
+        // Recognizes repeated answers within a scan by hash: the same packet from the same host,
+        // sent twice or heard on two interfaces, or a packet from a host bringing no record that
+        // an earlier answer of that host did not have. Another host is never a repeat, even with
+        // the same records, so that every host that answers is counted.
+        class answer_filter
+        {
+        public:
+            answer_filter() : m_answers(0)
+            {
+            }
+
+            static uint64_t PeerHash(const sockaddr_storage& peer)
+            {
+                uint64_t hash = Hash(&peer.ss_family, sizeof(peer.ss_family));
+
+                if (peer.ss_family == AF_INET6)
+                    return Hash(&reinterpret_cast<const sockaddr_in6&>(peer).sin6_addr, sizeof(in6_addr), hash);
+
+                return Hash(&reinterpret_cast<const sockaddr_in&>(peer).sin_addr, sizeof(in_addr), hash);
+            }
+
+            static uint64_t PacketHash(const sockaddr_storage& peer, const uint8_t* data, size_t size)
+            {
+                return Hash(data, size, PeerHash(peer));
+            }
+
+            // Index of the earlier answer that came in the same packet, NoAnswer if none
+            size_t FindPacket(uint64_t hash) const
+            {
+                auto it = m_packets.find(hash);
+                return it != m_packets.end() ? it->second : NoAnswer;
+            }
+
+            // Remembers the answer and returns NoAnswer, or returns the index of the earlier answer
+            // holding all of its records. Answers are numbered in the order they are added.
+            size_t Add(uint64_t packetHash, const mdns_responce& responce)
+            {
+                m_hashes.clear();
+
+                bool fresh = responce.records.empty();
+                size_t original = NoAnswer;
+                uint64_t peer = PeerHash(responce.peer);
+
+                for (auto& rr: responce.records)
+                {
+                    uint64_t record = HashRecord(responce, rr);
+                    uint64_t hash = Hash(&record, sizeof(record), peer);
+                    m_hashes.push_back(hash);
+
+                    auto it = m_records.find(hash);
+                    if (it == m_records.end())
+                        fresh = true;
+                    else if (original == NoAnswer || it->second > original)
+                        original = it->second; // the latest of them is the likeliest to hold them all
+                }
+
+                if (!fresh)
+                {
+                    m_packets.insert(std::make_pair(packetHash, original));
+                    return original;
+                }
+
+                size_t index = m_answers++;
+                m_packets.insert(std::make_pair(packetHash, index));
+
+                for (auto hash: m_hashes)
+                    m_records.insert(std::make_pair(hash, index));
+
+                return NoAnswer;
+            }
+
+        private:
+            size_t m_answers;
+            std::unordered_map<uint64_t, size_t> m_packets;
+            std::unordered_map<uint64_t, size_t> m_records;
+            std::vector<uint64_t> m_hashes;
+        };
+
+        // How long the parts of a truncated responce wait for the rest, as a responder waits
+        // for the known answers of a truncated query (RFC 6762 7.2)
+        const std::chrono::milliseconds MdnsTruncatedWait(500);
+
+        // Joins the parts of a truncated responce. RFC 6762 18.5 has the TC bit of a multicast responce
+        // ignored; joining them is a deliberate extension for the unicast replies to a legacy query
+        // (RFC 6762 6.7), which may be split like DNS ones. A packet with the TC bit waits for the
+        // rest from the same address and port, up to a packet without it or MdnsTruncatedWait.
+        // The records of all the parts go into one message parsed once more, so the callback sees
+        // one responce.
+        class responce_assembler
+        {
+        public:
+            typedef std::chrono::steady_clock clock;
+
+            // Handles a parsed packet, false while its responce has parts to come. The last part
+            // becomes the whole responce in place. A part that came already is ignored, the repeat
+            // of a whole responce is told by its last part.
+            bool Add(size_t source, uint64_t hash, mdns_responce* responce, clock::time_point now = clock::now())
+            {
+                if (m_joined.count(hash) != 0)
+                    return false;
+
+                auto it = m_pending.begin();
+                while (it != m_pending.end() && !SamePeer(it->peer, responce->peer))
+                    ++it;
+
+                if (it == m_pending.end())
+                {
+                    if (!responce->truncated)
+                        return true;
+
+                    m_pending.emplace_back();
+                    it = m_pending.end() - 1;
+                    memcpy(&it->peer, &responce->peer, sizeof(sockaddr_storage));
+                    it->first = now;
+                }
+
+                if (std::find(it->hashes.begin(), it->hashes.end(), hash) != it->hashes.end())
+                    return false;
+
+                it->source = source;
+                it->hashes.push_back(hash);
+                it->parts.push_back(*responce);
+
+                if (responce->truncated)
+                    return false;
+
+                bool st = Join(it->parts, responce);
+
+                it->hashes.pop_back();
+                m_joined.insert(it->hashes.begin(), it->hashes.end());
+                m_pending.erase(it);
+
+                if (!st)
+                    Log::Warning("Failed to join the parts of a truncated responce");
+
+                return st;
+            }
+
+            // Hands out the responces still waiting for parts as far as they came
+            template<typename Callback>
+            bool Flush(const Callback& callback)
+            {
+                std::vector<pending> items;
+                items.swap(m_pending);
+
+                return Hand(items, callback);
+            }
+
+            // Hands out the responces that waited MdnsTruncatedWait for the rest
+            template<typename Callback>
+            bool Expire(const Callback& callback, clock::time_point now = clock::now())
+            {
+                std::vector<pending> items;
+                for (auto it = m_pending.begin(); it != m_pending.end();)
+                {
+                    if (now - it->first < MdnsTruncatedWait)
+                    {
+                        ++it;
+                        continue;
+                    }
+
+                    items.push_back(std::move(*it));
+                    it = m_pending.erase(it);
+                }
+
+                return Hand(items, callback);
+            }
+
+            size_t Pending() const { return m_pending.size(); }
+
+            // Writes the question and the records of all the parts into one message and parses it
+            static bool Join(const std::vector<mdns_responce>& parts, mdns_responce* result)
+            {
+                if (parts.empty())
+                    return false;
+
+                uint8_t buffer[MdnsMaxMessageSize];
+                message_builder builder(buffer, sizeof(buffer));
+                builder.Reset(0, MdnsResponseFlag);
+
+                // every part repeats the question of the legacy unicast query (RFC 6762 6.7)
+                if (!builder.AddQuestion(parts[0].qname, parts[0].qtype))
+                    return false;
+
+                // the cache-flush bit stays, a record that doesn't fit is left out
+                for (auto& part: parts)
+                {
+                    for (auto& rr: part.records)
+                        WriteRecord(part, rr, rr.ttl, rr.rclass, MessageSection::Answer, &builder);
+                }
+
+                return Parse(parts[0].peer, builder.Data(), builder.Size(), result);
+            }
+
+        private:
+            struct pending
+            {
+                sockaddr_storage peer;
+                size_t source;
+                clock::time_point first; // when the first part came
+                std::vector<uint64_t> hashes;
+                std::vector<mdns_responce> parts;
+            };
+
+            template<typename Callback>
+            static bool Hand(std::vector<pending>& items, const Callback& callback)
+            {
+                mdns_responce result = {0};
+
+                for (auto& item: items)
+                {
+                    if (Join(item.parts, &result) && !callback(item.source, item.hashes.back(), result))
+                        return false;
+                }
+
+                return true;
+            }
+
+            static bool SamePeer(const sockaddr_storage& a, const sockaddr_storage& b)
+            {
+                if (a.ss_family != b.ss_family)
+                    return false;
+
+                if (a.ss_family == AF_INET)
+                {
+                    auto& ia = reinterpret_cast<const sockaddr_in&>(a);
+                    auto& ib = reinterpret_cast<const sockaddr_in&>(b);
+                    return ia.sin_port == ib.sin_port && memcmp(&ia.sin_addr, &ib.sin_addr, sizeof(in_addr)) == 0;
+                }
+
+                if (a.ss_family == AF_INET6)
+                {
+                    auto& ia = reinterpret_cast<const sockaddr_in6&>(a);
+                    auto& ib = reinterpret_cast<const sockaddr_in6&>(b);
+                    return ia.sin6_port == ib.sin6_port && memcmp(&ia.sin6_addr, &ib.sin6_addr, sizeof(in6_addr)) == 0;
+                }
+
+                return memcmp(&a, &b, sizeof(sockaddr_storage)) == 0;
+            }
+
+            std::vector<pending> m_pending;
+            std::unordered_set<uint64_t> m_joined; // of the parts but the last
+        };
+
+        const size_t MdnsPipelineDepth = 256;
+
+        // Parses datagrams on worker threads while the thread that pushes them only drains the sockets.
+        // The datagrams go through a ring of slots, each one free, received or parsed, and the pushing
+        // thread takes them back parsed in the order they came. Slot i always goes to worker i % n,
+        // so nothing but the atomic state of a slot is shared and a busy pipeline takes no lock.
+        // The lock and the condition variables only serve the idle edges: a worker that finds its
+        // next slot empty sleeps until Push fills it, Merge sleeps when it has to wait for a parse.
+        // A worker wakes the pushing thread up through WakeFd once per batch, not per packet.
+        // Push copies the datagram, the receive buffer is reused right away, into a slot whose
+        // buffer keeps its capacity from one round of the ring to the next.
+        class parse_pipeline
+        {
+        public:
+            struct slot
+            {
+                slot() : source(0), hash(0), parsed(false), state(Free) {}
+
+                size_t source;
+                uint64_t hash;           // answer_filter::PacketHash
+                bool parsed;             // false for a broken packet
+                mdns_responce responce;  // the datagram itself until parsed
+                std::atomic<int> state;
+            };
+
+            // Returns false to stop merging
+            typedef std::function<bool(slot& item)> MergeCallback;
+
+            explicit parse_pipeline(size_t threads, size_t depth = MdnsPipelineDepth)
+                : m_threads(std::max<size_t>(threads, 1)), m_pushed(0), m_merged(0), m_stopping(false),
+                m_received(new std::condition_variable[m_threads]), m_idle(new std::atomic<bool>[m_threads]), 
+                m_merging(false), m_signalled(false)
+            {
+                // a multiple of the number of workers, so that every slot has a worker of its own
+                depth = std::max(depth, m_threads);
+                m_slots = std::vector<slot>(depth - depth % m_threads);
+                m_wake[0] = m_wake[1] = -1;
+
+                for (size_t i = 0; i < m_threads; i++)
+                    m_idle[i] = false;
+            }
+
+            ~parse_pipeline()
+            {
+                Stop();
+            }
+
+            parse_pipeline(const parse_pipeline&) = delete;
+            parse_pipeline& operator=(const parse_pipeline&) = delete;
+
+            bool Start()
+            {
+#ifdef WIN32
+                Log::Error("Parsing on worker threads is not supported");
+                return false;
+#else
+                if (socketpair(AF_UNIX, SOCK_DGRAM, 0, m_wake) < 0)
+                {
+                    Log::Error("Failed to create socket pair with code ", GetSocketError());
+                    return false;
+                }
+
+                if (!Selectable(m_wake[0]))
+                {
+                    CloseSocket(m_wake[0]);
+                    CloseSocket(m_wake[1]);
+                    m_wake[0] = m_wake[1] = -1;
+                    return false;
+                }
+
+                for (size_t i = 0; i < m_threads; i++)
+                    m_workers.emplace_back([this, i]() { Work(i); });
+
+                return true;
+#endif
+            }
+
+            void Stop()
+            {
+                {
+                    std::lock_guard<std::mutex> lock(m_lock);
+                    m_stopping = true;
+                }
+
+                for (size_t i = 0; i < m_threads; i++)
+                    m_received[i].notify_one();
+
+                for (auto& worker: m_workers)
+                    worker.join();
+
+                m_workers.clear();
+
+                for (auto fd: m_wake)
+                {
+                    if (fd >= 0)
+                        CloseSocket(fd);
+                }
+
+                m_wake[0] = m_wake[1] = -1;
+            }
+
+            // Readable once there is something to merge
+            int WakeFd() const { return m_wake[0]; }
+
+            // Reads the wake-ups off WakeFd, the next parsed packet sends another one
+            void ClearWake()
+            {
+                char buffer[64];
+                while (recv(m_wake[0], buffer, sizeof(buffer), MSG_DONTWAIT) > 0)
+                    ;
+
+                m_signalled = false;
+            }
+
+            size_t Depth() const { return m_slots.size(); }
+            size_t Pending() const { return m_pushed - m_merged; }
+
+            // The ring must have a free slot, see Merge
+            void Push(size_t source, const sockaddr_storage& peer, const uint8_t* data, size_t size)
+            {
+                auto index = m_pushed++ % m_slots.size();
+                auto& item = m_slots[index];
+
+                item.source = source;
+                memcpy(&item.responce.peer, &peer, sizeof(sockaddr_storage));
+                item.responce.data.assign(data, data + size);
+                item.state = Received;
+
+                auto worker = index % m_threads;
+                if (m_idle[worker])
+                    Signal(m_received[worker]);
+            }
+
+            // Hands the parsed datagrams to the callback in the order they were pushed, waiting for them
+            // until at most pending are left. Returns false once the callback does.
+            bool Merge(const MergeCallback& callback, size_t pending)
+            {
+                while (m_merged < m_pushed)
+                {
+                    auto& item = m_slots[m_merged % m_slots.size()];
+
+                    if (item.state.load(std::memory_order_acquire) != Parsed)
+                    {
+                        if (Pending() <= pending)
+                            break;
+
+                        Sleep(m_parsed, m_merging, [&]() { return item.state == Parsed; });
+                    }
+
+                    bool go = callback(item);
+
+                    item.state.store(Free, std::memory_order_release);
+                    m_merged++;
+
+                    if (!go)
+                        return false;
+                }
+
+                return true;
+            }
+
+        private:
+            enum { Free, Received, Parsed };
+
+            // The sleeper raises its flag before it checks the condition once more, the other side
+            // changes the state before it looks at the flag: either the sleeper sees the change
+            // or the other side sees the flag and signals, under the lock so the wake-up cannot
+            // come in between the check and the wait
+            template<typename Condition>
+            void Sleep(std::condition_variable& wake, std::atomic<bool>& flag, const Condition& condition)
+            {
+                std::unique_lock<std::mutex> lock(m_lock);
+                flag = true;
+                wake.wait(lock, condition);
+                flag = false;
+            }
+
+            void Signal(std::condition_variable& wake)
+            {
+                {
+                    std::lock_guard<std::mutex> lock(m_lock);
+                }
+
+                wake.notify_one();
+            }
+
+            void Work(size_t index)
+            {
+                auto worker = index;
+                parse_tally parses; // reaches the metrics once the worker stops
+
+                while (1)
+                {
+                    auto& item = m_slots[index];
+
+                    if (item.state.load(std::memory_order_acquire) != Received)
+                    {
+                        Sleep(m_received[worker], m_idle[worker], [&]() { return m_stopping || item.state == Received; });
+
+                        if (item.state.load(std::memory_order_acquire) != Received)
+                        {
+                            Metrics().Fold(&parses);
+                            return;
+                        }
+                    }
+
+                    auto& responce = item.responce;
+                    responce.interfaceIndex = 0;
+                    responce.count = 1;
+
+                    item.hash = answer_filter::PacketHash(responce.peer, responce.data.data(), responce.data.size());
+                    item.parsed = !responce.data.empty() && Parse(&responce.data[0], responce.data.size(), &responce, &parses);
+                    item.state = Parsed;
+
+                    if (m_merging)
+                        Signal(m_parsed);
+
+                    // one wake-up until the pushing thread reads it
+                    if (!m_signalled.exchange(true))
+                    {
+                        const char Wake = 0;
+                        send(m_wake[1], &Wake, 1, MSG_DONTWAIT);
+                    }
+
+                    index = (index + m_threads) % m_slots.size();
+                }
+            }
+
+            size_t m_threads;
+            std::vector<slot> m_slots;
+            size_t m_pushed; // only touched by the pushing thread, as is m_merged
+            size_t m_merged;
+            std::atomic<bool> m_stopping;
+            std::mutex m_lock; // only taken on the way to sleep and to wake a sleeper
+            std::unique_ptr<std::condition_variable[]> m_received; // one per worker
+            std::unique_ptr<std::atomic<bool>[]> m_idle; // the worker sleeps, or is about to
+            std::condition_variable m_parsed;
+            std::atomic<bool> m_merging; // Merge sleeps, or is about to
+            std::atomic<bool> m_signalled; // a wake-up waits on WakeFd
+            std::vector<std::thread> m_workers;
+            int m_wake[2];
+        };
+
+        // Records of the past responces, kept for as long as their TTL says (RFC 6762 10).
+        // Safe to share between threads.
+        class record_cache
+        {
+        public:
+            typedef std::chrono::steady_clock clock;
+
+            record_cache() : m_scheduled(0) {}
+
+            struct entry
+            {
+                std::shared_ptr<const mdns_responce> source;
+                size_t index;
+                clock::time_point received;
+                clock::time_point expires;
+            };
+
+            void Insert(const mdns_responce& responce, clock::time_point now = clock::now())
+            {
+                auto source = std::make_shared<const mdns_responce>(responce);
+
+                std::lock_guard<std::mutex> lock(m_mutex);
+                ExpireLocked(now);
+
+                for (size_t i = 0; i < source->records.size(); i++)
+                {
+                    auto& rr = source->records[i];
+                    auto k = Key(rr.name, rr.type, rr.rclass);
+                    auto& entries = m_entries[k];
+
+                    // a record with the cache-flush bit replaces the older data of its set
+                    if ((rr.rclass & MdnsCacheFlushBit) != 0)
+                    {
+                        entries.erase(std::remove_if(entries.begin(), entries.end(), [&](const entry& e)
+                        {
+                            return now - e.received > std::chrono::seconds(1);
+                        }), entries.end());
+                    }
+
+                    entries.erase(std::remove_if(entries.begin(), entries.end(), [&](const entry& e)
+                    {
+                        return SameRecordData(*e.source, e.source->records[e.index], *source, rr);
+                    }), entries.end());
+
+                    if (rr.ttl == 0)
+                    {
+                        if (entries.empty())
+                            m_entries.erase(k);
+
+                        continue; // goodbye
+                    }
+
+                    entry e;
+                    e.source = source;
+                    e.index = i;
+                    e.received = now;
+                    e.expires = now + std::chrono::seconds(rr.ttl);
+                    entries.push_back(e);
+
+                    m_schedule.push(std::make_pair(e.expires, k));
+                }
+
+                // the deadlines of the replaced entries stay behind, once they are most of the schedule it starts over
+                if (m_schedule.size() > 2 * m_scheduled + 64)
+                    Reschedule();
+            }
+
+            // Fresh entries for the name, type and class
+            bool Lookup(const std::string& name, uint16_t type, uint16_t rclass, std::vector<entry>* result, clock::time_point now = clock::now())
+            {
+                result->clear();
+
+                std::lock_guard<std::mutex> lock(m_mutex);
+                ExpireLocked(now);
+
+                auto it = m_entries.find(Key(name, type, rclass));
+                if (it != m_entries.end())
+                    *result = it->second;
+
+                return !result->empty();
+            }
+
+            // The responces holding fresh records for the question, with expired records
+            // removed and TTLs counted down to what is left of them
+            bool Resolve(const std::string& name, uint16_t qtype, std::vector<mdns_responce>* result, clock::time_point now = clock::now())
+            {
+                result->clear();
+
+                std::lock_guard<std::mutex> lock(m_mutex);
+                ExpireLocked(now);
+
+                auto it = m_entries.find(Key(name, qtype, MdnsClassIn));
+                if (it == m_entries.end())
+                    return false;
+
+                std::vector<const mdns_responce*> sources;
+                for (auto& e: it->second)
+                {
+                    if (std::find(sources.begin(), sources.end(), e.source.get()) != sources.end())
+                        continue;
+
+                    sources.push_back(e.source.get());
+
+                    result->push_back(*e.source);
+                    auto& responce = result->back();
+                    responce.records.clear();
+
+                    for (size_t i = 0; i < e.source->records.size(); i++)
+                    {
+                        auto rr = e.source->records[i];
+                        auto left = Left(e.source.get(), i, now);
+                        if (left == 0)
+                            continue;
+
+                        rr.ttl = left;
+                        responce.records.push_back(std::move(rr));
+                    }
+                }
+
+                return !result->empty();
+            }
+
+            // Cached records for the question that are worth listing as known answers,
+            // those with more than half of their TTL left (RFC 6762 7.1)
+            bool KnownAnswers(const std::string& name, uint16_t qtype, std::vector<mdns_known_answer>* result, clock::time_point now = clock::now())
+            {
+                result->clear();
+
+                std::lock_guard<std::mutex> lock(m_mutex);
+                ExpireLocked(now);
+
+                auto it = m_entries.find(Key(name, qtype, MdnsClassIn));
+                if (it == m_entries.end())
+                    return false;
+
+                for (auto& e: it->second)
+                {
+                    auto left = std::chrono::duration_cast<std::chrono::seconds>(e.expires - now).count();
+                    if (left * 2 <= e.source->records[e.index].ttl)
+                        continue;
+
+                    mdns_known_answer ka;
+                    ka.source = e.source;
+                    ka.index = e.index;
+                    ka.ttl = static_cast<uint32_t>(left);
+                    result->push_back(ka);
+                }
+
+                return !result->empty();
+            }
+
+            // The cached part of the source, as Resolve returns it
+            bool Snapshot(const std::shared_ptr<const mdns_responce>& source, mdns_responce* result, clock::time_point now = clock::now())
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                ExpireLocked(now);
+
+                *result = *source;
+                result->records.clear();
+
+                for (size_t i = 0; i < source->records.size(); i++)
+                {
+                    auto left = Left(source.get(), i, now);
+                    if (left == 0)
+                        continue;
+
+                    result->records.push_back(source->records[i]);
+                    result->records.back().ttl = left;
+                }
+
+                return !result->records.empty();
+            }
+
+            void Expire(clock::time_point now = clock::now())
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                ExpireLocked(now);
+            }
+
+            void Clear()
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_entries.clear();
+                m_schedule = schedule();
+                m_scheduled = 0;
+            }
+
+            size_t Size()
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+
+                size_t result = 0;
+                for (auto& item: m_entries)
+                    result += item.second.size();
+
+                return result;
+            }
+
+            // Deadlines waiting in the schedule, those of the replaced entries too
+            size_t Scheduled()
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                return m_schedule.size();
+            }
+
+        private:
+            typedef std::tuple<std::string, uint16_t, uint16_t> key;
+            typedef std::pair<clock::time_point, key> deadline;
+            typedef std::priority_queue<deadline, std::vector<deadline>, std::greater<deadline>> schedule;
+
+            static key Key(const std::string& name, uint16_t type, uint16_t rclass)
+            {
+                std::string lower(name);
+                for (auto& c: lower)
+                    c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+
+                return key(lower, type, rclass & MdnsClassMask);
+            }
+
+            // Seconds left for the record of the source, 0 if it is not cached
+            uint32_t Left(const mdns_responce* source, size_t index, clock::time_point now) const
+            {
+                auto& rr = source->records[index];
+                auto it = m_entries.find(Key(rr.name, rr.type, rr.rclass));
+                if (it == m_entries.end())
+                    return 0;
+
+                for (auto& e: it->second)
+                {
+                    if (e.source.get() == source && e.index == index && e.expires > now)
+                        return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::seconds>(e.expires - now).count());
+                }
+
+                return 0;
+            }
+
+            void ExpireLocked(clock::time_point now)
+            {
+                while (!m_schedule.empty() && m_schedule.top().first <= now)
+                {
+                    auto it = m_entries.find(m_schedule.top().second);
+                    m_schedule.pop();
+
+                    if (it == m_entries.end())
+                        continue;
+
+                    auto& entries = it->second;
+                    entries.erase(std::remove_if(entries.begin(), entries.end(), [now](const entry& e)
+                    {
+                        return e.expires <= now;
+                    }), entries.end());
+
+                    if (entries.empty())
+                        m_entries.erase(it);
+                }
+            }
+
+            // One deadline per entry there is
+            void Reschedule()
+            {
+                std::vector<deadline> deadlines;
+                for (auto& item: m_entries)
+                {
+                    for (auto& e: item.second)
+                        deadlines.push_back(std::make_pair(e.expires, item.first));
+                }
+
+                m_schedule = schedule(std::greater<deadline>(), std::move(deadlines));
+                m_scheduled = m_schedule.size();
+            }
+
+            std::mutex m_mutex;
+            std::map<key, std::vector<entry>> m_entries;
+            schedule m_schedule;
+            size_t m_scheduled; // size of the schedule when it was last made anew
+        };
+
+        inline record_cache& DefaultCache()
+        {
+            static record_cache cache;
+            return cache;
+        }
+
+        enum class CachePolicy
+        {
+            Default, // answer from the cache when it has fresh records, ask the network otherwise
+            Refresh, // always ask the network and update the cache
+            Bypass   // leave the cache alone
+        };
+
+        struct resolve_options
+        {
+            resolve_options() : cachePolicy(CachePolicy::Default), cache(nullptr), parserThreads(0), maxMessageSize(MdnsMaxMessageSize), fanOut(false), destination(BroadcastAddress()), sockets(nullptr) {}
+
+            CachePolicy cachePolicy;
+            record_cache* cache; // DefaultCache() when null
+            completion_policy completion;
+            size_t parserThreads; // parse on that many threads while the calling one drains the sockets, 0 to parse inline
+            size_t maxMessageSize; // longer datagrams are dropped, the queries keep to MdnsMessageMaxLength unless it is less
+            bool fanOut; // multicast on every interface, IPv4 and IPv6, instead of one broadcast
+            std::vector<mdns_interface> interfaces; // where to fan out, all of ListInterfaces() when empty
+            sockaddr_storage destination; // IPv4 address of the query without fan-out, the broadcast by default
+            socket_set* sockets; // open sockets to scan on instead of new ones, they replace fanOut, interfaces and destination
+        };
+
+        // Returns false to end the scan, the responce may be moved out
+        typedef std::function<bool(mdns_responce& responce)> ResponceCallback;
+
+        // Largest query packet, the known answers beyond it go on in the next one
+        inline size_t QueryLength(const resolve_options& options)
+        {
+            return std::min(options.maxMessageSize, MdnsMessageMaxLength);
+        }
+
+        // Tells that an answer repeated the one handed to the callback as number original, from 0
+        typedef std::function<void(size_t original)> RepeatCallback;
+
+        // Encodes the queries to re-send, with the known answers gathered so far
+        typedef std::function<bool(std::vector<std::vector<uint8_t>>* queries)> RequeryCallback;
+
+        // Adds the questions of an encoded query, as far as they can be read
+        inline void ReadQuestions(const uint8_t* data, size_t size, std::vector<mdns_question>* result)
+        {
+            if (size < 12)
+                return;
+
+            size_t count = (data[4] << 8) | data[5];
+            size_t offset = 12;
+
+            for (size_t i = 0; i < count; i++)
+            {
+                mdns_question question;
+                auto cb = ReadFqdn(data, size, offset, &question.name);
+                if (cb == 0 || offset + cb + 4 > size)
+                    return;
+
+                offset += cb;
+                question.qtype = static_cast<uint16_t>((data[offset] << 8) | data[offset + 1]);
+                offset += 4;
+
+                result->push_back(question);
+            }
+        }
+
+        // Adds the questions of every query, false unless all of them could be read
+        inline bool ReadQuestions(const query_packet* queries, size_t count, std::vector<mdns_question>* result)
+        {
+            size_t expected = result->size();
+            for (size_t q = 0; q < count; q++)
+            {
+                if (queries[q].size >= 12)
+                    expected += (queries[q].data[4] << 8) | queries[q].data[5];
+
+                ReadQuestions(queries[q].data, queries[q].size, result);
+            }
+
+            return !result->empty() && result->size() == expected;
+        }
+
+        // Encodes the questions again, followed by the answers the cache has for them by now (RFC 6762 7.1)
+        inline RequeryCallback KnownAnswerRequery(const std::vector<mdns_question>& questions, record_cache* known, size_t maxLength)
+        {
+            return [questions, known, maxLength](std::vector<std::vector<uint8_t>>* result)
+            {
+                std::vector<mdns_known_answer> answers, found;
+                for (auto& q: questions)
+                {
+                    known->KnownAnswers(q.name, q.qtype, &found);
+                    answers.insert(answers.end(), found.begin(), found.end());
+                }
+
+                return WriteQueries(questions, answers, 0, maxLength, result);
+            };
+        }
+
+        // Sends the encoded queries through the sockets, to the mDNS group on each interface at once or to
+        // the IPv4 destination, and hands every new responce to the callback as soon as it arrives.
+        // Repeated answers (see answer_filter) only go to the repeat callback. The queries go out again
+        // on the schedule of the scan, as they are or as requery encodes them. With parser threads the
+        // packets are parsed by a parse_pipeline, the callbacks still run on the calling thread in order.
+        // Sockets that served a scan before take only the answers to these queries, late replies to
+        // the earlier ones are left out. A filter holding the answers handed out before the scan makes
+        // their repeats from the network go to the repeat callback, numbered after them.
+        inline bool Resolve(
+            const query_packet* queries, 
+            size_t count,
+            socket_set* sockets, 
+            scan_state* scan, 
+            const ResponceCallback& callback,
+            const RepeatCallback& repeat = RepeatCallback(),
+            const RequeryCallback& requery = RequeryCallback(),
+            size_t parserThreads = 0,
+            size_t maxMessageSize = MdnsMaxMessageSize,
+            answer_filter* seeded = nullptr)
+        {
+            auto& fds = sockets->Fds();
+            if (fds.empty())
+            {
+                Log::Error("No socket to send the query on");
+                return false;
+            }
+
+            std::vector<mdns_question> asked;
+            if (sockets->Scans() > 0)
+            {
+                for (size_t q = 0; q < count; q++)
+                    ReadQuestions(queries[q].data, queries[q].size, &asked);
+            }
+
+            sockets->Scanned();
+
+            // a socket that fails to send is skipped, the others still go on
+            auto send = [&](const query_packet* packets, size_t number)
+            {
+                size_t sent = 0;
+
+                for (size_t q = 0; q < number; q++)
+                {
+                    for (size_t i = 0; i < fds.size(); i++)
+                    {
+                        if (!sockets->Sends(i))
+                            continue;
+
+                        if (Send(fds[i], packets[q].data, packets[q].size, sockets->Destination(i)))
+                            sent++;
+                        else
+                            Log::Warning("Skipping the query on interface ", sockets->Index(i));
+                    }
+                }
+
+                return sent != 0 || number == 0;
+            };
+
+            auto retransmit = [&]()
+            {
+                if (!requery)
+                    return send(queries, count);
+
+                std::vector<std::vector<uint8_t>> encoded;
+                if (!requery(&encoded))
+                    return false;
+
+                std::vector<query_packet> packets;
+                for (auto& query: encoded)
+                {
+                    query_packet packet = { query.data(), query.size() };
+                    packets.push_back(packet);
+                }
+
+                return send(packets.data(), packets.size());
+            };
+
+            scan_timer timer;
+
+            if (!send(queries, count))
+                return false;
+            
+            auto& ring = sockets->Ring(maxMessageSize);
+            mdns_responce parsed = {0};
+            answer_filter own;
+            auto& filter = seeded != nullptr ? *seeded : own;
+            responce_assembler assembler;
+            bool stopped = false;
+
+            auto repeated = [&](size_t original)
+            {
+                Metrics().Repeated();
+                if (repeat)
+                    repeat(original);
+
+                return true;
+            };
+
+            auto complete = [&](size_t source, uint64_t hash, mdns_responce& responce)
+            {
+                auto original = filter.Add(hash, responce);
+                if (original != NoAnswer)
+                    return repeated(original);
+
+                auto peer = responce.peer;
+                timer.Answered(peer);
+
+                responce.interfaceIndex = sockets->Index(source);
+                stopped = !callback(responce) || !scan->Answered(peer);
+                return !stopped;
+            };
+
+            // the responce is parsed unless the packet repeats an earlier one,
+            // the parts of a truncated one wait for the rest of it
+            auto deliver = [&](size_t source, uint64_t hash, mdns_responce& responce)
+            {
+                auto original = filter.FindPacket(hash);
+                if (original != NoAnswer)
+                    return repeated(original);
+
+                if (!asked.empty() && std::none_of(asked.begin(), asked.end(), [&](const mdns_question& question)
+                {
+                    return Answers(responce, question.name, question.qtype);
+                }))
+                {
+                    return true;
+                }
+
+                // the parts that waited too long go first
+                if (!assembler.Expire(complete))
+                    return false;
+
+                return !assembler.Add(source, hash, &responce) || complete(source, hash, responce);
+            };
+
+            bool st = true;
+
+            if (parserThreads == 0)
+            {
+                st = Receive(fds, scan, &ring, [&](size_t source, const sockaddr_storage& peer, const uint8_t* data, size_t size)
+                {
+                    // a repeated packet is not even parsed
+                    auto hash = answer_filter::PacketHash(peer, data, size);
+                    if (filter.FindPacket(hash) == NoAnswer && !Parse(peer, data, size, &parsed, timer.Parses()))
+                        return true;
+
+                    return deliver(source, hash, parsed);
+                }, retransmit);
+            }
+            else
+            {
+                parse_pipeline pipeline(parserThreads);
+                if (!pipeline.Start())
+                    return false;
+
+                auto merge = [&](parse_pipeline::slot& item)
+                {
+                    if (!item.parsed && filter.FindPacket(item.hash) == NoAnswer)
+                        return true;
+
+                    return deliver(item.source, item.hash, item.responce);
+                };
+
+                st = Receive(fds, scan, &ring, [&](size_t source, const sockaddr_storage& peer, const uint8_t* data, size_t size)
+                {
+                    // makes room first, if the workers fall behind
+                    if (!pipeline.Merge(merge, pipeline.Depth() - 1))
+                        return false;
+
+                    pipeline.Push(source, peer, data, size);
+                    return true;
+                }, retransmit, pipeline.WakeFd(), [&]()
+                {
+                    pipeline.ClearWake();
+                    return pipeline.Merge(merge, SIZE_MAX);
+                });
+
+                // whatever came within the scan is still handed out
+                if (st && !stopped)
+                    pipeline.Merge(merge, 0);
+            }
+
+            // so are the parts of truncated responces whose rest never came
+            if (st && !stopped)
+                assembler.Flush(complete);
+
+            return st;
+        }
+
+        inline bool Resolve(
+            const std::vector<std::vector<uint8_t>>& queries, 
+            socket_set* sockets, 
+            scan_state* scan, 
+            const ResponceCallback& callback,
+            const RepeatCallback& repeat = RepeatCallback(),
+            const RequeryCallback& requery = RequeryCallback(),
+            size_t parserThreads = 0,
+            size_t maxMessageSize = MdnsMaxMessageSize,
+            answer_filter* seeded = nullptr)
+        {
+            std::vector<query_packet> packets;
+            for (auto& query: queries)
+            {
+                query_packet packet = { query.data(), query.size() };
+                packets.push_back(packet);
+            }
+
+            return Resolve(packets.data(), packets.size(), sockets, scan, callback, repeat, requery, parserThreads, maxMessageSize, seeded);
+        }
+
+        inline bool Resolve(
+            const std::vector<std::vector<uint8_t>>& queries, 
+            scan_state* scan, 
+            const ResponceCallback& callback, 
+            const RepeatCallback& repeat = RepeatCallback())
+        {
+            socket_set sockets;
+            if (!sockets.Open(std::vector<mdns_interface>(), BroadcastAddress()))
+                return false;
+
+            std::vector<query_packet> packets;
+            for (auto& query: queries)
+            {
+                query_packet packet = { query.data(), query.size() };
+                packets.push_back(packet);
+            }
+
+            // re-sent queries carry the answers found so far, when the questions can be read back
+            std::vector<mdns_question> questions;
+            if (!ReadQuestions(packets.data(), packets.size(), &questions))
+                return Resolve(queries, &sockets, scan, callback, repeat);
+
+            record_cache gathered;
+
+            return Resolve(queries, &sockets, scan, [&](mdns_responce& responce)
+            {
+                // nothing to gather once no re-send is due
+                if (scan->UntilRetransmit() != std::chrono::milliseconds::max())
+                    gathered.Insert(responce);
+
+                return callback(responce);
+            }, repeat, KnownAnswerRequery(questions, &gathered, MdnsMessageMaxLength));
+        }
+
+        inline bool Resolve(
+            const std::vector<std::vector<uint8_t>>& queries, 
+            time_t scanTime, 
+            const ResponceCallback& callback, 
+            const RepeatCallback& repeat = RepeatCallback())
+        {
+            scan_state scan(scanTime);
+            return Resolve(queries, &scan, callback, repeat);
+        }
+
+        // Counts the repeats of the collected responces
+        inline RepeatCallback CountRepeats(std::vector<mdns_responce>* result)
+        {
+            return [result](size_t original)
+            {
+                if (original < result->size())
+                    (*result)[original].count++;
+            };
+        }
+
+        // Sends the encoded queries and collects every distinct responce within one scan window
+        inline bool Resolve(const std::vector<std::vector<uint8_t>>& queries, time_t scanTime, std::vector<mdns_responce>* result)
+        {
+            result->clear();
+
+            return Resolve(queries, scanTime, [result](mdns_responce& responce)
+            {
+                result->push_back(std::move(responce));
+                return true;
+            }, CountRepeats(result));
+        }
+
+        inline bool Resolve(const std::string& serviceName, time_t scanTime, std::vector<mdns_responce>* result)
+        {
+            result->clear();
+
+            std::vector<std::vector<uint8_t>> queries(1);
+            WriteQuery(serviceName, MdnsTypePtr, 0, &queries[0]);
+            if (queries[0].empty())
+            {
+                Log::Error("Failed to encode query name ", serviceName);
+                return false;
+            }
+
+            return Resolve(queries, scanTime, result);
+        }
+
+        // Where the options fan the queries out, nothing without fan-out
+        inline bool FanOutInterfaces(const resolve_options& options, std::vector<mdns_interface>* result)
+        {
+            result->clear();
+
+            if (!options.fanOut)
+                return true;
+
+            *result = options.interfaces;
+            if (result->empty())
+            {
+                if (!ListInterfaces(result))
+                    return false;
+
+                if (result->empty())
+                {
+                    Log::Error("No interface to send the query on");
+                    return false;
+                }
+            }
+
+            return true;
+        }
+
+        // The sockets the options pass in, or ones opened into own for the scan
+        inline socket_set* ScanSockets(const resolve_options& options, socket_set* own)
+        {
+            if (options.sockets != nullptr)
+                return options.sockets;
+
+            std::vector<mdns_interface> interfaces;
+            if (!FanOutInterfaces(options, &interfaces) || !own->Open(interfaces, options.destination))
+                return nullptr;
+
+            return own;
+        }
+
+        // Sends the query as it is, so the cache only takes in the responces and known answers are not sent
+        // with it. The re-sent queries ask the questions read back from it with the answers found so far.
+        inline bool Resolve(
+            const query_packet& query, 
+            time_t scanTime, 
+            const resolve_options& options, 
+            const ResponceCallback& callback, 
+            const RepeatCallback& repeat = RepeatCallback())
+        {
+            auto cache = options.cache != nullptr ? options.cache : &DefaultCache();
+
+            socket_set own;
+            auto sockets = ScanSockets(options, &own);
+            if (sockets == nullptr)
+                return false;
+
+            scan_state scan(scanTime, options.completion);
+
+            record_cache gathered;
+            auto known = options.cachePolicy != CachePolicy::Bypass ? cache : &gathered;
+
+            // sent as it is again when its questions cannot be read back
+            std::vector<mdns_question> questions;
+            auto requery = ReadQuestions(&query, 1, &questions) ? 
+                KnownAnswerRequery(questions, known, QueryLength(options)) : RequeryCallback();
+
+            return Resolve(&query, 1, sockets, &scan, [&](mdns_responce& responce)
+            {
+                if (known != &gathered || scan.UntilRetransmit() != std::chrono::milliseconds::max())
+                    known->Insert(responce);
+
+                return callback(responce);
+            }, repeat, requery, options.parserThreads, options.maxMessageSize);
+        }
+
+        template<size_t N>
+        inline bool Resolve(const std::array<uint8_t, N>& query, time_t scanTime, const resolve_options& options, const ResponceCallback& callback)
+        {
+            query_packet packet = { query.data(), query.size() };
+            return Resolve(packet, scanTime, options, callback);
+        }
+
+        template<size_t N>
+        inline bool Resolve(const std::array<uint8_t, N>& query, time_t scanTime, const resolve_options& options, std::vector<mdns_responce>* result)
+        {
+            result->clear();
+
+            query_packet packet = { query.data(), query.size() };
+
+            return Resolve(packet, scanTime, options, [result](mdns_responce& responce)
+            {
+                result->push_back(std::move(responce));
+                return true;
+            }, CountRepeats(result));
+        }
+
+        inline bool Resolve(
+            const std::string& serviceName, 
+            time_t scanTime, 
+            const resolve_options& options, 
+            const ResponceCallback& callback, 
+            const RepeatCallback& repeat)
+        {
+            auto cache = options.cache != nullptr ? options.cache : &DefaultCache();
+
+            scan_state scan(scanTime, options.completion);
+            answer_filter filter;
+
+            // the responces from the cache go through the filter and the scan as those from the network,
+            // false once the scan is complete
+            auto deliver = [&](mdns_responce& cached)
+            {
+                auto original = filter.Add(answer_filter::PacketHash(cached.peer, cached.data.data(), cached.data.size()), cached);
+                if (original != NoAnswer)
+                {
+                    Metrics().Repeated();
+                    if (repeat)
+                        repeat(original);
+
+                    return true;
+                }
+
+                auto peer = cached.peer;
+                return callback(cached) && scan.Answered(peer);
+            };
+
+            if (options.cachePolicy == CachePolicy::Default)
+            {
+                std::vector<mdns_responce> cached;
+                if (cache->Resolve(serviceName, MdnsTypePtr, &cached))
+                {
+                    for (auto& responce: cached)
+                    {
+                        if (!deliver(responce))
+                            break;
+                    }
+
+                    return true;
+                }
+            }
+
+            std::vector<mdns_known_answer> knownAnswers;
+            if (options.cachePolicy != CachePolicy::Bypass)
+                cache->KnownAnswers(serviceName, MdnsTypePtr, &knownAnswers);
+
+            // re-sent queries carry what this scan found so far, even bypassing the cache
+            record_cache gathered;
+            auto known = options.cachePolicy != CachePolicy::Bypass ? cache : &gathered;
+
+            std::vector<mdns_question> questions(1);
+            questions[0].name = serviceName;
+            questions[0].qtype = MdnsTypePtr;
+
+            socket_set own;
+            auto sockets = ScanSockets(options, &own);
+            if (sockets == nullptr)
+                return false;
+
+            auto& queries = sockets->Queries();
+            if (!WriteQueries(questions, knownAnswers, 0, QueryLength(options), &queries))
+                return false;
+
+            // responders stay silent about the known answers, report those from the cache first;
+            // the filter of the scan takes them in, so that a host answering anyway is a repeat
+            std::vector<const mdns_responce*> sources;
+            for (auto& ka: knownAnswers)
+            {
+                if (std::find(sources.begin(), sources.end(), ka.source.get()) != sources.end())
+                    continue;
+
+                sources.push_back(ka.source.get());
+
+                mdns_responce cached;
+                if (cache->Snapshot(ka.source, &cached) && !deliver(cached))
+                    return true;
+            }
+
+            return Resolve(queries, sockets, &scan, [&](mdns_responce& responce)
+            {
+                // nothing to gather once no re-send is due
+                if (known != &gathered || scan.UntilRetransmit() != std::chrono::milliseconds::max())
+                    known->Insert(responce);
+
+                return callback(responce);
+            }, repeat, KnownAnswerRequery(questions, known, QueryLength(options)), options.parserThreads, options.maxMessageSize, &filter);
+        }
+
+        inline bool Resolve(const std::string& serviceName, time_t scanTime, const resolve_options& options, const ResponceCallback& callback)
+        {
+            return Resolve(serviceName, scanTime, options, callback, RepeatCallback());
+        }
+
+        // Collects every distinct responce, mdns_responce::count tells how many times it came
+        inline bool Resolve(const std::string& serviceName, time_t scanTime, const resolve_options& options, std::vector<mdns_responce>* result)
+        {
+            result->clear();
+
+            return Resolve(serviceName, scanTime, options, [result](mdns_responce& responce)
+            {
+                result->push_back(std::move(responce));
+                return true;
+            }, CountRepeats(result));
+        }
+
+        // Asks all the questions at once and sorts the responces out per question,
+        // a responce answering several questions is listed under each of them
+        inline bool Resolve(
+            const std::vector<mdns_question>& questions, 
+            time_t scanTime, 
+            std::vector<std::vector<mdns_responce>>* result)
+        {
+            result->clear();
+            result->resize(questions.size());
+
+            std::vector<std::vector<uint8_t>> queries;
+            if (!WriteQueries(questions, 0, MdnsMessageMaxLength, &queries))
+                return false;
+
+            std::vector<mdns_responce> responces;
+            if (!Resolve(queries, scanTime, &responces))
+                return false;
+
+            for (auto& responce: responces)
+            {
+                for (size_t i = 0; i < questions.size(); i++)
+                {
+                    if (Answers(responce, questions[i].name, questions[i].qtype))
+                        (*result)[i].push_back(responce);
+                }
             }
 
             return true;
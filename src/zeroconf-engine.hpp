@@ -0,0 +1,314 @@
+#ifndef ZEROCONF_ENGINE_HPP
+#define ZEROCONF_ENGINE_HPP
+
+//////////////////////////////////////////////////////////////////////////
+// zeroconf-engine.hpp
+
+// (C) Copyright 2016 Yuri Yakovlev <yvzmail@gmail.com>
+// Use, modification and distribution is subject to the GNU General Public License
+
+#if defined(__linux__)
+
+#include <map>
+#include <unordered_map>
+
+#include <sys/epoll.h>
+
+#include "zeroconf-util.hpp"
+#include "zeroconf-detail.hpp"
+
+namespace Zeroconf
+{
+    namespace Detail
+    {
+        typedef std::function<void(uint16_t id, const mdns_responce& responce)> QueryCallback;
+        typedef std::function<void(uint16_t id)> CompletionCallback;
+
+        // Non-blocking resolver running any number of queries over one socket.
+        //
+        // Each query carries its own message ID, so replies of responders that echo it
+        // are routed to that query only. Replies with ID 0 go to every query whose name
+        // they answer. The epoll descriptor from Fd() can be added to an outer event loop,
+        // which then calls Poll(0) whenever it becomes readable or Timeout() elapses.
+        class engine
+        {
+        public:
+            engine() : m_fd(-1), m_epoll(-1), m_nextId(0), m_destination(BroadcastAddress())
+            {
+            }
+
+            ~engine()
+            {
+                Close();
+            }
+
+            engine(const engine&) = delete;
+            engine& operator=(const engine&) = delete;
+
+            bool Open()
+            {
+                if (m_fd >= 0)
+                    return true;
+
+                if (!CreateSocket(&m_fd))
+                    return false;
+
+                m_epoll = epoll_create1(EPOLL_CLOEXEC);
+                if (m_epoll < 0)
+                {
+                    Log::Error("Failed to create epoll instance with code ", GetSocketError());
+                    Close();
+                    return false;
+                }
+
+                epoll_event ev = {0};
+                ev.events = EPOLLIN;
+                ev.data.fd = m_fd;
+
+                if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_fd, &ev) < 0)
+                {
+                    Log::Error("Failed to watch socket with code ", GetSocketError());
+                    Close();
+                    return false;
+                }
+
+                return true;
+            }
+
+            void Close()
+            {
+                if (m_epoll >= 0)
+                    CloseSocket(m_epoll);
+
+                if (m_fd >= 0)
+                    CloseSocket(m_fd);
+
+                m_epoll = m_fd = -1;
+                m_queries.clear();
+                m_deadlines.clear();
+            }
+
+            int Fd() const { return m_epoll; }
+            size_t Pending() const { return m_queries.size(); }
+
+            // Where the queries go, the mDNS broadcast address by default
+            void SetDestination(const sockaddr_storage& destination)
+            {
+                m_destination = destination;
+            }
+
+            bool Query(
+                const std::string& name,
+                uint16_t qtype,
+                std::chrono::milliseconds timeout,
+                const QueryCallback& onResponce,
+                const CompletionCallback& onComplete,
+                uint16_t* id)
+            {
+                if (m_fd < 0 && !Open())
+                    return false;
+
+                if (m_queries.size() >= UINT16_MAX)
+                {
+                    Log::Error("Too many queries in flight");
+                    return false;
+                }
+
+                do
+                    m_nextId++;
+                while (m_nextId == 0 || m_queries.count(m_nextId) != 0);
+
+                WriteQuery(name, qtype, m_nextId, &m_packet);
+                if (m_packet.empty())
+                {
+                    Log::Error("Failed to encode query name ", name);
+                    return false;
+                }
+
+                if (!Send(m_fd, &m_packet[0], m_packet.size(), m_destination))
+                    return false;
+
+                auto deadline = std::chrono::steady_clock::now() + timeout;
+
+                auto& query = m_queries[m_nextId];
+                query.name = name;
+                query.qtype = qtype;
+                query.onResponce = onResponce;
+                query.onComplete = onComplete;
+                query.deadline = m_deadlines.insert(std::make_pair(deadline, m_nextId));
+
+                *id = m_nextId;
+                return true;
+            }
+
+            // Drops the query without calling its completion callback
+            void Cancel(uint16_t id)
+            {
+                auto it = m_queries.find(id);
+                if (it == m_queries.end())
+                    return;
+
+                m_deadlines.erase(it->second.deadline);
+                m_queries.erase(it);
+            }
+
+            // Milliseconds until the nearest query completes, -1 when idle
+            int Timeout() const
+            {
+                if (m_deadlines.empty())
+                    return -1;
+
+                auto left = m_deadlines.begin()->first - std::chrono::steady_clock::now();
+                auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(left).count();
+
+                return ms < 0 ? 0 : static_cast<int>(ms) + 1;
+            }
+
+            // Waits up to timeoutMs (-1 to wait for the nearest deadline) and processes
+            // everything that is ready: received replies first, then expired queries
+            bool Poll(int timeoutMs)
+            {
+                if (m_epoll < 0)
+                    return false;
+
+                int wait = Timeout();
+                if (timeoutMs >= 0 && (wait < 0 || timeoutMs < wait))
+                    wait = timeoutMs;
+
+                epoll_event events[1];
+                int st = epoll_wait(m_epoll, events, 1, wait);
+                if (st < 0 && errno != EINTR)
+                {
+                    Log::Error("Failed to wait on socket with code ", GetSocketError());
+                    return false;
+                }
+
+                if (st > 0 && !Drain())
+                    return false;
+
+                Expire();
+                return true;
+            }
+
+            // Polls until every query has completed
+            bool Run()
+            {
+                while (!m_queries.empty())
+                {
+                    if (!Poll(-1))
+                        return false;
+                }
+
+                return true;
+            }
+
+        private:
+            struct query
+            {
+                std::string name;
+                uint16_t qtype;
+                QueryCallback onResponce;
+                CompletionCallback onComplete;
+                std::multimap<std::chrono::steady_clock::time_point, uint16_t>::iterator deadline;
+            };
+
+            bool Drain()
+            {
+                while (1)
+                {
+                    auto start = metrics::Now();
+
+                    size_t count = 0;
+                    if (!m_ring.Fill(m_fd, &count))
+                    {
+                        Log::Error("Failed to receive with code ", GetSocketError());
+                        return false;
+                    }
+
+                    RecordReceived(m_ring, count, metrics::Now() - start);
+
+                    if (count == 0)
+                        return true;
+
+                    // the metrics are updated once per batch
+                    parse_tally parses;
+
+                    for (size_t i = 0; i < count; i++)
+                    {
+                        if (m_ring.Truncated(i))
+                            parses.Rejected(ParseFailure::Truncated, metrics::clock::duration::zero());
+                        else if (Parse(m_ring.Peer(i), m_ring.Data(i), m_ring.Size(i), &m_parsed, &parses))
+                            Dispatch(m_parsed);
+                    }
+
+                    Metrics().Fold(&parses);
+                }
+            }
+
+            void Dispatch(const mdns_responce& responce)
+            {
+                uint16_t id = static_cast<uint16_t>((responce.data[0] << 8) | responce.data[1]);
+
+                if (id != 0)
+                {
+                    Deliver(id, responce);
+                    return;
+                }
+
+                // callbacks may add or cancel queries, so collect first
+                m_matched.clear();
+                for (auto& item: m_queries)
+                {
+                    if (Answers(responce, item.second.name, item.second.qtype))
+                        m_matched.push_back(item.first);
+                }
+
+                for (auto i: m_matched)
+                    Deliver(i, responce);
+            }
+
+            void Deliver(uint16_t id, const mdns_responce& responce)
+            {
+                auto it = m_queries.find(id);
+                if (it == m_queries.end() || !it->second.onResponce)
+                    return;
+
+                auto callback = it->second.onResponce;
+                callback(id, responce);
+            }
+
+            void Expire()
+            {
+                auto now = std::chrono::steady_clock::now();
+
+                while (!m_deadlines.empty() && m_deadlines.begin()->first <= now)
+                {
+                    uint16_t id = m_deadlines.begin()->second;
+                    m_deadlines.erase(m_deadlines.begin());
+
+                    auto it = m_queries.find(id);
+                    auto callback = std::move(it->second.onComplete);
+                    m_queries.erase(it);
+
+                    if (callback)
+                        callback(id);
+                }
+            }
+
+            int m_fd;
+            int m_epoll;
+            uint16_t m_nextId;
+            sockaddr_storage m_destination;
+            std::unordered_map<uint16_t, query> m_queries;
+            std::multimap<std::chrono::steady_clock::time_point, uint16_t> m_deadlines;
+            std::vector<uint16_t> m_matched;
+            std::vector<uint8_t> m_packet;
+            receive_ring m_ring;
+            mdns_responce m_parsed;
+        };
+    }
+}
+
+#endif // __linux__
+
+#endif // ZEROCONF_ENGINE_HPP
\ No newline at end of file
@@ -0,0 +1,519 @@
+#ifndef ZEROCONF_METRICS_HPP
+#define ZEROCONF_METRICS_HPP
+
+//////////////////////////////////////////////////////////////////////////
+// zeroconf-metrics.hpp
+
+// (C) Copyright 2016 Yuri Yakovlev <yvzmail@gmail.com>
+// Use, modification and distribution is subject to the GNU General Public License
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+
+#ifdef WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+
+#include "zeroconf-util.hpp"
+
+namespace Zeroconf
+{
+    namespace Detail
+    {
+        const size_t MetricsBuckets = 32; // bucket 0 counts 0 µs, bucket i > 0 counts [2^(i-1), 2^i) µs
+        const size_t MetricsMaxPeers = 1024;
+
+        // Why Parse rejected a message
+        enum class ParseFailure { Truncated, Flags, QueryName, RecordName };
+        const size_t ParseFailureCount = 4;
+
+        struct histogram_snapshot
+        {
+            uint64_t count;
+            uint64_t sum; // µs
+            uint64_t buckets[MetricsBuckets];
+
+            double Mean() const
+            {
+                return count == 0 ? 0 : static_cast<double>(sum) / count;
+            }
+
+            // Upper bound in µs of the bucket that holds the given fraction of the samples
+            uint64_t Percentile(double fraction) const
+            {
+                uint64_t seen = 0;
+                for (size_t i = 0; i < MetricsBuckets; i++)
+                {
+                    seen += buckets[i];
+                    if (seen > 0 && seen >= fraction * count)
+                        return i == 0 ? 0 : (uint64_t(1) << i);
+                }
+
+                return 0;
+            }
+        };
+
+        inline uint64_t Microseconds(std::chrono::steady_clock::duration duration)
+        {
+            auto us = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+            return us > 0 ? static_cast<uint64_t>(us) : 0;
+        }
+
+        inline size_t MetricsBucket(uint64_t us)
+        {
+            size_t bucket = 0;
+            while (bucket < MetricsBuckets - 1 && us >= (uint64_t(1) << bucket))
+                bucket++;
+
+            return bucket;
+        }
+
+        // Latency histogram with power of two buckets, safe to record from any thread
+        class histogram
+        {
+        public:
+            histogram()
+            {
+                Reset();
+            }
+
+            void Record(std::chrono::steady_clock::duration duration)
+            {
+                auto value = Microseconds(duration);
+
+                m_count.fetch_add(1, std::memory_order_relaxed);
+                m_sum.fetch_add(value, std::memory_order_relaxed);
+                m_buckets[MetricsBucket(value)].fetch_add(1, std::memory_order_relaxed);
+            }
+
+            // Adds the samples gathered elsewhere
+            void Add(const histogram_snapshot& samples)
+            {
+                if (samples.count == 0)
+                    return;
+
+                m_count.fetch_add(samples.count, std::memory_order_relaxed);
+                m_sum.fetch_add(samples.sum, std::memory_order_relaxed);
+
+                for (size_t i = 0; i < MetricsBuckets; i++)
+                {
+                    if (samples.buckets[i] != 0)
+                        m_buckets[i].fetch_add(samples.buckets[i], std::memory_order_relaxed);
+                }
+            }
+
+            histogram_snapshot Snapshot() const
+            {
+                histogram_snapshot result;
+                result.count = m_count.load(std::memory_order_relaxed);
+                result.sum = m_sum.load(std::memory_order_relaxed);
+
+                for (size_t i = 0; i < MetricsBuckets; i++)
+                    result.buckets[i] = m_buckets[i].load(std::memory_order_relaxed);
+
+                return result;
+            }
+
+            void Reset()
+            {
+                m_count = 0;
+                m_sum = 0;
+
+                for (auto& item: m_buckets)
+                    item = 0;
+            }
+
+        private:
+            std::atomic<uint64_t> m_count;
+            std::atomic<uint64_t> m_sum;
+            std::atomic<uint64_t> m_buckets[MetricsBuckets];
+        };
+
+        // Outcomes and latencies of Parse, gathered by one thread over a scan or a batch of packets
+        // and added to the process-wide metrics in one go (metrics::Fold), so that threads parsing
+        // side by side don't contend for the same counters
+        struct parse_tally
+        {
+            parse_tally()
+            {
+                Reset();
+            }
+
+            void Parsed(std::chrono::steady_clock::duration duration)
+            {
+                parsed++;
+                Record(duration);
+            }
+
+            void Rejected(ParseFailure reason, std::chrono::steady_clock::duration duration)
+            {
+                rejected++;
+                failures[static_cast<size_t>(reason)]++;
+                Record(duration);
+            }
+
+            void Reset()
+            {
+                memset(this, 0, sizeof(*this));
+            }
+
+            uint64_t parsed;
+            uint64_t rejected;
+            uint64_t failures[ParseFailureCount]; // by ParseFailure
+            histogram_snapshot latency;
+
+        private:
+            void Record(std::chrono::steady_clock::duration duration)
+            {
+                auto value = Microseconds(duration);
+                latency.count++;
+                latency.sum += value;
+                latency.buckets[MetricsBucket(value)]++;
+            }
+        };
+
+        struct peer_timing
+        {
+            uint64_t answers; // scans the peer answered
+            uint64_t last;    // µs from the query to its first answer
+            uint64_t min;
+            uint64_t max;
+            uint64_t sum;
+        };
+
+        struct metrics_snapshot
+        {
+            uint64_t scans;
+            uint64_t packetsSent;
+            uint64_t bytesSent;
+            uint64_t sendFailures;
+            uint64_t packetsReceived;
+            uint64_t bytesReceived;
+            uint64_t parsed;
+            uint64_t rejected;
+            uint64_t parseFailures[ParseFailureCount]; // by ParseFailure
+            uint64_t answers; // responces handed to Resolve callbacks
+            uint64_t repeats; // repeated answers Resolve dropped
+
+            histogram_snapshot send;        // sendto
+            histogram_snapshot wait;        // select
+            histogram_snapshot recv;        // recvmmsg or recvfrom, per batch
+            histogram_snapshot parse;       // Parse, accepted or not
+            histogram_snapshot firstAnswer; // from the query to the first answer of the scan
+            histogram_snapshot rtt;         // from the query to the first answer of each peer
+
+            std::map<std::string, peer_timing> peers; // by address, at most MetricsMaxPeers
+        };
+
+        inline std::string PeerAddress(const sockaddr_storage& peer)
+        {
+            char text[64] = {0};
+
+            if (peer.ss_family == AF_INET6)
+                inet_ntop(AF_INET6, const_cast<in6_addr*>(&reinterpret_cast<const sockaddr_in6*>(&peer)->sin6_addr), text, sizeof(text));
+            else
+                inet_ntop(AF_INET, const_cast<in_addr*>(&reinterpret_cast<const sockaddr_in*>(&peer)->sin_addr), text, sizeof(text));
+
+            return text;
+        }
+
+        // Process-wide counters of the resolve pipeline. Every update is a relaxed atomic add, only the
+        // per-peer table takes a lock, once per peer and scan. Parse results come in through a
+        // parse_tally per scan or per batch rather than per packet. Defining ZEROCONF_DISABLE_METRICS
+        // compiles the updates and the clock reads away.
+        class metrics
+        {
+        public:
+            typedef std::chrono::steady_clock clock;
+
+            metrics()
+            {
+                Reset();
+            }
+
+            static clock::time_point Now()
+            {
+#if defined(ZEROCONF_DISABLE_METRICS)
+                return clock::time_point();
+#else
+                return clock::now();
+#endif
+            }
+
+            void Sent(size_t size, clock::duration duration)
+            {
+#if !defined(ZEROCONF_DISABLE_METRICS)
+                m_packetsSent.fetch_add(1, std::memory_order_relaxed);
+                m_bytesSent.fetch_add(size, std::memory_order_relaxed);
+                m_send.Record(duration);
+#endif
+            }
+
+            void SendFailed()
+            {
+#if !defined(ZEROCONF_DISABLE_METRICS)
+                m_sendFailures.fetch_add(1, std::memory_order_relaxed);
+#endif
+            }
+
+            void Waited(clock::duration duration)
+            {
+#if !defined(ZEROCONF_DISABLE_METRICS)
+                m_wait.Record(duration);
+#endif
+            }
+
+            void Received(size_t packets, size_t bytes, clock::duration duration)
+            {
+#if !defined(ZEROCONF_DISABLE_METRICS)
+                m_packetsReceived.fetch_add(packets, std::memory_order_relaxed);
+                m_bytesReceived.fetch_add(bytes, std::memory_order_relaxed);
+                m_recv.Record(duration);
+#endif
+            }
+
+            // Adds the tally and clears it
+            void Fold(parse_tally* tally)
+            {
+#if !defined(ZEROCONF_DISABLE_METRICS)
+                if (tally->parsed != 0)
+                    m_parsed.fetch_add(tally->parsed, std::memory_order_relaxed);
+
+                if (tally->rejected != 0)
+                {
+                    m_rejected.fetch_add(tally->rejected, std::memory_order_relaxed);
+
+                    for (size_t i = 0; i < ParseFailureCount; i++)
+                    {
+                        if (tally->failures[i] != 0)
+                            m_parseFailures[i].fetch_add(tally->failures[i], std::memory_order_relaxed);
+                    }
+                }
+
+                m_parse.Add(tally->latency);
+#endif
+                tally->Reset();
+            }
+
+            void Rejected(ParseFailure reason, clock::duration duration)
+            {
+#if !defined(ZEROCONF_DISABLE_METRICS)
+                m_rejected.fetch_add(1, std::memory_order_relaxed);
+                m_parseFailures[static_cast<size_t>(reason)].fetch_add(1, std::memory_order_relaxed);
+                m_parse.Record(duration);
+#endif
+            }
+
+            void ScanStarted()
+            {
+#if !defined(ZEROCONF_DISABLE_METRICS)
+                m_scans.fetch_add(1, std::memory_order_relaxed);
+#endif
+            }
+
+            void Answered()
+            {
+#if !defined(ZEROCONF_DISABLE_METRICS)
+                m_answers.fetch_add(1, std::memory_order_relaxed);
+#endif
+            }
+
+            void Repeated()
+            {
+#if !defined(ZEROCONF_DISABLE_METRICS)
+                m_repeats.fetch_add(1, std::memory_order_relaxed);
+#endif
+            }
+
+            void FirstAnswer(clock::duration duration)
+            {
+#if !defined(ZEROCONF_DISABLE_METRICS)
+                m_firstAnswer.Record(duration);
+#endif
+            }
+
+            // The first answer of the peer within a scan
+            void PeerAnswered(const sockaddr_storage& peer, clock::duration duration)
+            {
+#if !defined(ZEROCONF_DISABLE_METRICS)
+                m_rtt.Record(duration);
+
+                auto us = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(duration).count());
+                auto address = PeerAddress(peer);
+
+                std::lock_guard<std::mutex> lock(m_mutex);
+
+                auto it = m_peers.find(address);
+                if (it == m_peers.end())
+                {
+                    if (m_peers.size() >= MetricsMaxPeers)
+                        return;
+
+                    peer_timing timing = { 0, 0, us, us, 0 };
+                    it = m_peers.insert(std::make_pair(address, timing)).first;
+                }
+
+                auto& timing = it->second;
+                timing.answers++;
+                timing.last = us;
+                timing.min = std::min(timing.min, us);
+                timing.max = std::max(timing.max, us);
+                timing.sum += us;
+#else
+                (void)peer;
+                (void)duration;
+#endif
+            }
+
+            metrics_snapshot Snapshot() const
+            {
+                metrics_snapshot result;
+                result.scans = m_scans.load(std::memory_order_relaxed);
+                result.packetsSent = m_packetsSent.load(std::memory_order_relaxed);
+                result.bytesSent = m_bytesSent.load(std::memory_order_relaxed);
+                result.sendFailures = m_sendFailures.load(std::memory_order_relaxed);
+                result.packetsReceived = m_packetsReceived.load(std::memory_order_relaxed);
+                result.bytesReceived = m_bytesReceived.load(std::memory_order_relaxed);
+                result.parsed = m_parsed.load(std::memory_order_relaxed);
+                result.rejected = m_rejected.load(std::memory_order_relaxed);
+                result.answers = m_answers.load(std::memory_order_relaxed);
+                result.repeats = m_repeats.load(std::memory_order_relaxed);
+
+                for (size_t i = 0; i < ParseFailureCount; i++)
+                    result.parseFailures[i] = m_parseFailures[i].load(std::memory_order_relaxed);
+
+                result.send = m_send.Snapshot();
+                result.wait = m_wait.Snapshot();
+                result.recv = m_recv.Snapshot();
+                result.parse = m_parse.Snapshot();
+                result.firstAnswer = m_firstAnswer.Snapshot();
+                result.rtt = m_rtt.Snapshot();
+
+                std::lock_guard<std::mutex> lock(m_mutex);
+                result.peers = m_peers;
+
+                return result;
+            }
+
+            void Reset()
+            {
+                m_scans = m_packetsSent = m_bytesSent = m_sendFailures = 0;
+                m_packetsReceived = m_bytesReceived = m_parsed = m_rejected = m_answers = m_repeats = 0;
+
+                for (auto& item: m_parseFailures)
+                    item = 0;
+
+                m_send.Reset();
+                m_wait.Reset();
+                m_recv.Reset();
+                m_parse.Reset();
+                m_firstAnswer.Reset();
+                m_rtt.Reset();
+
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_peers.clear();
+            }
+
+        private:
+            std::atomic<uint64_t> m_scans;
+            std::atomic<uint64_t> m_packetsSent;
+            std::atomic<uint64_t> m_bytesSent;
+            std::atomic<uint64_t> m_sendFailures;
+            std::atomic<uint64_t> m_packetsReceived;
+            std::atomic<uint64_t> m_bytesReceived;
+            std::atomic<uint64_t> m_parsed;
+            std::atomic<uint64_t> m_rejected;
+            std::atomic<uint64_t> m_parseFailures[ParseFailureCount];
+            std::atomic<uint64_t> m_answers;
+            std::atomic<uint64_t> m_repeats;
+
+            histogram m_send;
+            histogram m_wait;
+            histogram m_recv;
+            histogram m_parse;
+            histogram m_firstAnswer;
+            histogram m_rtt;
+
+            mutable std::mutex m_mutex;
+            std::map<std::string, peer_timing> m_peers;
+        };
+
+        inline metrics& Metrics()
+        {
+            static metrics instance;
+            return instance;
+        }
+
+        // Times the answers of one scan from the moment the queries go out
+        class scan_timer
+        {
+        public:
+            scan_timer() : m_start(metrics::Now()), m_answered(false)
+            {
+                Metrics().ScanStarted();
+            }
+
+            ~scan_timer()
+            {
+                Metrics().Fold(&m_parses);
+            }
+
+            scan_timer(const scan_timer&) = delete;
+            scan_timer& operator=(const scan_timer&) = delete;
+
+            // What the scan parsed, added to the metrics once it ends
+            parse_tally* Parses() { return &m_parses; }
+
+            void Answered(const sockaddr_storage& peer)
+            {
+#if !defined(ZEROCONF_DISABLE_METRICS)
+                auto elapsed = metrics::Now() - m_start;
+
+                Metrics().Answered();
+
+                if (!m_answered)
+                    Metrics().FirstAnswer(elapsed);
+
+                m_answered = true;
+
+                if (m_peers.insert(Key(peer)).second)
+                    Metrics().PeerAnswered(peer, elapsed);
+#else
+                (void)peer;
+#endif
+            }
+
+        private:
+            // The address bytes, cheaper than the text
+            static std::string Key(const sockaddr_storage& peer)
+            {
+                if (peer.ss_family == AF_INET6)
+                {
+                    auto& addr = reinterpret_cast<const sockaddr_in6&>(peer).sin6_addr;
+                    return std::string(reinterpret_cast<const char*>(&addr), sizeof(addr));
+                }
+
+                auto& addr = reinterpret_cast<const sockaddr_in&>(peer).sin_addr;
+                return std::string(reinterpret_cast<const char*>(&addr), sizeof(addr));
+            }
+
+            metrics::clock::time_point m_start;
+            bool m_answered;
+            std::set<std::string> m_peers;
+            parse_tally m_parses;
+        };
+    }
+}
+
+#endif // ZEROCONF_METRICS_HPP
@@ -0,0 +1,567 @@
+#ifndef ZEROCONF_PCAP_HPP
+#define ZEROCONF_PCAP_HPP
+
+//////////////////////////////////////////////////////////////////////////
+// zeroconf-pcap.hpp
+
+// (C) Copyright 2016 Yuri Yakovlev <yvzmail@gmail.com>
+// Use, modification and distribution is subject to the GNU General Public License
+
+#include <map>
+#include <thread>
+#include <condition_variable>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#endif
+
+#include "zeroconf-util.hpp"
+#include "zeroconf-detail.hpp"
+
+namespace Zeroconf
+{
+    namespace Detail
+    {
+        const uint32_t PcapMagic = 0xA1B2C3D4;
+        const uint32_t PcapMagicNs = 0xA1B23C4D;
+        const uint32_t PcapngSectionBlock = 0x0A0D0D0A;
+        const uint32_t PcapngInterfaceBlock = 1;
+        const uint32_t PcapngSimplePacketBlock = 3;
+        const uint32_t PcapngEnhancedPacketBlock = 6;
+        const uint32_t PcapngByteOrderMagic = 0x1A2B3C4D;
+
+        const uint16_t LinkTypeNull = 0;
+        const uint16_t LinkTypeEthernet = 1;
+        const uint16_t LinkTypeRaw = 101;
+        const uint16_t LinkTypeLinuxSll = 113;
+        const uint16_t LinkTypeLinuxSll2 = 276;
+
+        const size_t PcapReplayBatchSize = 1024;
+
+        struct capture_frame
+        {
+            uint16_t linkType;
+            const uint8_t* data;
+            size_t size;
+        };
+
+        // Walks the frames of a pcap or pcapng capture in place, in either byte order
+        class capture_reader
+        {
+        public:
+            capture_reader(const uint8_t* data, size_t size)
+                : m_data(data), m_size(size), m_pos(0), m_swapped(false), m_ng(false), m_linkType(0)
+            {
+                if (size < 24)
+                    return;
+
+                uint32_t magic = Get32(0);
+                if (magic == PcapngSectionBlock)
+                {
+                    m_ng = true;
+                    return;
+                }
+
+                m_swapped = magic != PcapMagic && magic != PcapMagicNs;
+                magic = Get32(0);
+                if (magic != PcapMagic && magic != PcapMagicNs)
+                    return;
+
+                m_linkType = static_cast<uint16_t>(Get32(20));
+                m_pos = 24;
+            }
+
+            // False when the data is neither pcap nor pcapng
+            bool Valid() const
+            {
+                return m_ng || m_pos != 0;
+            }
+
+            bool Next(capture_frame* result)
+            {
+                return m_ng ? NextBlock(result) : NextRecord(result);
+            }
+
+        private:
+            uint16_t Get16(size_t pos) const
+            {
+                uint16_t value;
+                memcpy(&value, m_data + pos, sizeof(value));
+                return m_swapped ? static_cast<uint16_t>((value >> 8) | (value << 8)) : value;
+            }
+
+            uint32_t Get32(size_t pos) const
+            {
+                uint32_t value;
+                memcpy(&value, m_data + pos, sizeof(value));
+                return m_swapped ?
+                    (value >> 24) | ((value >> 8) & 0xFF00) | ((value << 8) & 0xFF0000) | (value << 24) :
+                    value;
+            }
+
+            bool NextRecord(capture_frame* result)
+            {
+                // ts_sec, ts_usec, incl_len, orig_len
+                if (m_pos == 0 || m_size - m_pos < 16)
+                    return false;
+
+                size_t length = Get32(m_pos + 8);
+                if (length > m_size - m_pos - 16)
+                    return false;
+
+                result->linkType = m_linkType;
+                result->data = m_data + m_pos + 16;
+                result->size = length;
+
+                m_pos += 16 + length;
+                return true;
+            }
+
+            bool NextBlock(capture_frame* result)
+            {
+                while (m_size - m_pos >= 12)
+                {
+                    uint32_t type;
+                    memcpy(&type, m_data + m_pos, sizeof(type));
+
+                    // a section header sets the byte order of everything up to the next one
+                    if (type == PcapngSectionBlock)
+                    {
+                        uint32_t magic;
+                        memcpy(&magic, m_data + m_pos + 8, sizeof(magic));
+                        m_swapped = magic != PcapngByteOrderMagic;
+                        m_interfaces.clear();
+                    }
+                    else
+                    {
+                        type = Get32(m_pos);
+                    }
+
+                    size_t length = Get32(m_pos + 4);
+                    if (length < 12 || length % 4 != 0 || length > m_size - m_pos)
+                        return false;
+
+                    size_t body = m_pos + 8;
+                    size_t bodyLength = length - 12;
+                    m_pos += length;
+
+                    if (type == PcapngInterfaceBlock && bodyLength >= 2)
+                    {
+                        m_interfaces.push_back(Get16(body));
+                    }
+                    else if (type == PcapngEnhancedPacketBlock && bodyLength >= 20)
+                    {
+                        size_t itf = Get32(body);
+                        size_t captured = Get32(body + 12);
+                        if (itf >= m_interfaces.size() || captured > bodyLength - 20)
+                            continue;
+
+                        result->linkType = m_interfaces[itf];
+                        result->data = m_data + body + 20;
+                        result->size = captured;
+                        return true;
+                    }
+                    else if (type == PcapngSimplePacketBlock && bodyLength >= 4)
+                    {
+                        if (m_interfaces.empty())
+                            continue;
+
+                        result->linkType = m_interfaces[0];
+                        result->data = m_data + body + 4;
+                        result->size = std::min<size_t>(Get32(body), bodyLength - 4);
+                        return true;
+                    }
+                }
+
+                return false;
+            }
+
+            const uint8_t* m_data;
+            size_t m_size;
+            size_t m_pos;
+            bool m_swapped;
+            bool m_ng;
+            uint16_t m_linkType;
+            std::vector<uint16_t> m_interfaces;
+        };
+
+        // Finds the UDP payload of a frame sent from or to port 5353, the payload points into the frame.
+        // Fragments are skipped, a single mDNS message rarely needs them.
+        inline bool ExtractMdns(const capture_frame& frame, sockaddr_storage* peer, const uint8_t** payload, size_t* size)
+        {
+            auto p = frame.data;
+            auto end = frame.data + frame.size;
+
+            auto get16 = [](const uint8_t* at) { return static_cast<uint16_t>((at[0] << 8) | at[1]); };
+
+            uint16_t ethertype = 0;
+
+            switch (frame.linkType)
+            {
+                case LinkTypeEthernet:
+                    if (end - p < 14)
+                        return false;
+
+                    ethertype = get16(p + 12);
+                    p += 14;
+
+                    // 802.1Q and 802.1ad tags
+                    while ((ethertype == 0x8100 || ethertype == 0x88A8) && end - p >= 4)
+                    {
+                        ethertype = get16(p + 2);
+                        p += 4;
+                    }
+                    break;
+
+                case LinkTypeLinuxSll:
+                    if (end - p < 16)
+                        return false;
+
+                    ethertype = get16(p + 14);
+                    p += 16;
+                    break;
+
+                case LinkTypeLinuxSll2:
+                    if (end - p < 20)
+                        return false;
+
+                    ethertype = get16(p);
+                    p += 20;
+                    break;
+
+                case LinkTypeNull:
+                    if (end - p < 4)
+                        return false;
+
+                    p += 4;
+                    break;
+
+                case LinkTypeRaw:
+                    break;
+
+                default:
+                    return false;
+            }
+
+            if (ethertype == 0 && p < end)
+                ethertype = (*p >> 4) == 6 ? 0x86DD : 0x0800;
+
+            memset(peer, 0, sizeof(sockaddr_storage));
+            uint8_t protocol = 0;
+
+            if (ethertype == 0x0800)
+            {
+                if (end - p < 20 || (p[0] >> 4) != 4)
+                    return false;
+
+                size_t headerLength = (p[0] & 0x0F) * 4;
+                size_t totalLength = get16(p + 2);
+                if (headerLength < 20 || totalLength < headerLength || totalLength > static_cast<size_t>(end - p))
+                    return false;
+
+                // more fragments or a fragment offset
+                if ((get16(p + 6) & 0x3FFF) != 0)
+                    return false;
+
+                protocol = p[9];
+
+                auto addr = reinterpret_cast<sockaddr_in*>(peer);
+                addr->sin_family = AF_INET;
+                memcpy(&addr->sin_addr, p + 12, sizeof(in_addr));
+
+                end = p + totalLength;
+                p += headerLength;
+            }
+            else if (ethertype == 0x86DD)
+            {
+                if (end - p < 40 || (p[0] >> 4) != 6)
+                    return false;
+
+                size_t payloadLength = get16(p + 4);
+                if (payloadLength > static_cast<size_t>(end - p - 40))
+                    return false;
+
+                protocol = p[6];
+
+                auto addr = reinterpret_cast<sockaddr_in6*>(peer);
+                addr->sin6_family = AF_INET6;
+                memcpy(&addr->sin6_addr, p + 8, sizeof(in6_addr));
+
+                end = p + 40 + payloadLength;
+                p += 40;
+
+                // hop-by-hop, routing and destination options
+                while ((protocol == 0 || protocol == 43 || protocol == 60) && end - p >= 8)
+                {
+                    size_t length = (p[1] + 1) * 8;
+                    if (length > static_cast<size_t>(end - p))
+                        return false;
+
+                    protocol = p[0];
+                    p += length;
+                }
+            }
+            else
+            {
+                return false;
+            }
+
+            if (protocol != 17 || end - p < 8)
+                return false;
+
+            uint16_t srcPort = get16(p);
+            uint16_t dstPort = get16(p + 2);
+            size_t udpLength = get16(p + 4);
+
+            if (srcPort != 5353 && dstPort != 5353)
+                return false;
+
+            if (udpLength < 8 || udpLength > static_cast<size_t>(end - p))
+                return false;
+
+            if (peer->ss_family == AF_INET)
+                reinterpret_cast<sockaddr_in*>(peer)->sin_port = htons(srcPort);
+            else
+                reinterpret_cast<sockaddr_in6*>(peer)->sin6_port = htons(srcPort);
+
+            *payload = p + 8;
+            *size = udpLength - 8;
+            return true;
+        }
+
+        struct responder_stats
+        {
+            responder_stats() : packets(0), records(0), bytes(0), failed(0) {}
+
+            size_t packets;
+            size_t records;
+            size_t bytes;
+            size_t failed;
+        };
+
+        struct capture_stats
+        {
+            capture_stats() : frames(0), queries(0), responces(0), records(0), failed(0), bytes(0), seconds(0) {}
+
+            size_t frames;     // all frames of the capture
+            size_t queries;    // mDNS queries, not parsed
+            size_t responces;  // parsed responces
+            size_t records;
+            size_t failed;     // mDNS responces Parse rejected
+            size_t bytes;      // mDNS payload bytes
+            double seconds;    // wall time of the replay
+            std::map<std::string, responder_stats> responders; // by address of the sender
+        };
+
+        // Parses every mDNS message of the capture on a pool of workers. The reader hands batches
+        // of payloads, still pointing into the capture, to the workers, which keep their own
+        // statistics until the end, so the only shared state is the batch queue.
+        inline bool ReplayCapture(const uint8_t* data, size_t size, size_t workers, capture_stats* result)
+        {
+            *result = capture_stats();
+
+            capture_reader reader(data, size);
+            if (!reader.Valid())
+            {
+                Log::Error("Unknown capture format");
+                return false;
+            }
+
+            struct payload
+            {
+                const uint8_t* data;
+                size_t size;
+                sockaddr_storage peer;
+            };
+
+            typedef std::vector<payload> batch;
+
+            if (workers == 0)
+                workers = std::max(1u, std::thread::hardware_concurrency());
+
+            auto start = std::chrono::steady_clock::now();
+
+            std::mutex lock;
+            std::condition_variable ready;
+            std::condition_variable drained;
+            std::queue<batch> queue;
+            bool done = false;
+
+            std::vector<capture_stats> partial(workers);
+            std::vector<std::map<std::string, sockaddr_storage>> peers(workers);
+            std::vector<std::thread> threads;
+
+            for (size_t i = 0; i < workers; i++)
+            {
+                threads.emplace_back([&, i]()
+                {
+                    auto& stats = partial[i];
+                    mdns_responce parsed;
+                    batch items;
+
+                    while (1)
+                    {
+                        {
+                            std::unique_lock<std::mutex> guard(lock);
+                            ready.wait(guard, [&]() { return done || !queue.empty(); });
+
+                            if (queue.empty())
+                                return;
+
+                            items.swap(queue.front());
+                            queue.pop();
+                        }
+
+                        drained.notify_one();
+
+                        for (auto& item: items)
+                        {
+                            // raw address bytes make a cheap key, turned into text at the end
+                            auto& peer = item.peer;
+                            std::string key(reinterpret_cast<const char*>(&peer), sizeof(sockaddr_in6));
+
+                            auto& responder = stats.responders[key];
+                            if (responder.packets == 0 && responder.failed == 0)
+                                peers[i][key] = peer;
+
+                            if (Parse(item.data, item.size, &parsed))
+                            {
+                                stats.responces++;
+                                stats.records += parsed.records.size();
+                                responder.packets++;
+                                responder.records += parsed.records.size();
+                            }
+                            else
+                            {
+                                stats.failed++;
+                                responder.failed++;
+                            }
+
+                            responder.bytes += item.size;
+                        }
+                    }
+                });
+            }
+
+            batch items;
+            items.reserve(PcapReplayBatchSize);
+
+            auto flush = [&]()
+            {
+                std::unique_lock<std::mutex> guard(lock);
+
+                // bounded queue, the reader waits for the workers rather than buffering the whole capture
+                drained.wait(guard, [&]() { return queue.size() < workers * 4; });
+
+                queue.push(std::move(items));
+                guard.unlock();
+
+                ready.notify_one();
+
+                items = batch();
+                items.reserve(PcapReplayBatchSize);
+            };
+
+            capture_frame frame;
+            while (reader.Next(&frame))
+            {
+                result->frames++;
+
+                payload item;
+                if (!ExtractMdns(frame, &item.peer, &item.data, &item.size))
+                    continue;
+
+                result->bytes += item.size;
+
+                // the QR bit tells queries apart
+                if (item.size < 3 || (item.data[2] & 0x80) == 0)
+                {
+                    result->queries++;
+                    continue;
+                }
+
+                items.push_back(item);
+                if (items.size() == PcapReplayBatchSize)
+                    flush();
+            }
+
+            if (!items.empty())
+                flush();
+
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                done = true;
+            }
+
+            ready.notify_all();
+
+            for (auto& thread: threads)
+                thread.join();
+
+            for (size_t i = 0; i < workers; i++)
+            {
+                result->responces += partial[i].responces;
+                result->records += partial[i].records;
+                result->failed += partial[i].failed;
+
+                for (auto& item: partial[i].responders)
+                {
+                    auto& responder = result->responders[PeerAddress(peers[i][item.first])];
+                    responder.packets += item.second.packets;
+                    responder.records += item.second.records;
+                    responder.bytes += item.second.bytes;
+                    responder.failed += item.second.failed;
+                }
+            }
+
+            result->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            return true;
+        }
+
+#ifndef WIN32
+        // Maps the capture file instead of reading it, so gigabytes of it cost only page cache
+        inline bool ReplayCapture(const std::string& path, size_t workers, capture_stats* result)
+        {
+            int fd = open(path.c_str(), O_RDONLY);
+            if (fd < 0)
+            {
+                Log::Error("Failed to open ", path, " with code ", errno);
+                return false;
+            }
+
+            std::shared_ptr<void> guard(0, [fd](void*) { close(fd); });
+
+            struct stat st;
+            if (fstat(fd, &st) < 0)
+            {
+                Log::Error("Failed to stat ", path, " with code ", errno);
+                return false;
+            }
+
+            size_t size = static_cast<size_t>(st.st_size);
+            if (size == 0)
+            {
+                Log::Error("Empty capture ", path);
+                return false;
+            }
+
+            void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data == MAP_FAILED)
+            {
+                Log::Error("Failed to map ", path, " with code ", errno);
+                return false;
+            }
+
+            std::shared_ptr<void> unmap(data, [size](void* p) { munmap(p, size); });
+            madvise(data, size, MADV_SEQUENTIAL);
+
+            return ReplayCapture(static_cast<const uint8_t*>(data), size, workers, result);
+        }
+#endif
+    }
+}
+
+#endif // ZEROCONF_PCAP_HPP
@@ -0,0 +1,502 @@
+#ifndef ZEROCONF_RESPONDER_HPP
+#define ZEROCONF_RESPONDER_HPP
+
+//////////////////////////////////////////////////////////////////////////
+// zeroconf-responder.hpp
+
+// (C) Copyright 2016 Yuri Yakovlev <yvzmail@gmail.com>
+// Use, modification and distribution is subject to the GNU General Public License
+
+#include <unordered_map>
+
+#include "zeroconf-util.hpp"
+#include "zeroconf-detail.hpp"
+
+namespace Zeroconf
+{
+    namespace Detail
+    {
+        const uint16_t MdnsPort = 5353;
+        const uint32_t MdnsLegacyUnicastTtl = 10; // RFC 6762 6.7
+        const uint16_t MdnsUnicastResponseBit = 0x8000;
+
+        struct service_info
+        {
+            service_info() : port(0), ttl(120) { memset(&address, 0, sizeof(address)); }
+
+            std::string instance;         // "Office Printer"
+            std::string type;             // "_ipp._tcp.local"
+            std::string host;             // "printer.local"
+            uint16_t port;
+            std::vector<std::string> txt; // "key=value" strings
+            in_addr address;
+            uint32_t ttl;
+        };
+
+        // Answers queries about the registered services from packets serialized at registration.
+        //
+        // Every question a service can answer maps to two ready messages: a multicast one, and
+        // a legacy unicast one that repeats the question and caps the TTLs. Answering a query
+        // only patches the ID and sends, so after the first few queries nothing is allocated.
+        // Known-answer suppression and probing are left to the callers.
+        class responder
+        {
+        public:
+            responder() : m_fd(-1), m_answered(0), m_group(MulticastAddress(AF_INET, 0))
+            {
+            }
+
+            ~responder()
+            {
+                Close();
+            }
+
+            responder(const responder&) = delete;
+            responder& operator=(const responder&) = delete;
+
+            // Listens on the port of all addresses and joins the mDNS group, port 0 picks a free one
+            bool Open(uint16_t port = MdnsPort)
+            {
+                Close();
+
+                m_fd = static_cast<int>(socket(AF_INET, SOCK_DGRAM, 0));
+                if (m_fd < 0)
+                {
+                    Log::Error("Failed to create socket with code ", GetSocketError());
+                    return false;
+                }
+
+                if (!Selectable(m_fd))
+                {
+                    Close();
+                    return false;
+                }
+
+                if (setsockopt(m_fd, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&SockTrue), sizeof(SockTrue)) < 0)
+                {
+                    Log::Error("Failed to set socket option SO_REUSEADDR with code ", GetSocketError());
+                    Close();
+                    return false;
+                }
+
+                sockaddr_in addr = {0};
+                addr.sin_family = AF_INET;
+                addr.sin_port = htons(port);
+                addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+                if (bind(m_fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) < 0)
+                {
+                    Log::Error("Failed to bind socket with code ", GetSocketError());
+                    Close();
+                    return false;
+                }
+
+                ip_mreq group = {0};
+                group.imr_multiaddr = reinterpret_cast<const sockaddr_in*>(&m_group)->sin_addr;
+                group.imr_interface.s_addr = htonl(INADDR_ANY);
+
+                // hosts without a multicast route can still answer unicast queries
+                if (setsockopt(m_fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, reinterpret_cast<const char*>(&group), sizeof(group)) < 0)
+                    Log::Warning("Failed to join the mDNS group with code ", GetSocketError());
+
+                return true;
+            }
+
+            void Close()
+            {
+                if (m_fd >= 0)
+                    CloseSocket(m_fd);
+
+                m_fd = -1;
+            }
+
+            int Fd() const { return m_fd; }
+
+            // Queries answered so far
+            size_t Answered() const { return m_answered; }
+
+            // Where the multicast answers go, the mDNS group by default
+            void SetGroup(const sockaddr_storage& group)
+            {
+                m_group = group;
+            }
+
+            bool Register(const service_info& service)
+            {
+                if (service.instance.empty() || service.type.empty() || service.host.empty())
+                {
+                    Log::Error("Incomplete service ", service.instance);
+                    return false;
+                }
+
+                for (auto& item: m_services)
+                {
+                    if (NameEquals(item.instance, service.instance) && NameEquals(item.type, service.type))
+                    {
+                        Log::Error("Service ", service.instance, ".", service.type, " is already registered");
+                        return false;
+                    }
+                }
+
+                m_services.push_back(service);
+                if (!Rebuild())
+                {
+                    m_services.pop_back();
+                    Rebuild();
+                    return false;
+                }
+
+                if (m_fd >= 0)
+                    Announce(m_services.back(), false);
+
+                return true;
+            }
+
+            // Sends the goodbye, all records of the service with TTL 0
+            bool Unregister(const std::string& instance, const std::string& type)
+            {
+                auto it = std::find_if(m_services.begin(), m_services.end(), [&](const service_info& item)
+                {
+                    return NameEquals(item.instance, instance) && NameEquals(item.type, type);
+                });
+
+                if (it == m_services.end())
+                    return false;
+
+                if (m_fd >= 0)
+                    Announce(*it, true);
+
+                m_services.erase(it);
+                return Rebuild();
+            }
+
+            // Waits up to timeoutMs for queries and answers everything that is ready
+            bool Poll(int timeoutMs)
+            {
+                if (m_fd < 0)
+                    return false;
+
+                fd_set fds;
+                FD_ZERO(&fds);
+                FD_SET(m_fd, &fds);
+
+                timeval tv = {0};
+                tv.tv_sec = timeoutMs / 1000;
+                tv.tv_usec = (timeoutMs % 1000) * 1000;
+
+                int st = select(m_fd + 1, &fds, nullptr, nullptr, &tv);
+                if (st < 0)
+                {
+                    Log::Error("Failed to wait on socket with code ", GetSocketError());
+                    return false;
+                }
+
+                if (st == 0)
+                    return true;
+
+                size_t count = 0;
+                if (!m_ring.Fill(m_fd, &count))
+                {
+                    Log::Error("Failed to receive with code ", GetSocketError());
+                    return false;
+                }
+
+                // a query cut short can't be answered right
+                for (size_t i = 0; i < count; i++)
+                {
+                    if (!m_ring.Truncated(i))
+                        Handle(m_ring.Peer(i), m_ring.Data(i), m_ring.Size(i));
+                }
+
+                return true;
+            }
+
+            // Answers every question of the query it has a template for, returns the number of answers sent
+            size_t Handle(const sockaddr_storage& peer, const uint8_t* data, size_t size)
+            {
+                // header (12b), a query with the standard opcode
+                if (size < 12 || (data[2] & 0xF8) != 0)
+                    return 0;
+
+                uint16_t qdcount = static_cast<uint16_t>((data[4] << 8) | data[5]);
+
+                auto port = peer.ss_family == AF_INET6 ?
+                    reinterpret_cast<const sockaddr_in6*>(&peer)->sin6_port :
+                    reinterpret_cast<const sockaddr_in*>(&peer)->sin_port;
+
+                bool legacy = ntohs(port) != MdnsPort;
+
+                size_t pos = 12;
+                size_t sent = 0;
+
+                for (uint16_t i = 0; i < qdcount; i++)
+                {
+                    auto length = ReadFqdn(data, size, pos, &m_name);
+                    if (length == 0 || size - pos - length < 4)
+                        break;
+
+                    pos += length;
+
+                    uint16_t qtype = static_cast<uint16_t>((data[pos] << 8) | data[pos + 1]);
+                    uint16_t qclass = static_cast<uint16_t>((data[pos + 2] << 8) | data[pos + 3]);
+                    pos += 4;
+
+                    auto it = m_templates.find(Key(m_name, qtype));
+                    if (it == m_templates.end())
+                        continue;
+
+                    auto& answer = it->second;
+
+                    if (legacy)
+                    {
+                        answer.unicast[0] = data[0];
+                        answer.unicast[1] = data[1];
+                        if (!Send(m_fd, &answer.unicast[0], answer.unicast.size(), peer))
+                            continue;
+                    }
+                    else
+                    {
+                        auto& destination = (qclass & MdnsUnicastResponseBit) != 0 ? peer : m_group;
+                        if (!Send(m_fd, &answer.multicast[0], answer.multicast.size(), destination))
+                            continue;
+                    }
+
+                    sent++;
+                }
+
+                if (sent != 0)
+                    m_answered++;
+
+                return sent;
+            }
+
+        private:
+            struct answer_template
+            {
+                std::vector<uint8_t> multicast;
+                std::vector<uint8_t> unicast;
+            };
+
+            struct record_ref
+            {
+                const service_info* service;
+                uint16_t type;
+            };
+
+            // Lower case name, a zero and the type, built in a reused buffer
+            const std::string& Key(const std::string& name, uint16_t qtype)
+            {
+                m_key.clear();
+                for (auto c: name)
+                    m_key.push_back(static_cast<char>(tolower(static_cast<unsigned char>(c))));
+
+                m_key.push_back(0);
+                m_key.push_back(static_cast<char>(qtype >> 8));
+                m_key.push_back(static_cast<char>(qtype));
+
+                return m_key;
+            }
+
+            // Unsolicited responce with all records of the service, the goodbye has the TTLs patched to 0
+            bool Announce(const service_info& service, bool goodbye)
+            {
+                record_ref ptr = { &service, MdnsTypePtr };
+                record_ref srv = { &service, MdnsTypeSrv };
+                record_ref txt = { &service, MdnsTypeTxt };
+                record_ref a = { &service, MdnsTypeA };
+
+                std::vector<record_ref> answers = { ptr, srv, txt, a };
+                std::vector<uint8_t> message;
+                std::vector<size_t> ttls;
+
+                if (!WriteMessage(service.type, MdnsTypePtr, answers, std::vector<record_ref>(), false, &message, &ttls))
+                    return false;
+
+                if (goodbye)
+                {
+                    for (auto pos: ttls)
+                        memset(&message[pos], 0, sizeof(uint32_t));
+                }
+
+                return Send(m_fd, &message[0], message.size(), m_group);
+            }
+
+            static bool WriteServiceRecord(
+                const record_ref& rr,
+                bool unicast,
+                MessageSection section,
+                message_builder* builder,
+                std::vector<size_t>* ttls)
+            {
+                auto& service = *rr.service;
+                auto fullName = service.instance + "." + service.type;
+                auto& name = rr.type == MdnsTypePtr ? service.type : (rr.type == MdnsTypeA ? service.host : fullName);
+
+                // the shared PTR records never flush, legacy unicast answers never flush (RFC 6762 10.2)
+                uint16_t rclass = MdnsClassIn;
+                if (rr.type != MdnsTypePtr && !unicast)
+                    rclass |= MdnsCacheFlushBit;
+
+                uint32_t ttl = unicast ? std::min(service.ttl, MdnsLegacyUnicastTtl) : service.ttl;
+
+                if (!builder->BeginRecord(name, rr.type, rclass, ttl))
+                    return false;
+
+                ttls->push_back(builder->Size() - 6); // TTL and data length precede the data
+
+                bool written = true;
+
+                switch (rr.type)
+                {
+                    case MdnsTypePtr:
+                        written = builder->WriteName(fullName);
+                        break;
+
+                    case MdnsTypeSrv:
+                        written = builder->Write16(0) && // priority
+                            builder->Write16(0) &&       // weight
+                            builder->Write16(service.port) &&
+                            builder->WriteName(service.host);
+                        break;
+
+                    case MdnsTypeTxt:
+                        for (auto& item: service.txt)
+                        {
+                            uint8_t length = static_cast<uint8_t>(item.size());
+                            written = written && item.size() <= 255 && 
+                                builder->WriteBytes(&length, 1) && 
+                                builder->WriteBytes(reinterpret_cast<const uint8_t*>(item.data()), item.size());
+                        }
+
+                        // an empty TXT record holds a single empty string
+                        if (service.txt.empty())
+                        {
+                            const uint8_t Empty = 0;
+                            written = builder->WriteBytes(&Empty, 1);
+                        }
+                        break;
+
+                    case MdnsTypeA:
+                        written = builder->WriteBytes(reinterpret_cast<const uint8_t*>(&service.address), sizeof(in_addr));
+                        break;
+                }
+
+                if (!written)
+                    return false;
+
+                builder->EndRecord(section);
+                return true;
+            }
+
+            static bool WriteMessage(
+                const std::string& qname,
+                uint16_t qtype,
+                const std::vector<record_ref>& answers,
+                const std::vector<record_ref>& additionals,
+                bool unicast,
+                std::vector<uint8_t>* result,
+                std::vector<size_t>* ttls)
+            {
+                uint8_t buffer[MdnsMaxMessageSize];
+                ttls->clear();
+
+                message_builder builder(buffer, sizeof(buffer));
+                builder.Reset(0, MdnsResponseFlag);
+
+                bool written = !unicast || builder.AddQuestion(qname, qtype);
+
+                for (auto& rr: answers)
+                    written = written && WriteServiceRecord(rr, unicast, MessageSection::Answer, &builder, ttls);
+
+                for (auto& rr: additionals)
+                    written = written && WriteServiceRecord(rr, unicast, MessageSection::Additional, &builder, ttls);
+
+                // a write fails once the message would not fit a datagram
+                if (written)
+                    result->assign(builder.Data(), builder.Data() + builder.Size());
+                else
+                    result->clear();
+
+                return written;
+            }
+
+            bool Add(const std::string& qname, uint16_t qtype, const std::vector<record_ref>& answers, const std::vector<record_ref>& additionals)
+            {
+                auto& answer = m_templates[Key(qname, qtype)];
+                std::vector<size_t> ttls;
+
+                if (!WriteMessage(qname, qtype, answers, additionals, false, &answer.multicast, &ttls) ||
+                    !WriteMessage(qname, qtype, answers, additionals, true, &answer.unicast, &ttls))
+                {
+                    Log::Error("Failed to encode the answer about ", qname);
+                    return false;
+                }
+
+                return true;
+            }
+
+            // Serializes every answer of every registered service
+            bool Rebuild()
+            {
+                m_templates.clear();
+
+                // PTR answers list all instances of the type
+                std::map<std::string, std::vector<record_ref>> types;
+                std::map<std::string, std::vector<record_ref>> extras;
+
+                for (auto& service: m_services)
+                {
+                    auto fullName = service.instance + "." + service.type;
+
+                    record_ref ptr = { &service, MdnsTypePtr };
+                    record_ref srv = { &service, MdnsTypeSrv };
+                    record_ref txt = { &service, MdnsTypeTxt };
+                    record_ref a = { &service, MdnsTypeA };
+
+                    types[Key(service.type, 0)].push_back(ptr);
+                    auto& additionals = extras[Key(service.type, 0)];
+                    additionals.push_back(srv);
+                    additionals.push_back(txt);
+                    additionals.push_back(a);
+
+                    std::vector<record_ref> srvAndTxt = { srv, txt };
+                    std::vector<record_ref> none;
+
+                    if (!Add(fullName, MdnsTypeSrv, std::vector<record_ref>(1, srv), std::vector<record_ref>(1, a)) ||
+                        !Add(fullName, MdnsTypeTxt, std::vector<record_ref>(1, txt), none) ||
+                        !Add(fullName, MdnsTypeAny, srvAndTxt, std::vector<record_ref>(1, a)) ||
+                        !Add(service.host, MdnsTypeA, std::vector<record_ref>(1, a), none) ||
+                        !Add(service.host, MdnsTypeAny, std::vector<record_ref>(1, a), none))
+                    {
+                        return false;
+                    }
+                }
+
+                for (auto& item: types)
+                {
+                    auto& type = item.second[0].service->type;
+                    auto& additionals = extras[item.first];
+
+                    if (!Add(type, MdnsTypePtr, item.second, additionals) ||
+                        !Add(type, MdnsTypeAny, item.second, additionals))
+                    {
+                        return false;
+                    }
+                }
+
+                return true;
+            }
+
+            int m_fd;
+            size_t m_answered;
+            sockaddr_storage m_group;
+            std::vector<service_info> m_services;
+            std::unordered_map<std::string, answer_template> m_templates;
+            receive_ring m_ring;
+            std::string m_name;
+            std::string m_key;
+        };
+    }
+}
+
+#endif // ZEROCONF_RESPONDER_HPP
@@ -0,0 +1,512 @@
+#ifndef ZEROCONF_SIMULATOR_HPP
+#define ZEROCONF_SIMULATOR_HPP
+
+//////////////////////////////////////////////////////////////////////////
+// zeroconf-simulator.hpp
+
+// (C) Copyright 2016 Yuri Yakovlev <yvzmail@gmail.com>
+// Use, modification and distribution is subject to the GNU General Public License
+
+#if defined(__linux__)
+
+#include <atomic>
+#include <random>
+#include <set>
+#include <thread>
+
+#include <arpa/inet.h>
+
+#include "zeroconf-util.hpp"
+#include "zeroconf-detail.hpp"
+
+namespace Zeroconf
+{
+    namespace Detail
+    {
+        struct simulated_record
+        {
+            std::string name;
+            uint16_t type;
+            uint32_t ttl;
+            std::vector<uint8_t> rdata; // uncompressed
+        };
+
+        struct simulated_responder
+        {
+            std::string service; // the question name it answers
+            std::vector<simulated_record> records;
+        };
+
+        struct simulator_options
+        {
+            simulator_options() : minDelay(0), maxDelay(0), loss(0), burst(1), maxMessageSize(0), suppress(true), seed(1) {}
+
+            std::chrono::microseconds minDelay; // every reply is delayed by a random time in the range
+            std::chrono::microseconds maxDelay;
+            double loss;  // probability of a responder ignoring a query
+            size_t burst; // copies of every reply
+            size_t maxMessageSize; // longer replies go in parts, all but the last with the TC bit, 0 to send them whole
+            bool suppress; // stay silent when the query lists the PTR record among its known answers (RFC 6762 7.1)
+            unsigned seed;
+        };
+
+        // PTR, SRV, TXT and A records of one instance of the service, the host is 127.x.y.z
+        inline simulated_responder SimulatedService(const std::string& service, const std::string& instance, const in_addr& host)
+        {
+            simulated_responder result;
+            result.service = service;
+
+            auto fullName = instance + "." + service;
+            auto hostName = instance + ".local";
+
+            simulated_record ptr = { service, MdnsTypePtr, 120 };
+            WriteFqdn(fullName, &ptr.rdata);
+
+            simulated_record srv = { fullName, MdnsTypeSrv, 120 };
+            const uint8_t Srv[] = { 0x00, 0x00, 0x00, 0x00, 0x1F, 0x90 }; // priority, weight, port 8080
+            srv.rdata.assign(std::begin(Srv), std::end(Srv));
+            WriteFqdn(hostName, &srv.rdata);
+
+            simulated_record txt = { fullName, MdnsTypeTxt, 4500 };
+            const char Txt[] = "path=/";
+            txt.rdata.push_back(sizeof(Txt) - 1);
+            txt.rdata.insert(txt.rdata.end(), Txt, Txt + sizeof(Txt) - 1);
+
+            simulated_record a = { hostName, MdnsTypeA, 120 };
+            auto bytes = reinterpret_cast<const uint8_t*>(&host);
+            a.rdata.assign(bytes, bytes + sizeof(in_addr));
+
+            result.records.push_back(ptr);
+            result.records.push_back(srv);
+            result.records.push_back(txt);
+            result.records.push_back(a);
+
+            return result;
+        }
+
+        // Stands in for any number of responders on the loopback. Responder i replies from 127.0.0.2 + i,
+        // so each one counts as a distinct host, through one socket and one thread. The replies are
+        // legacy unicast ones: they echo the ID and the question and go back to the port of the query.
+        // A responder whose PTR record is among the known answers of the query stays silent.
+        // A reply too long for maxMessageSize is split between records, every part with the question.
+        class simulator
+        {
+        public:
+            simulator() : m_fd(-1), m_running(false), m_queries(0), m_sent(0), m_lost(0), m_suppressed(0)
+            {
+            }
+
+            ~simulator()
+            {
+                Stop();
+            }
+
+            simulator(const simulator&) = delete;
+            simulator& operator=(const simulator&) = delete;
+
+            bool Start(const std::vector<simulated_responder>& responders, const simulator_options& options)
+            {
+                Stop();
+
+                if (responders.size() > 0xFFFFFF - 2)
+                {
+                    Log::Error("Too many simulated responders");
+                    return false;
+                }
+
+                m_options = options;
+                m_responders.clear();
+
+                for (auto& item: responders)
+                {
+                    m_responders.emplace_back();
+
+                    auto& responder = m_responders.back();
+                    responder.service = item.service;
+
+                    for (auto& record: item.records)
+                    {
+                        if (record.type == MdnsTypePtr)
+                            ReadFqdn(record.rdata, 0, &responder.instance);
+
+                        WriteFqdn(record.name, &responder.answers);
+
+                        const uint8_t Header[] =
+                        {
+                            static_cast<uint8_t>(record.type >> 8), static_cast<uint8_t>(record.type),
+                            0x00, static_cast<uint8_t>(MdnsClassIn),
+                            static_cast<uint8_t>(record.ttl >> 24), static_cast<uint8_t>(record.ttl >> 16),
+                            static_cast<uint8_t>(record.ttl >> 8), static_cast<uint8_t>(record.ttl),
+                            static_cast<uint8_t>(record.rdata.size() >> 8), static_cast<uint8_t>(record.rdata.size())
+                        };
+
+                        responder.answers.insert(responder.answers.end(), std::begin(Header), std::end(Header));
+                        responder.answers.insert(responder.answers.end(), record.rdata.begin(), record.rdata.end());
+                        responder.ends.push_back(responder.answers.size());
+                    }
+                }
+
+                m_fd = socket(AF_INET, SOCK_DGRAM, 0);
+                if (m_fd < 0)
+                {
+                    Log::Error("Failed to create socket with code ", GetSocketError());
+                    return false;
+                }
+
+                if (!Selectable(m_fd))
+                {
+                    Stop();
+                    return false;
+                }
+
+                // any address, so that replies can go out from every 127.x.y.z
+                sockaddr_in addr = {0};
+                addr.sin_family = AF_INET;
+                addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+                socklen_t len = sizeof(addr);
+                if (bind(m_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 ||
+                    getsockname(m_fd, reinterpret_cast<sockaddr*>(&addr), &len) < 0)
+                {
+                    Log::Error("Failed to bind socket with code ", GetSocketError());
+                    Stop();
+                    return false;
+                }
+
+                memset(&m_address, 0, sizeof(m_address));
+                auto address = reinterpret_cast<sockaddr_in*>(&m_address);
+                address->sin_family = AF_INET;
+                address->sin_port = addr.sin_port;
+                address->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+                m_queries = m_sent = m_lost = m_suppressed = 0;
+                m_known.clear();
+                m_running = true;
+                m_thread = std::thread([this]() { Run(); });
+
+                return true;
+            }
+
+            void Stop()
+            {
+                m_running = false;
+
+                if (m_thread.joinable())
+                    m_thread.join();
+
+                if (m_fd >= 0)
+                    CloseSocket(m_fd);
+
+                m_fd = -1;
+            }
+
+            // Where to send the queries
+            const sockaddr_storage& Address() const { return m_address; }
+
+            size_t Queries() const { return m_queries; }
+            size_t Sent() const { return m_sent; }
+            size_t Lost() const { return m_lost; }
+            size_t Suppressed() const { return m_suppressed; }
+
+            // The number of known answers of every query in the order they were answered, read it once stopped
+            const std::vector<size_t>& KnownAnswers() const { return m_known; }
+
+            static in_addr ResponderAddress(size_t index)
+            {
+                in_addr result;
+                result.s_addr = htonl(static_cast<uint32_t>(INADDR_LOOPBACK + 1 + index));
+                return result;
+            }
+
+        private:
+            typedef std::chrono::steady_clock clock;
+
+            struct responder
+            {
+                std::string service;
+                std::string instance; // target of the PTR record
+                std::vector<uint8_t> answers;
+                std::vector<size_t> ends; // of every record in the answers
+            };
+
+            struct reply
+            {
+                clock::time_point due;
+                size_t responder;
+                size_t query;
+
+                bool operator>(const reply& other) const { return due > other.due; }
+            };
+
+            struct query
+            {
+                sockaddr_in peer;
+                std::vector<uint8_t> header; // header and question of the query
+                std::string name;
+                std::set<std::string> known;
+                bool pending; // more known answers to come (RFC 6762 7.2)
+                clock::time_point due;
+            };
+
+            // Schedules the replies of every responder that neither drops the query nor finds itself in the known answers
+            void Answer(size_t index, const std::vector<query>& queries, std::mt19937* random, std::priority_queue<reply, std::vector<reply>, std::greater<reply>>* schedule)
+            {
+                std::uniform_real_distribution<double> loss(0, 1);
+                std::uniform_int_distribution<long long> delay(m_options.minDelay.count(), std::max(m_options.minDelay, m_options.maxDelay).count());
+
+                auto& q = queries[index];
+                auto now = clock::now();
+
+                m_known.push_back(q.known.size());
+
+                for (size_t i = 0; i < m_responders.size(); i++)
+                {
+                    if (!NameEquals(q.name, m_responders[i].service))
+                        continue;
+
+                    if (m_options.suppress && q.known.count(m_responders[i].instance) != 0)
+                    {
+                        m_suppressed++;
+                        continue;
+                    }
+
+                    if (m_options.loss > 0 && loss(*random) < m_options.loss)
+                    {
+                        m_lost++;
+                        continue;
+                    }
+
+                    reply r = { now + std::chrono::microseconds(delay(*random)), i, index };
+                    schedule->push(r);
+                }
+            }
+
+            void Run()
+            {
+                // how long a truncated query waits for the rest of its known answers
+                const std::chrono::milliseconds KnownAnswerWait(100);
+
+                std::mt19937 random(m_options.seed);
+
+                std::priority_queue<reply, std::vector<reply>, std::greater<reply>> schedule;
+                std::vector<query> queries;
+                std::vector<uint8_t> buffer(MdnsMaxMessageSize);
+                std::vector<std::vector<uint8_t>> packets;
+
+                while (m_running)
+                {
+                    auto now = clock::now();
+                    auto wait = std::chrono::microseconds(10000);
+                    if (!schedule.empty())
+                        wait = std::min(wait, std::max(std::chrono::microseconds(0), std::chrono::duration_cast<std::chrono::microseconds>(schedule.top().due - now)));
+
+                    fd_set fds;
+                    FD_ZERO(&fds);
+                    FD_SET(m_fd, &fds);
+
+                    timeval tv = { 0, static_cast<long>(wait.count()) };
+                    int st = select(m_fd + 1, &fds, nullptr, nullptr, &tv);
+
+                    if (st > 0)
+                    {
+                        query item;
+                        socklen_t len = sizeof(item.peer);
+                        auto cb = recvfrom(m_fd, &buffer[0], buffer.size(), 0, reinterpret_cast<sockaddr*>(&item.peer), &len);
+
+                        size_t questions = cb > 12 ? (buffer[4] << 8) | buffer[5] : 0;
+                        bool truncated = cb > 12 && (buffer[2] & (MdnsTruncatedFlag >> 8)) != 0;
+
+                        if (cb > 12 && questions == 0)
+                        {
+                            // the known answers continue the last truncated query of the peer
+                            for (size_t i = queries.size(); i-- > 0;)
+                            {
+                                auto& q = queries[i];
+                                if (q.peer.sin_port != item.peer.sin_port || q.peer.sin_addr.s_addr != item.peer.sin_addr.s_addr)
+                                    continue;
+
+                                if (q.pending)
+                                {
+                                    KnownAnswers(&buffer[0], cb, 12, &q.known);
+                                    q.pending = truncated;
+
+                                    if (!q.pending)
+                                        Answer(i, queries, &random, &schedule);
+                                }
+
+                                break;
+                            }
+                        }
+
+                        // header and the first question
+                        size_t nameLength = questions > 0 ? ReadFqdn(&buffer[0], cb, 12, &item.name) : 0;
+                        if (nameLength != 0 && 12 + nameLength + 4 <= static_cast<size_t>(cb))
+                        {
+                            m_queries++;
+
+                            item.header.assign(buffer.begin(), buffer.begin() + 12 + nameLength + 4);
+                            KnownAnswers(&buffer[0], cb, 12 + nameLength + 4, &item.known);
+                            item.pending = truncated;
+                            item.due = clock::now() + KnownAnswerWait;
+
+                            queries.push_back(std::move(item));
+
+                            if (!truncated)
+                                Answer(queries.size() - 1, queries, &random, &schedule);
+                        }
+                    }
+
+                    // the rest of the known answers got lost
+                    bool pending = false;
+                    now = clock::now();
+                    for (size_t i = 0; i < queries.size(); i++)
+                    {
+                        if (queries[i].pending && queries[i].due <= now)
+                        {
+                            queries[i].pending = false;
+                            Answer(i, queries, &random, &schedule);
+                        }
+
+                        pending = pending || queries[i].pending;
+                    }
+
+                    now = clock::now();
+                    while (!schedule.empty() && schedule.top().due <= now)
+                    {
+                        auto r = schedule.top();
+                        schedule.pop();
+
+                        auto& q = queries[r.query];
+                        Reply(q, m_responders[r.responder], &packets);
+
+                        for (size_t i = 0; i < m_options.burst; i++)
+                        {
+                            for (auto& packet: packets)
+                            {
+                                if (SendFrom(ResponderAddress(r.responder), q.peer, packet))
+                                    m_sent++;
+                            }
+                        }
+                    }
+
+                    if (schedule.empty() && !pending)
+                        queries.clear();
+                }
+            }
+
+            // The packets of a reply, one unless it has to be split
+            void Reply(const query& q, const responder& responder, std::vector<std::vector<uint8_t>>* result) const
+            {
+                result->clear();
+
+                size_t begin = 0;
+                while (result->empty() || begin < responder.answers.size())
+                {
+                    // at least one record per packet, however long
+                    size_t end = begin;
+                    uint16_t count = 0;
+                    for (auto next: responder.ends)
+                    {
+                        if (next <= begin)
+                            continue;
+
+                        if (count > 0 && m_options.maxMessageSize > 0 && q.header.size() + next - begin > m_options.maxMessageSize)
+                            break;
+
+                        end = next;
+                        count++;
+                    }
+
+                    bool last = end == responder.answers.size();
+                    uint16_t flags = last ? MdnsResponseFlag : MdnsResponseFlag | MdnsTruncatedFlag;
+
+                    result->push_back(q.header);
+
+                    auto& packet = result->back();
+                    packet[2] = static_cast<uint8_t>(flags >> 8);
+                    packet[3] = static_cast<uint8_t>(flags);
+                    packet[4] = 0;
+                    packet[5] = 1;
+                    packet[6] = static_cast<uint8_t>(count >> 8);
+                    packet[7] = static_cast<uint8_t>(count);
+                    memset(&packet[8], 0, 4);
+                    packet.insert(packet.end(), responder.answers.begin() + begin, responder.answers.begin() + end);
+
+                    begin = end;
+                }
+            }
+
+            // Adds the PTR targets in the answer section of a query, only the case the responders have to match
+            static void KnownAnswers(const uint8_t* data, size_t size, size_t offset, std::set<std::string>* result)
+            {
+                size_t count = (data[6] << 8) | data[7];
+                std::string target;
+
+                for (size_t i = 0; i < count; i++)
+                {
+                    std::string owner;
+                    auto nameLength = ReadFqdn(data, size, offset, &owner);
+                    if (nameLength == 0 || offset + nameLength + 10 > size)
+                        return;
+
+                    auto rr = data + offset + nameLength;
+                    uint16_t type = (rr[0] << 8) | rr[1];
+                    size_t length = (rr[8] << 8) | rr[9];
+
+                    offset += nameLength + 10;
+                    if (offset + length > size)
+                        return;
+
+                    if (type == MdnsTypePtr && ReadFqdn(data, size, offset, &target) != 0)
+                        result->insert(target);
+
+                    offset += length;
+                }
+            }
+
+            bool SendFrom(const in_addr& source, const sockaddr_in& destination, const std::vector<uint8_t>& data)
+            {
+                iovec iov;
+                iov.iov_base = const_cast<uint8_t*>(&data[0]);
+                iov.iov_len = data.size();
+
+                char control[CMSG_SPACE(sizeof(in_pktinfo))] = {0};
+
+                msghdr msg = {0};
+                msg.msg_name = const_cast<sockaddr_in*>(&destination);
+                msg.msg_namelen = sizeof(destination);
+                msg.msg_iov = &iov;
+                msg.msg_iovlen = 1;
+                msg.msg_control = control;
+                msg.msg_controllen = sizeof(control);
+
+                auto cmsg = CMSG_FIRSTHDR(&msg);
+                cmsg->cmsg_level = IPPROTO_IP;
+                cmsg->cmsg_type = IP_PKTINFO;
+                cmsg->cmsg_len = CMSG_LEN(sizeof(in_pktinfo));
+
+                in_pktinfo info = {0};
+                info.ipi_spec_dst = source;
+                memcpy(CMSG_DATA(cmsg), &info, sizeof(info));
+
+                return sendmsg(m_fd, &msg, 0) >= 0;
+            }
+
+            int m_fd;
+            sockaddr_storage m_address;
+            simulator_options m_options;
+            std::vector<responder> m_responders;
+            std::thread m_thread;
+            std::atomic<bool> m_running;
+            std::atomic<size_t> m_queries;
+            std::atomic<size_t> m_sent;
+            std::atomic<size_t> m_lost;
+            std::atomic<size_t> m_suppressed;
+            std::vector<size_t> m_known; // only touched by the simulator thread while it runs
+        };
+    }
+}
+
+#endif // __linux__
+
+#endif // ZEROCONF_SIMULATOR_HPP
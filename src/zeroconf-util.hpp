@@ -7,13 +7,12 @@
 // (C) Copyright 2016 Yuri Yakovlev <yvzmail@gmail.com>
 // Use, modification and distribution is subject to the GNU General Public License
 
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <string>
-#include <istream>
-#include <streambuf>
-
-#if _MSC_VER == 1700
-#define thread_local __declspec(thread)
-#endif
+#include <atomic>
+#include <mutex>
 
 namespace Zeroconf
 {
@@ -21,49 +20,266 @@ namespace Zeroconf
     {
         namespace stdext
         {
-            class membuf : public std::streambuf
+            // Non-owning reference to a range of characters, until std::string_view is available
+            class string_view
             {
-            public: 
-                membuf(const unsigned char* base, int size) 
+            public:
+                string_view() : m_data(nullptr), m_size(0) {}
+                string_view(const char* data, size_t size) : m_data(data), m_size(size) {}
+                string_view(const std::string& s) : m_data(s.data()), m_size(s.size()) {}
+
+                const char* data() const { return m_data; }
+                size_t size() const { return m_size; }
+                bool empty() const { return m_size == 0; }
+
+                const char* begin() const { return m_data; }
+                const char* end() const { return m_data + m_size; }
+                char operator[](size_t pos) const { return m_data[pos]; }
+
+                std::string to_string() const { return std::string(m_data, m_size); }
+
+                friend bool operator==(const string_view& a, const string_view& b)
                 {
-                    auto p = reinterpret_cast<char*>(const_cast<unsigned char*>(base));
-                    setg(p, p, p + size);
+                    return a.m_size == b.m_size && (a.m_size == 0 || memcmp(a.m_data, b.m_data, a.m_size) == 0);
                 }
 
-            protected:
-                virtual pos_type seekoff(off_type offset, std::ios_base::seekdir, std::ios_base::openmode mode) override
+                friend bool operator!=(const string_view& a, const string_view& b)
                 {
-                    if (offset == 0 && mode == std::ios_base::in)
-                        return pos_type(gptr() - eback());
+                    return !(a == b);
+                }
+
+            private:
+                const char* m_data;
+                size_t m_size;
+            };
+
+            // Non-owning reference to a contiguous run of items, until std::span is available
+            template<typename T>
+            class array_view
+            {
+            public:
+                array_view() : m_data(nullptr), m_size(0) {}
+                array_view(const T* data, size_t size) : m_data(data), m_size(size) {}
+
+                const T* data() const { return m_data; }
+                size_t size() const { return m_size; }
+                bool empty() const { return m_size == 0; }
+
+                const T* begin() const { return m_data; }
+                const T* end() const { return m_data + m_size; }
+                const T& operator[](size_t pos) const { return m_data[pos]; }
+
+            private:
+                const T* m_data;
+                size_t m_size;
+            };
 
-                    return pos_type(-1);
+            // Bounds-checked big-endian reader over a borrowed byte range.
+            // Reads past the end fail and leave the position unchanged.
+            class byte_reader
+            {
+            public:
+                byte_reader(const uint8_t* base, size_t size)
+                    : m_base(base), m_size(size), m_pos(0)
+                {
                 }
+
+                const uint8_t* data() const { return m_base; }
+                size_t size() const { return m_size; }
+                size_t tell() const { return m_pos; }
+                size_t remaining() const { return m_size - m_pos; }
+                bool eof() const { return m_pos >= m_size; }
+
+                bool seek(size_t pos)
+                {
+                    if (pos > m_size)
+                        return false;
+
+                    m_pos = pos;
+                    return true;
+                }
+
+                bool skip(size_t count)
+                {
+                    if (count > remaining())
+                        return false;
+
+                    m_pos += count;
+                    return true;
+                }
+
+                bool read(uint8_t* result)
+                {
+                    if (remaining() < 1)
+                        return false;
+
+                    *result = m_base[m_pos++];
+                    return true;
+                }
+
+                bool read(uint16_t* result)
+                {
+                    if (remaining() < 2)
+                        return false;
+
+                    *result = static_cast<uint16_t>((m_base[m_pos] << 8) | m_base[m_pos + 1]);
+                    m_pos += 2;
+                    return true;
+                }
+
+                bool read(uint32_t* result)
+                {
+                    if (remaining() < 4)
+                        return false;
+
+                    *result = 
+                        (static_cast<uint32_t>(m_base[m_pos]) << 24) | 
+                        (static_cast<uint32_t>(m_base[m_pos + 1]) << 16) |
+                        (static_cast<uint32_t>(m_base[m_pos + 2]) << 8) | 
+                        static_cast<uint32_t>(m_base[m_pos + 3]);
+                    m_pos += 4;
+                    return true;
+                }
+
+            private:
+                const uint8_t* m_base;
+                size_t m_size;
+                size_t m_pos;
             };
         }
 
+        // Process-wide logging. Messages below the threshold, or with no sink set, cost a single
+        // atomic load: the arguments are only concatenated for a message that goes out.
+        // Defining ZEROCONF_DISABLE_LOG compiles every message away.
         namespace Log
         {
             enum class LogLevel { Error, Warning };
 
             typedef void(*LogCallback)(LogLevel, const std::string&);
+            typedef void(*LogSink)(void* context, LogLevel, const std::string&);
 
-            static thread_local LogCallback g_logcb = nullptr;
+            struct log_state
+            {
+                log_state() : threshold(-1), level(LogLevel::Warning), callback(nullptr), sink(nullptr), context(nullptr) {}
+
+                std::atomic<int> threshold; // the most verbose level to emit, -1 without a sink
+                std::mutex mutex;
+                LogLevel level;
+                LogCallback callback;
+                LogSink sink;
+                void* context;
+            };
+
+            inline log_state& State()
+            {
+                static log_state state;
+                return state;
+            }
+
+            inline bool Enabled(LogLevel level)
+            {
+#if defined(ZEROCONF_DISABLE_LOG)
+                (void)level;
+                return false;
+#else
+                return static_cast<int>(level) <= State().threshold.load(std::memory_order_relaxed);
+#endif
+            }
 
-            inline void Error(const std::string& message) 
+            inline void Update(log_state& state)
             {
-                if (g_logcb != nullptr)
-                    g_logcb(LogLevel::Error, message);
+                bool set = state.callback != nullptr || state.sink != nullptr;
+                state.threshold.store(set ? static_cast<int>(state.level) : -1, std::memory_order_relaxed);
             }
 
-            inline void Warning(const std::string& message) 
+            // Replaces the sink, the context goes with every message. Messages go out under a lock,
+            // so once this returns the old sink is no longer called and its context may go. For the
+            // same reason a sink must not log nor change the sink itself.
+            inline void SetLogSink(LogSink sink, void* context)
             {
-                if (g_logcb != nullptr)
-                    g_logcb(LogLevel::Warning, message);
+                auto& state = State();
+                std::lock_guard<std::mutex> lock(state.mutex);
+                state.callback = nullptr;
+                state.sink = sink;
+                state.context = context;
+                Update(state);
             }
 
             inline void SetLogCallback(LogCallback logcb)
             {
-                g_logcb = logcb;
+                auto& state = State();
+                std::lock_guard<std::mutex> lock(state.mutex);
+                state.callback = logcb;
+                state.sink = nullptr;
+                state.context = nullptr;
+                Update(state);
+            }
+
+            // The most verbose level to emit, Warning by default
+            inline void SetLogLevel(LogLevel level)
+            {
+                auto& state = State();
+                std::lock_guard<std::mutex> lock(state.mutex);
+                state.level = level;
+                Update(state);
+            }
+
+            inline void Append(std::string* result, const std::string& value) { result->append(value); }
+            inline void Append(std::string* result, const char* value) { result->append(value); }
+            inline void Append(std::string* result, char value) { result->push_back(value); }
+
+            template<typename T>
+            inline void Append(std::string* result, const T& value)
+            {
+                result->append(std::to_string(value));
+            }
+
+            inline void Format(std::string*)
+            {
+            }
+
+            template<typename T, typename... Args>
+            inline void Format(std::string* result, const T& value, const Args&... args)
+            {
+                Append(result, value);
+                Format(result, args...);
+            }
+
+            inline void Emit(LogLevel level, const std::string& message)
+            {
+                auto& state = State();
+
+                // held while the sink runs, see SetLogSink
+                std::lock_guard<std::mutex> lock(state.mutex);
+
+                if (state.callback != nullptr)
+                    state.callback(level, message);
+                else if (state.sink != nullptr)
+                    state.sink(state.context, level, message);
+            }
+
+            template<typename... Args>
+            inline void Write(LogLevel level, const Args&... args)
+            {
+                if (!Enabled(level))
+                    return;
+
+                std::string message;
+                Format(&message, args...);
+                Emit(level, message);
+            }
+
+            // The arguments are concatenated, numbers as by std::to_string
+            template<typename... Args>
+            inline void Error(const Args&... args)
+            {
+                Write(LogLevel::Error, args...);
+            }
+
+            template<typename... Args>
+            inline void Warning(const Args&... args)
+            {
+                Write(LogLevel::Warning, args...);
             }
         }
     }
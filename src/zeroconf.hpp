@@ -13,22 +13,184 @@
 
 #include "zeroconf-util.hpp"
 #include "zeroconf-detail.hpp"
+#include "zeroconf-arena.hpp"
+#include "zeroconf-client.hpp"
+#include "zeroconf-engine.hpp"
 
 namespace Zeroconf
 {    
     typedef Detail::Log::LogLevel LogLevel;
     typedef Detail::Log::LogCallback LogCallback;
+    typedef Detail::Log::LogSink LogSink;
     typedef Detail::mdns_responce mdns_responce;
+    typedef Detail::mdns_record mdns_record;
+    typedef Detail::mdns_question mdns_question;
+    typedef Detail::record_cache record_cache;
+    typedef Detail::resolve_options resolve_options;
+    typedef Detail::CachePolicy CachePolicy;
+    typedef Detail::completion_policy completion_policy;
+    typedef Detail::mdns_interface mdns_interface;
+    typedef Detail::mdns_srv mdns_srv;
+    typedef Detail::mdns_txt mdns_txt;
+    typedef Detail::txt_reader txt_reader;
+    typedef Detail::ResponceCallback ResponceCallback;
+    typedef Detail::scan_result scan_result;
+    typedef Detail::mdns_responce_view mdns_responce_view;
+    typedef Detail::mdns_record_view mdns_record_view;
+    typedef Detail::metrics_snapshot metrics_snapshot;
+    typedef Detail::histogram_snapshot histogram_snapshot;
+    typedef Detail::ParseFailure ParseFailure;
+    typedef Detail::client client;
+
+#if defined(__linux__)
+    typedef Detail::engine engine;
+#endif
+
+    // Calls back per responce as it arrives, the callback returns false to stop the scan early
+    inline bool Resolve(const std::string& serviceName, time_t scanTime, const resolve_options& options, const ResponceCallback& callback)
+    {
+        return Detail::Resolve(serviceName, scanTime, options, callback);
+    }
+
+    inline bool Resolve(const std::string& serviceName, time_t scanTime, const ResponceCallback& callback)
+    {
+        return Detail::Resolve(serviceName, scanTime, resolve_options(), callback);
+    }
+
+    inline bool Resolve(const std::string& serviceName, time_t scanTime, const resolve_options& options, std::vector<mdns_responce>* result)
+    {
+        return Detail::Resolve(serviceName, scanTime, options, result);
+    }
 
     inline bool Resolve(const std::string& serviceName, time_t scanTime, std::vector<mdns_responce>* result)
     {
-        return Detail::Resolve(serviceName, scanTime, result);
+        return Detail::Resolve(serviceName, scanTime, resolve_options(), result);
+    }
+
+    // Keeps the responces in a few large blocks, see scan_result
+    inline bool Resolve(const std::string& serviceName, time_t scanTime, const resolve_options& options, scan_result* result)
+    {
+        return Detail::Resolve(serviceName, scanTime, options, result);
+    }
+
+    inline bool Resolve(const std::string& serviceName, time_t scanTime, scan_result* result)
+    {
+        return Detail::Resolve(serviceName, scanTime, resolve_options(), result);
+    }
+
+    // Encodes the PTR (or other) query for a name known at compile time, see Resolve below
+    template<size_t N>
+    constexpr std::array<uint8_t, N + 17> EncodeQuery(const char (&name)[N], uint16_t qtype = Detail::MdnsTypePtr)
+    {
+        return Detail::EncodeQuery(name, qtype);
+    }
+
+    // Sends a query from EncodeQuery as it is, without encoding anything at run time
+    template<size_t N>
+    inline bool Resolve(const std::array<uint8_t, N>& query, time_t scanTime, const resolve_options& options, const ResponceCallback& callback)
+    {
+        return Detail::Resolve(query, scanTime, options, callback);
+    }
+
+    template<size_t N>
+    inline bool Resolve(const std::array<uint8_t, N>& query, time_t scanTime, std::vector<mdns_responce>* result)
+    {
+        return Detail::Resolve(query, scanTime, resolve_options(), result);
+    }
+
+    template<size_t N>
+    inline bool Resolve(const std::array<uint8_t, N>& query, time_t scanTime, const resolve_options& options, scan_result* result)
+    {
+        return Detail::Resolve(query, scanTime, options, result);
+    }
+
+    inline bool Resolve(const std::vector<mdns_question>& questions, time_t scanTime, std::vector<std::vector<mdns_responce>>* result)
+    {
+        return Detail::Resolve(questions, scanTime, result);
+    }
+
+    inline bool ListInterfaces(std::vector<mdns_interface>* result)
+    {
+        return Detail::ListInterfaces(result);
+    }
+
+    inline bool ReadA(const mdns_responce& responce, const mdns_record& rr, in_addr* result)
+    {
+        return Detail::ReadA(responce, rr, result);
+    }
+
+    inline bool ReadAaaa(const mdns_responce& responce, const mdns_record& rr, in6_addr* result)
+    {
+        return Detail::ReadAaaa(responce, rr, result);
+    }
+
+    inline bool ReadPtr(const mdns_responce& responce, const mdns_record& rr, std::string* result)
+    {
+        return Detail::ReadPtr(responce, rr, result);
+    }
+
+    inline bool ReadSrv(const mdns_responce& responce, const mdns_record& rr, mdns_srv* result)
+    {
+        return Detail::ReadSrv(responce, rr, result);
+    }
+
+    inline txt_reader ReadTxt(const mdns_responce& responce, const mdns_record& rr)
+    {
+        return Detail::ReadTxt(responce, rr);
+    }
+
+    inline bool ReadA(const mdns_responce_view& responce, const mdns_record_view& rr, in_addr* result)
+    {
+        return Detail::ReadA(responce, rr, result);
+    }
+
+    inline bool ReadAaaa(const mdns_responce_view& responce, const mdns_record_view& rr, in6_addr* result)
+    {
+        return Detail::ReadAaaa(responce, rr, result);
+    }
+
+    inline bool ReadPtr(const mdns_responce_view& responce, const mdns_record_view& rr, std::string* result)
+    {
+        return Detail::ReadPtr(responce, rr, result);
+    }
+
+    inline bool ReadSrv(const mdns_responce_view& responce, const mdns_record_view& rr, mdns_srv* result)
+    {
+        return Detail::ReadSrv(responce, rr, result);
+    }
+
+    inline txt_reader ReadTxt(const mdns_responce_view& responce, const mdns_record_view& rr)
+    {
+        return Detail::ReadTxt(responce, rr);
+    }
+
+    // Counters and latencies of everything resolved so far in the process
+    inline metrics_snapshot GetMetrics()
+    {
+        return Detail::Metrics().Snapshot();
     }
 
+    inline void ResetMetrics()
+    {
+        Detail::Metrics().Reset();
+    }
+
+    // The sinks are process-wide and called from whichever thread logs, one message at a time.
+    // A sink must not log itself, once it is replaced it is no longer called.
     inline void SetLogCallback(LogCallback callback)
     {
         Detail::Log::SetLogCallback(callback);
     }
+
+    inline void SetLogSink(LogSink sink, void* context)
+    {
+        Detail::Log::SetLogSink(sink, context);
+    }
+
+    inline void SetLogLevel(LogLevel level)
+    {
+        Detail::Log::SetLogLevel(level);
+    }
 }
 
 #endif // ZEROCONF_HPP
\ No newline at end of file
@@ -0,0 +1,196 @@
+#include <gmock/gmock.h>
+
+#include "zeroconf-arena.hpp"
+#include "zeroconf-simulator.hpp"
+
+namespace
+{
+    const uint8_t RealPacket[] =
+    {
+        0x00, 0x00, 0x84, 0x00, 0x00, 0x01, 0x00, 0x05, 0x00, 0x00, 0x00, 0x00, 0x05, 0x5F, 0x68, 0x74,
+        0x74, 0x70, 0x04, 0x5F, 0x74, 0x63, 0x70, 0x05, 0x6C, 0x6F, 0x63, 0x61, 0x6C, 0x00, 0x00, 0x0C,
+        0x00, 0x01, 0xC0, 0x0C, 0x00, 0x0C, 0x00, 0x01, 0x00, 0x00, 0x00, 0x0A, 0x00, 0x10, 0x0D, 0x61,
+        0x70, 0x70, 0x6C, 0x65, 0x20, 0x6D, 0x61, 0x63, 0x62, 0x6F, 0x6F, 0x6B, 0xC0, 0x0C, 0xC0, 0x2E,
+        0x00, 0x10, 0x00, 0x01, 0x00, 0x00, 0x00, 0x0A, 0x00, 0x46, 0x45, 0x4C, 0x6F, 0x72, 0x65, 0x6D,
+        0x20, 0x69, 0x70, 0x73, 0x75, 0x6D, 0x20, 0x64, 0x6F, 0x6C, 0x6F, 0x72, 0x20, 0x73, 0x69, 0x74,
+        0x20, 0x61, 0x6D, 0x65, 0x74, 0x20, 0x63, 0x6F, 0x6E, 0x73, 0x65, 0x63, 0x74, 0x65, 0x74, 0x75,
+        0x72, 0x20, 0x61, 0x64, 0x69, 0x70, 0x69, 0x73, 0x63, 0x69, 0x6E, 0x67, 0x20, 0x65, 0x6C, 0x69,
+        0x74, 0x20, 0x73, 0x65, 0x64, 0x20, 0x64, 0x6F, 0x20, 0x65, 0x69, 0x75, 0x73, 0x6D, 0x6F, 0x64,
+        0xC0, 0x2E, 0x00, 0x21, 0x00, 0x01, 0x00, 0x00, 0x00, 0x0A, 0x00, 0x0E, 0x00, 0x00, 0x00, 0x00,
+        0x22, 0xB3, 0x05, 0x61, 0x70, 0x70, 0x6C, 0x65, 0xC0, 0x17, 0xC0, 0xA2, 0x00, 0x1C, 0x00, 0x01,
+        0x00, 0x00, 0x00, 0x0A, 0x00, 0x10, 0xFD, 0xAD, 0xC9, 0xE2, 0x23, 0x28, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0xC0, 0xA2, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x00, 0x0A,
+        0x00, 0x04, 0xC0, 0xA8, 0x00, 0x01
+    };
+
+    Zeroconf::Detail::mdns_responce ParseRealPacket()
+    {
+        sockaddr_storage peer = {0};
+        peer.ss_family = AF_INET;
+
+        Zeroconf::Detail::mdns_responce result;
+        EXPECT_TRUE(Zeroconf::Detail::Parse(peer, RealPacket, sizeof(RealPacket), &result));
+        return result;
+    }
+}
+
+TEST(Test_Arena, Blocks)
+{
+    Zeroconf::Detail::scan_arena arena(1024);
+    EXPECT_EQ(0, arena.Blocks());
+
+    auto first = arena.Allocate(3, 1);
+    auto second = arena.Allocate<uint64_t>(4);
+    EXPECT_EQ(0, reinterpret_cast<uintptr_t>(second) % alignof(uint64_t));
+    EXPECT_LE(static_cast<uint8_t*>(first) + 3, reinterpret_cast<uint8_t*>(second));
+    EXPECT_EQ(1, arena.Blocks());
+
+    // a big one that does not fit stands apart and leaves the block in use
+    arena.Allocate(1000, 1);
+    EXPECT_EQ(2, arena.Blocks());
+    arena.Allocate(600, 1);
+    arena.Allocate(200, 1);
+    EXPECT_EQ(2, arena.Blocks());
+
+    // the rest of the block is too small
+    arena.Allocate(200, 1);
+    EXPECT_EQ(3, arena.Blocks());
+    EXPECT_EQ(3 + 32 + 1000 + 600 + 200 + 200, arena.Used());
+
+    Zeroconf::Detail::scan_arena other(std::move(arena));
+    EXPECT_EQ(3, other.Blocks());
+    EXPECT_EQ(0, arena.Blocks());
+
+    other.Clear();
+    EXPECT_EQ(0, other.Blocks());
+    EXPECT_EQ(0, other.Used());
+}
+
+TEST(Test_Arena, ScanResultKeepsResponces)
+{
+    auto responce = ParseRealPacket();
+
+    Zeroconf::Detail::scan_result result;
+    EXPECT_EQ(0, result.Add(responce));
+    EXPECT_EQ(1, result.Add(responce));
+    result.Repeated(1);
+
+    // the views outlive the source and the move
+    responce = Zeroconf::Detail::mdns_responce();
+    auto moved = std::move(result);
+    EXPECT_TRUE(result.Empty());
+
+    ASSERT_EQ(2, moved.Size());
+    EXPECT_EQ(1, moved.Arena().Blocks());
+    EXPECT_EQ(2, moved[1].count);
+
+    auto& view = moved[0];
+    EXPECT_EQ("_http._tcp.local", view.qname.to_string());
+    EXPECT_EQ(sizeof(RealPacket), view.data.size());
+    EXPECT_EQ(0, memcmp(RealPacket, view.data.data(), sizeof(RealPacket)));
+    ASSERT_EQ(5, view.records.size());
+    EXPECT_EQ("apple macbook._http._tcp.local", view.records[2].name.to_string());
+
+    std::string target;
+    ASSERT_TRUE(Zeroconf::Detail::ReadPtr(view, view.records[0], &target));
+    EXPECT_EQ("apple macbook._http._tcp.local", target);
+
+    Zeroconf::Detail::mdns_srv srv;
+    ASSERT_TRUE(Zeroconf::Detail::ReadSrv(view, view.records[2], &srv));
+    EXPECT_EQ(8883, srv.port);
+    EXPECT_EQ("apple.local", srv.target);
+
+    in_addr addr;
+    ASSERT_TRUE(Zeroconf::Detail::ReadA(view, view.records[4], &addr));
+    EXPECT_EQ(htonl(0xC0A80001), addr.s_addr);
+
+    Zeroconf::Detail::mdns_txt txt;
+    EXPECT_TRUE(Zeroconf::Detail::ReadTxt(view, view.records[1]).Next(&txt));
+
+    Zeroconf::Detail::mdns_responce copy;
+    Zeroconf::Detail::Copy(view, &copy);
+    ASSERT_EQ(5, copy.records.size());
+    EXPECT_EQ("apple.local", copy.records[3].name);
+    ASSERT_TRUE(Zeroconf::Detail::ReadSrv(copy, copy.records[2], &srv));
+    EXPECT_EQ("apple.local", srv.target);
+}
+
+TEST(Test_Arena, ParseReusesRecords)
+{
+    auto responce = ParseRealPacket();
+    auto name = responce.records[2].name.data();
+
+    sockaddr_storage peer = {0};
+    ASSERT_TRUE(Zeroconf::Detail::Parse(peer, RealPacket, sizeof(RealPacket), &responce));
+    ASSERT_EQ(5, responce.records.size());
+    EXPECT_EQ(name, responce.records[2].name.data());
+
+    // a broken packet keeps none of the old records
+    ASSERT_FALSE(Zeroconf::Detail::Parse(peer, RealPacket, 0x40, &responce));
+    EXPECT_EQ(1, responce.records.size());
+}
+
+#if defined(__linux__)
+TEST(Test_Arena, Resolve)
+{
+    std::vector<Zeroconf::Detail::simulated_responder> responders;
+    for (size_t i = 0; i < 50; i++)
+        responders.push_back(Zeroconf::Detail::SimulatedService("_sim._tcp.local", "node-" + std::to_string(i), Zeroconf::Detail::simulator::ResponderAddress(i)));
+
+    Zeroconf::Detail::simulator_options simOptions;
+    simOptions.burst = 2;
+
+    Zeroconf::Detail::simulator sim;
+    ASSERT_TRUE(sim.Start(responders, simOptions));
+
+    Zeroconf::Detail::resolve_options options;
+    options.cachePolicy = Zeroconf::Detail::CachePolicy::Bypass;
+    options.destination = sim.Address();
+    options.completion.quietPeriod = std::chrono::milliseconds(100);
+
+    Zeroconf::Detail::scan_result result;
+    ASSERT_TRUE(Zeroconf::Detail::Resolve("_sim._tcp.local", 1, options, &result));
+    ASSERT_EQ(50, result.Size());
+
+    // 50 packets of some 200 bytes with their names and records
+    EXPECT_LE(result.Arena().Blocks(), 2);
+
+    for (auto& responce: result)
+    {
+        EXPECT_EQ(2, responce.count);
+        ASSERT_EQ(4, responce.records.size());
+
+        in_addr addr;
+        ASSERT_TRUE(Zeroconf::Detail::ReadA(responce, responce.records[3], &addr));
+        EXPECT_EQ(0, memcmp(&addr, &reinterpret_cast<const sockaddr_in*>(&responce.peer)->sin_addr, sizeof(addr)));
+    }
+}
+
+TEST(Test_Arena, ResolveLeavesCacheAlone)
+{
+    std::vector<Zeroconf::Detail::simulated_responder> responders;
+    for (size_t i = 0; i < 3; i++)
+        responders.push_back(Zeroconf::Detail::SimulatedService("_sim._tcp.local", "node-" + std::to_string(i), Zeroconf::Detail::simulator::ResponderAddress(i)));
+
+    Zeroconf::Detail::simulator sim;
+    ASSERT_TRUE(sim.Start(responders, Zeroconf::Detail::simulator_options()));
+
+    Zeroconf::Detail::record_cache cache;
+
+    Zeroconf::Detail::resolve_options options;
+    options.cache = &cache;
+    options.destination = sim.Address();
+    options.completion.peers = 3;
+
+    Zeroconf::Detail::scan_result result;
+    ASSERT_TRUE(Zeroconf::Detail::Resolve("_sim._tcp.local", 1, options, &result));
+    ASSERT_EQ(3, result.Size());
+    EXPECT_EQ(0, cache.Size());
+
+    // unless asked to
+    options.cachePolicy = Zeroconf::Detail::CachePolicy::Refresh;
+    ASSERT_TRUE(Zeroconf::Detail::Resolve("_sim._tcp.local", 1, options, &result));
+    ASSERT_EQ(3, result.Size());
+    EXPECT_EQ(3 * 4, cache.Size());
+}
+#endif
@@ -0,0 +1,195 @@
+#include <gmock/gmock.h>
+
+#include "zeroconf-client.hpp"
+#include "zeroconf-simulator.hpp"
+
+namespace
+{
+    const char* Service = "_sim._tcp.local";
+    const char* OtherService = "_other._tcp.local";
+
+    std::vector<Zeroconf::Detail::simulated_responder> Responders(const std::string& service, size_t first, size_t count)
+    {
+        std::vector<Zeroconf::Detail::simulated_responder> result;
+        for (size_t i = first; i < first + count; i++)
+        {
+            auto host = Zeroconf::Detail::simulator::ResponderAddress(i);
+            result.push_back(Zeroconf::Detail::SimulatedService(service, "node-" + std::to_string(i), host));
+        }
+
+        return result;
+    }
+
+    Zeroconf::Detail::resolve_options Options(const Zeroconf::Detail::simulator& sim)
+    {
+        Zeroconf::Detail::resolve_options result;
+        result.cachePolicy = Zeroconf::Detail::CachePolicy::Bypass;
+        result.destination = sim.Address();
+        result.completion.deadline = std::chrono::milliseconds(500);
+        result.completion.retransmit = std::chrono::milliseconds(0);
+        return result;
+    }
+}
+
+TEST(Test_Client, ReusesSockets)
+{
+    Zeroconf::Detail::simulator sim;
+    ASSERT_TRUE(sim.Start(Responders(Service, 0, 3), Zeroconf::Detail::simulator_options()));
+
+    auto options = Options(sim);
+    options.completion.peers = 3;
+
+    Zeroconf::Detail::client client(options);
+    ASSERT_TRUE(client.Open());
+
+    for (size_t i = 0; i < 3; i++)
+    {
+        std::vector<Zeroconf::Detail::mdns_responce> result;
+        ASSERT_TRUE(client.Resolve(Service, 1, &result));
+        EXPECT_EQ(3, result.size());
+    }
+
+    EXPECT_EQ(1, client.Opened());
+    EXPECT_EQ(3, sim.Queries());
+}
+
+TEST(Test_Client, LateRepliesGoToCache)
+{
+    Zeroconf::Detail::simulator_options simOptions;
+    simOptions.minDelay = simOptions.maxDelay = std::chrono::milliseconds(150);
+
+    Zeroconf::Detail::simulator sim;
+    ASSERT_TRUE(sim.Start(Responders(Service, 0, 3), simOptions));
+
+    Zeroconf::Detail::record_cache cache;
+
+    auto options = Options(sim);
+    options.cachePolicy = Zeroconf::Detail::CachePolicy::Default;
+    options.cache = &cache;
+    options.completion.deadline = std::chrono::milliseconds(50);
+
+    Zeroconf::Detail::client client(options);
+
+    std::vector<Zeroconf::Detail::mdns_responce> result;
+    ASSERT_TRUE(client.Resolve(Service, 1, &result));
+    EXPECT_TRUE(result.empty());
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+
+    // the replies waited on the sockets, the second scan finds them in the cache
+    ASSERT_TRUE(client.Resolve(Service, 1, &result));
+    EXPECT_EQ(3, result.size());
+    EXPECT_EQ(3, client.Late());
+    EXPECT_EQ(1, sim.Queries());
+}
+
+TEST(Test_Client, LateRepliesToOtherQuery)
+{
+    auto responders = Responders(Service, 0, 3);
+    auto others = Responders(OtherService, 3, 2);
+    responders.insert(responders.end(), others.begin(), others.end());
+
+    Zeroconf::Detail::simulator_options simOptions;
+    simOptions.minDelay = simOptions.maxDelay = std::chrono::milliseconds(100);
+
+    Zeroconf::Detail::simulator sim;
+    ASSERT_TRUE(sim.Start(responders, simOptions));
+
+    auto options = Options(sim);
+    Zeroconf::Detail::client client(options);
+
+    // the first scan is over before the replies come, they come within the second one
+    options.completion.deadline = std::chrono::milliseconds(20);
+
+    std::vector<Zeroconf::Detail::mdns_responce> result;
+    ASSERT_TRUE(client.Resolve(OtherService, 1, options, &result));
+    EXPECT_TRUE(result.empty());
+
+    options.completion.deadline = std::chrono::milliseconds(300);
+
+    ASSERT_TRUE(client.Resolve(Service, 1, options, &result));
+    ASSERT_EQ(3, result.size());
+    for (auto& responce: result)
+        EXPECT_STREQ(Service, responce.qname.c_str());
+
+    EXPECT_EQ(1, client.Opened());
+}
+
+TEST(Test_Client, Shards)
+{
+    Zeroconf::Detail::simulator_options simOptions;
+    simOptions.burst = 2;
+
+    Zeroconf::Detail::simulator sim;
+    ASSERT_TRUE(sim.Start(Responders(Service, 0, 40), simOptions));
+
+    auto options = Options(sim);
+    options.completion.quietPeriod = std::chrono::milliseconds(100);
+
+    Zeroconf::Detail::client client(options, 4);
+
+    for (size_t i = 0; i < 2; i++)
+    {
+        std::vector<Zeroconf::Detail::mdns_responce> result;
+        ASSERT_TRUE(client.Resolve(Service, 1, &result));
+
+        ASSERT_EQ(40, result.size());
+        for (auto& responce: result)
+            EXPECT_EQ(2, responce.count);
+    }
+
+    EXPECT_EQ(1, client.Opened());
+}
+
+TEST(Test_Client, ConcurrentScans)
+{
+    Zeroconf::Detail::simulator sim;
+    ASSERT_TRUE(sim.Start(Responders(Service, 0, 3), Zeroconf::Detail::simulator_options()));
+
+    auto options = Options(sim);
+    options.completion.peers = 3;
+
+    Zeroconf::Detail::client client(options);
+
+    std::vector<size_t> counts(4);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < counts.size(); i++)
+    {
+        threads.emplace_back([&, i]()
+        {
+            for (size_t j = 0; j < 5; j++)
+            {
+                std::vector<Zeroconf::Detail::mdns_responce> result;
+                if (client.Resolve(Service, 1, &result))
+                    counts[i] += result.size();
+            }
+        });
+    }
+
+    for (auto& thread: threads)
+        thread.join();
+
+    for (auto count: counts)
+        EXPECT_EQ(5 * 3, count);
+
+    EXPECT_GE(client.Opened(), 1);
+    EXPECT_LE(client.Opened(), 4);
+}
+
+TEST(Test_Client, FailedScanReopens)
+{
+    Zeroconf::Detail::simulator sim;
+    ASSERT_TRUE(sim.Start(Responders(Service, 0, 3), Zeroconf::Detail::simulator_options()));
+
+    auto options = Options(sim);
+    options.completion.peers = 3;
+
+    Zeroconf::Detail::client client(options);
+
+    std::vector<Zeroconf::Detail::mdns_responce> result;
+    EXPECT_FALSE(client.Resolve("", 1, &result));
+
+    ASSERT_TRUE(client.Resolve(Service, 1, &result));
+    EXPECT_EQ(3, result.size());
+    EXPECT_EQ(2, client.Opened());
+}
@@ -0,0 +1,167 @@
+#include <gmock/gmock.h>
+
+#include "zeroconf-engine.hpp"
+
+#include <arpa/inet.h>
+
+using testing::ElementsAre;
+using testing::UnorderedElementsAre;
+
+namespace
+{
+    const uint8_t AnswerRecord[] =
+    {
+        0xc0, 0x0c, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x00, 0x0a, 0x00, 0x04, 0x7f, 0x00, 0x00, 0x01
+    };
+
+    // Socket on the loopback standing in for a responder
+    struct responder
+    {
+        int fd;
+        sockaddr_storage addr;
+
+        responder()
+        {
+            fd = socket(AF_INET, SOCK_DGRAM, 0);
+
+            memset(&addr, 0, sizeof(addr));
+            auto in = reinterpret_cast<sockaddr_in*>(&addr);
+            in->sin_family = AF_INET;
+            in->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(sockaddr_in));
+
+            socklen_t len = sizeof(addr);
+            getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len);
+
+            timeval tv = {1, 0};
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        }
+
+        ~responder()
+        {
+            Zeroconf::Detail::CloseSocket(fd);
+        }
+
+        // Answers the next query, optionally replacing its ID
+        void Answer(bool keepId)
+        {
+            std::vector<uint8_t> data(512);
+            sockaddr_storage peer;
+            socklen_t len = sizeof(peer);
+
+            auto cb = recvfrom(fd, &data[0], data.size(), 0, reinterpret_cast<sockaddr*>(&peer), &len);
+            ASSERT_GT(cb, 12);
+            data.resize(cb);
+
+            data[2] = 0x84;
+            if (!keepId)
+                data[0] = data[1] = 0;
+
+            data.insert(data.end(), std::begin(AnswerRecord), std::end(AnswerRecord));
+            sendto(fd, &data[0], data.size(), 0, reinterpret_cast<sockaddr*>(&peer), len);
+        }
+    };
+}
+
+TEST(Test_Engine, RoutesRepliesToQueries)
+{
+    responder r;
+    Zeroconf::Detail::engine e;
+    ASSERT_TRUE(e.Open());
+    e.SetDestination(r.addr);
+
+    std::vector<std::pair<uint16_t, std::string>> answers;
+    std::vector<uint16_t> completed;
+
+    auto onResponce = [&](uint16_t id, const Zeroconf::Detail::mdns_responce& responce)
+    {
+        answers.push_back(std::make_pair(id, responce.qname));
+    };
+
+    auto onComplete = [&](uint16_t id)
+    {
+        completed.push_back(id);
+    };
+
+    uint16_t id1 = 0, id2 = 0, id3 = 0;
+    ASSERT_TRUE(e.Query("foo.local", 1, std::chrono::milliseconds(200), onResponce, onComplete, &id1));
+    ASSERT_TRUE(e.Query("bar.local", 1, std::chrono::milliseconds(200), onResponce, onComplete, &id2));
+    ASSERT_TRUE(e.Query("baz.local", 1, std::chrono::milliseconds(100), onResponce, onComplete, &id3));
+    EXPECT_EQ(3, e.Pending());
+    EXPECT_NE(id1, id2);
+    EXPECT_NE(id2, id3);
+
+    r.Answer(true);
+    r.Answer(true);
+    r.Answer(false);
+
+    ASSERT_TRUE(e.Run());
+    EXPECT_EQ(0, e.Pending());
+
+    EXPECT_THAT(answers, UnorderedElementsAre(
+        std::make_pair(id1, std::string("foo.local")),
+        std::make_pair(id2, std::string("bar.local")),
+        std::make_pair(id3, std::string("baz.local"))));
+
+    EXPECT_THAT(completed, ElementsAre(id3, id1, id2));
+}
+
+TEST(Test_Engine, CancelAndTimeout)
+{
+    Zeroconf::Detail::engine e;
+    EXPECT_EQ(-1, e.Timeout());
+
+    responder r;
+    e.SetDestination(r.addr);
+
+    bool completed = false;
+    uint16_t id = 0;
+    ASSERT_TRUE(e.Query("foo.local", 1, std::chrono::milliseconds(5000), nullptr, [&](uint16_t) { completed = true; }, &id));
+
+    EXPECT_GT(e.Timeout(), 4000);
+    EXPECT_GE(e.Fd(), 0);
+
+    e.Cancel(id);
+    EXPECT_EQ(0, e.Pending());
+    EXPECT_EQ(-1, e.Timeout());
+
+    ASSERT_TRUE(e.Run());
+    EXPECT_FALSE(completed);
+}
+
+TEST(Test_Engine, ManyConcurrentQueries)
+{
+    static const size_t Count = 300;
+
+    responder r;
+    Zeroconf::Detail::engine e;
+    e.SetDestination(r.addr);
+
+    size_t answered = 0;
+    size_t completed = 0;
+
+    for (size_t i = 0; i < Count; i++)
+    {
+        uint16_t id;
+        ASSERT_TRUE(e.Query(
+            "host" + std::to_string(i) + ".local", 
+            1, 
+            std::chrono::milliseconds(300), 
+            [&](uint16_t, const Zeroconf::Detail::mdns_responce&) { answered++; },
+            [&](uint16_t) { completed++; },
+            &id));
+
+        r.Answer(true);
+
+        // keep the socket buffers from overflowing, every query stays in flight
+        if (i % 50 == 0)
+        {
+            ASSERT_TRUE(e.Poll(0));
+        }
+    }
+
+    EXPECT_EQ(Count, e.Pending());
+    ASSERT_TRUE(e.Run());
+    EXPECT_EQ(Count, answered);
+    EXPECT_EQ(Count, completed);
+}
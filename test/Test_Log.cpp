@@ -0,0 +1,108 @@
+#include <gmock/gmock.h>
+
+#include <atomic>
+#include <memory>
+#include <thread>
+
+#include "zeroconf-detail.hpp"
+
+namespace
+{
+    struct capture
+    {
+        std::vector<std::string> messages;
+    };
+
+    void Collect(void* context, Zeroconf::Detail::Log::LogLevel level, const std::string& message)
+    {
+        auto prefix = level == Zeroconf::Detail::Log::LogLevel::Error ? "E: " : "W: ";
+        static_cast<capture*>(context)->messages.push_back(prefix + message);
+    }
+
+    // Counts how many times the message was formatted
+    struct counted
+    {
+        size_t* count;
+    };
+
+    // found by argument-dependent lookup
+    void Append(std::string* result, const counted& value)
+    {
+        (*value.count)++;
+        result->append("counted");
+    }
+}
+
+TEST(Test_Log, SinkWithContext)
+{
+    capture output;
+    Zeroconf::Detail::Log::SetLogSink(Collect, &output);
+
+    Zeroconf::Detail::Log::Error("Failed to bind socket to interface ", std::string("eth0"), " with code ", 98);
+    Zeroconf::Detail::Log::Warning("Skipping interface ", 'x', '.');
+
+    Zeroconf::Detail::Log::SetLogSink(nullptr, nullptr);
+    Zeroconf::Detail::Log::Error("Dropped");
+
+    EXPECT_THAT(output.messages, testing::ElementsAre(
+        "E: Failed to bind socket to interface eth0 with code 98", "W: Skipping interface x."));
+}
+
+TEST(Test_Log, Threshold)
+{
+    capture output;
+    Zeroconf::Detail::Log::SetLogSink(Collect, &output);
+    Zeroconf::Detail::Log::SetLogLevel(Zeroconf::Detail::Log::LogLevel::Error);
+
+    size_t count = 0;
+    Zeroconf::Detail::Log::Warning("Not formatted ", counted { &count });
+    EXPECT_EQ(0, count);
+
+    Zeroconf::Detail::Log::Error("Formatted ", counted { &count });
+    EXPECT_EQ(1, count);
+
+    Zeroconf::Detail::Log::SetLogLevel(Zeroconf::Detail::Log::LogLevel::Warning);
+    Zeroconf::Detail::Log::SetLogSink(nullptr, nullptr);
+
+    Zeroconf::Detail::Log::Error("No sink ", counted { &count });
+    EXPECT_EQ(1, count);
+
+    EXPECT_THAT(output.messages, testing::ElementsAre("E: Formatted counted"));
+}
+
+TEST(Test_Log, OtherThreads)
+{
+    capture output;
+    Zeroconf::Detail::Log::SetLogSink(Collect, &output);
+
+    std::thread([]() { Zeroconf::Detail::Log::Warning("From a worker"); }).join();
+
+    Zeroconf::Detail::Log::SetLogSink(nullptr, nullptr);
+    EXPECT_THAT(output.messages, testing::ElementsAre("W: From a worker"));
+}
+
+TEST(Test_Log, NoMessageAfterReplaced)
+{
+    std::atomic<bool> done(false);
+    std::thread worker([&]()
+    {
+        while (!done)
+            Zeroconf::Detail::Log::Warning("From a worker");
+    });
+
+    for (size_t i = 0; i < 100; i++)
+    {
+        std::unique_ptr<capture> output(new capture());
+        Zeroconf::Detail::Log::SetLogSink(Collect, output.get());
+        std::this_thread::yield();
+
+        // no message is on its way to the context it goes with
+        Zeroconf::Detail::Log::SetLogSink(nullptr, nullptr);
+        auto count = output->messages.size();
+        std::this_thread::yield();
+        EXPECT_EQ(count, output->messages.size());
+    }
+
+    done = true;
+    worker.join();
+}
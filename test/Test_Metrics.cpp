@@ -0,0 +1,108 @@
+#include <gmock/gmock.h>
+
+#include "zeroconf-detail.hpp"
+#include "zeroconf-simulator.hpp"
+
+TEST(Test_Metrics, Histogram)
+{
+    Zeroconf::Detail::histogram histogram;
+
+    histogram.Record(std::chrono::microseconds(0));
+    histogram.Record(std::chrono::microseconds(1));
+    histogram.Record(std::chrono::microseconds(3));
+    histogram.Record(std::chrono::microseconds(1000));
+
+    auto snapshot = histogram.Snapshot();
+    EXPECT_EQ(4, snapshot.count);
+    EXPECT_EQ(1004, snapshot.sum);
+    EXPECT_EQ(1, snapshot.buckets[0]);
+    EXPECT_EQ(1, snapshot.buckets[1]);  // [1, 2)
+    EXPECT_EQ(1, snapshot.buckets[2]);  // [2, 4)
+    EXPECT_EQ(1, snapshot.buckets[10]); // [512, 1024)
+
+    EXPECT_EQ(0, snapshot.Percentile(0.25));
+    EXPECT_EQ(4, snapshot.Percentile(0.75));
+    EXPECT_EQ(1024, snapshot.Percentile(1));
+    EXPECT_DOUBLE_EQ(251, snapshot.Mean());
+
+    // everything past the last bound lands in the last bucket
+    histogram.Record(std::chrono::hours(24));
+    EXPECT_EQ(1, histogram.Snapshot().buckets[Zeroconf::Detail::MetricsBuckets - 1]);
+}
+
+TEST(Test_Metrics, ParseFailures)
+{
+    Zeroconf::Detail::Metrics().Reset();
+
+    const uint8_t Query[] = { 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
+    const uint8_t Short[] = { 0x00, 0x00, 0x84 };
+
+    Zeroconf::Detail::mdns_responce result;
+    Zeroconf::Detail::parse_tally tally;
+    EXPECT_FALSE(Zeroconf::Detail::Parse(Query, sizeof(Query), &result, &tally));
+    EXPECT_FALSE(Zeroconf::Detail::Parse(Short, sizeof(Short), &result, &tally));
+    EXPECT_FALSE(Zeroconf::Detail::Parse(Short, sizeof(Short), &result)); // no tally, not counted
+
+    EXPECT_EQ(2, tally.rejected);
+    EXPECT_EQ(2, tally.latency.count);
+
+    // nothing reaches the metrics until the tally is folded in
+    EXPECT_EQ(0, Zeroconf::Detail::Metrics().Snapshot().rejected);
+
+    Zeroconf::Detail::Metrics().Fold(&tally);
+    EXPECT_EQ(0, tally.rejected);
+
+    auto snapshot = Zeroconf::Detail::Metrics().Snapshot();
+    EXPECT_EQ(0, snapshot.parsed);
+    EXPECT_EQ(2, snapshot.rejected);
+    EXPECT_EQ(1, snapshot.parseFailures[static_cast<size_t>(Zeroconf::Detail::ParseFailure::Flags)]);
+    EXPECT_EQ(1, snapshot.parseFailures[static_cast<size_t>(Zeroconf::Detail::ParseFailure::Truncated)]);
+    EXPECT_EQ(2, snapshot.parse.count);
+}
+
+#if defined(__linux__)
+TEST(Test_Metrics, Resolve)
+{
+    std::vector<Zeroconf::Detail::simulated_responder> responders;
+    for (size_t i = 0; i < 3; i++)
+    {
+        auto host = Zeroconf::Detail::simulator::ResponderAddress(i);
+        responders.push_back(Zeroconf::Detail::SimulatedService("_sim._tcp.local", "node-" + std::to_string(i), host));
+    }
+
+    Zeroconf::Detail::simulator_options simOptions;
+    simOptions.burst = 2;
+
+    Zeroconf::Detail::simulator sim;
+    ASSERT_TRUE(sim.Start(responders, simOptions));
+
+    Zeroconf::Detail::resolve_options options;
+    options.cachePolicy = Zeroconf::Detail::CachePolicy::Bypass;
+    options.destination = sim.Address();
+    options.completion.deadline = std::chrono::milliseconds(200);
+
+    Zeroconf::Detail::Metrics().Reset();
+
+    std::vector<Zeroconf::Detail::mdns_responce> result;
+    ASSERT_TRUE(Zeroconf::Detail::Resolve("_sim._tcp.local", 1, options, &result));
+    ASSERT_EQ(3, result.size());
+
+    auto snapshot = Zeroconf::Detail::Metrics().Snapshot();
+    EXPECT_EQ(1, snapshot.scans);
+    EXPECT_EQ(1, snapshot.packetsSent);
+    EXPECT_EQ(1, snapshot.send.count);
+    EXPECT_EQ(6, snapshot.packetsReceived);
+    EXPECT_EQ(3, snapshot.parsed); // the repeats are recognized before parsing
+    EXPECT_EQ(3, snapshot.answers);
+    EXPECT_EQ(3, snapshot.repeats);
+    EXPECT_EQ(1, snapshot.firstAnswer.count);
+    EXPECT_EQ(3, snapshot.rtt.count);
+    EXPECT_GT(snapshot.wait.count, 0);
+    EXPECT_GT(snapshot.recv.count, 0);
+
+    ASSERT_EQ(3, snapshot.peers.size());
+    auto& peer = snapshot.peers["127.0.0.2"];
+    EXPECT_EQ(1, peer.answers);
+    EXPECT_LE(peer.min, peer.max);
+}
+#endif
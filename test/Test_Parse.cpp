@@ -63,11 +63,11 @@ TEST(Test_Parse, RealPacket)
     EXPECT_EQ(198, output.records[4].pos);
     EXPECT_EQ( 16, output.records[4].len);
 
-    EXPECT_STREQ("_http", output.records[0].name.c_str());
-    EXPECT_STREQ("apple macbook", output.records[1].name.c_str());
-    EXPECT_STREQ("apple macbook", output.records[2].name.c_str());
-    EXPECT_STREQ("apple", output.records[3].name.c_str());
-    EXPECT_STREQ("apple", output.records[4].name.c_str());
+    EXPECT_STREQ("_http._tcp.local", output.records[0].name.c_str());
+    EXPECT_STREQ("apple macbook._http._tcp.local", output.records[1].name.c_str());
+    EXPECT_STREQ("apple macbook._http._tcp.local", output.records[2].name.c_str());
+    EXPECT_STREQ("apple.local", output.records[3].name.c_str());
+    EXPECT_STREQ("apple.local", output.records[4].name.c_str());
 
     EXPECT_STREQ("_http._tcp.local", output.qname.c_str());
 }
@@ -168,7 +168,47 @@ TEST(Test_Parse, RecordName)
 
     ASSERT_TRUE(Zeroconf::Detail::Parse(input, &output));
     ASSERT_EQ(1, output.records.size());
-    EXPECT_STREQ("foo", output.records[0].name.c_str());
+    EXPECT_STREQ("foo.bar", output.records[0].name.c_str());
+}
+
+TEST(Test_Parse, UncompressedRecordName)
+{
+    Zeroconf::Detail::raw_responce input;
+    Zeroconf::Detail::mdns_responce output;
+
+    input.data.assign(std::begin(BlankPacket), std::end(BlankPacket));
+    input.data.insert(input.data.end(), std::begin(Fqdn2), std::end(Fqdn2));
+    input.data.insert(input.data.end(), std::begin(BlankRecord) + 2, std::end(BlankRecord));
+
+    ASSERT_TRUE(Zeroconf::Detail::Parse(input, &output));
+    ASSERT_EQ(1, output.records.size());
+    EXPECT_STREQ("foo.bar", output.records[0].name.c_str());
+    EXPECT_EQ(sizeof(BlankPacket), output.records[0].pos);
+    EXPECT_EQ(sizeof(Fqdn2) + sizeof(BlankRecord) - 2, output.records[0].len);
+}
+
+TEST(Test_Parse, RecordNameBeyondFirst256Bytes)
+{
+    Zeroconf::Detail::raw_responce input;
+    Zeroconf::Detail::mdns_responce output;
+
+    input.data.assign(std::begin(BlankPacket), std::end(BlankPacket));
+    
+    // a record with 300 bytes of payload, followed by a record with the name inside of it
+    auto it = input.data.insert(input.data.end(), std::begin(BlankRecord), std::end(BlankRecord));
+    *(it + 10) = 0x01;
+    *(it + 11) = 0x2c;
+    size_t payload = input.data.size();
+    input.data.resize(input.data.size() + 300);
+    std::copy(std::begin(Fqdn1), std::end(Fqdn1), input.data.begin() + payload + 290);
+
+    it = input.data.insert(input.data.end(), std::begin(BlankRecord), std::end(BlankRecord));
+    *it = 0xc0 | ((payload + 290) >> 8);
+    *(it + 1) = (payload + 290) & 0xff;
+
+    ASSERT_TRUE(Zeroconf::Detail::Parse(input, &output));
+    ASSERT_EQ(2, output.records.size());
+    EXPECT_STREQ("foo", output.records[1].name.c_str());
 }
 
 TEST(Test_Parse, EmptyAndIncompletePacket)
@@ -199,6 +239,24 @@ TEST(Test_Parse, WrongPacketFlags)
     }
 }
 
+TEST(Test_Parse, TruncatedFlag)
+{
+    Zeroconf::Detail::raw_responce input;
+    Zeroconf::Detail::mdns_responce output;
+
+    input.data.assign(std::begin(RealPacket), std::end(RealPacket));
+    input.data[2] |= Zeroconf::Detail::MdnsTruncatedFlag >> 8;
+
+    ASSERT_TRUE(Zeroconf::Detail::Parse(input, &output));
+    EXPECT_TRUE(output.truncated);
+    EXPECT_EQ(5, output.records.size());
+
+    input.data.assign(std::begin(RealPacket), std::end(RealPacket));
+
+    ASSERT_TRUE(Zeroconf::Detail::Parse(input, &output));
+    EXPECT_FALSE(output.truncated);
+}
+
 TEST(Test_Parse, WrongFqdn)
 {
     static const uint8_t InvalidFqdnLengths[] = { 2, 3, 4, 5 };
@@ -233,13 +291,84 @@ TEST(Test_Parse, IncompleRecord)
 }
 
 TEST(Test_Parse, WrongRecordToken)
+{
+    static const uint8_t Tokens[] = { 0x40, 0x80 };
+
+    for (auto i: Tokens)
+    {
+        Zeroconf::Detail::raw_responce input;
+        Zeroconf::Detail::mdns_responce output;
+        
+        input.data.assign(std::begin(BlankPacket), std::end(BlankPacket));
+        auto it = input.data.insert(input.data.end(), std::begin(BlankRecord), std::end(BlankRecord));
+        *it = i;
+
+        EXPECT_FALSE(Zeroconf::Detail::Parse(input, &output));
+    }
+}
+
+TEST(Test_Parse, WrongRecordNamePointer)
 {
     Zeroconf::Detail::raw_responce input;
     Zeroconf::Detail::mdns_responce output;
         
+    // pointing to itself
     input.data.assign(std::begin(BlankPacket), std::end(BlankPacket));
     auto it = input.data.insert(input.data.end(), std::begin(BlankRecord), std::end(BlankRecord));
-    *it = 0;
+    *(it + 1) = sizeof(BlankPacket);
 
     EXPECT_FALSE(Zeroconf::Detail::Parse(input, &output));
 }
+
+TEST(Test_Parse, BorrowedBuffer)
+{
+    Zeroconf::Detail::mdns_responce output;
+
+    ASSERT_TRUE(Zeroconf::Detail::Parse(RealPacket, sizeof(RealPacket), &output));
+    ASSERT_EQ(5, output.records.size());
+    EXPECT_TRUE(output.data.empty());
+    EXPECT_STREQ("_http._tcp.local", output.qname.c_str());
+    EXPECT_EQ(198, output.records[4].pos);
+}
+
+TEST(Test_Parse, MovedBuffer)
+{
+    Zeroconf::Detail::raw_responce input;
+    Zeroconf::Detail::mdns_responce output;
+    input.data.assign(std::begin(RealPacket), std::end(RealPacket));
+    auto p = &input.data[0];
+
+    ASSERT_TRUE(Zeroconf::Detail::Parse(std::move(input), &output));
+    EXPECT_EQ(p, &output.data[0]);
+    EXPECT_EQ(5, output.records.size());
+}
+
+TEST(Test_Parse, TruncatedAndCorruptedPacket)
+{
+    const std::vector<uint8_t> data(std::begin(RealPacket), std::end(RealPacket));
+    static const size_t RecordEnds[] = { 34, 62, 144, 170, 198 };
+
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        Zeroconf::Detail::mdns_responce output;
+        bool expected = std::find(std::begin(RecordEnds), std::end(RecordEnds), i) != std::end(RecordEnds);
+        EXPECT_EQ(expected, Zeroconf::Detail::Parse(&data[0], i, &output));
+    }
+
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        static const uint8_t Values[] = { 0x00, 0x01, 0x0c, 0x3f, 0xc0, 0xff };
+        for (auto v: Values)
+        {
+            auto corrupted = data;
+            corrupted[i] = v;
+
+            Zeroconf::Detail::mdns_responce output;
+            if (!Zeroconf::Detail::Parse(&corrupted[0], corrupted.size(), &output))
+                continue;
+
+            for (auto& rr: output.records)
+                EXPECT_LE(rr.pos + rr.len, corrupted.size());
+        }
+    }
+}
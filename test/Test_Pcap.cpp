@@ -0,0 +1,248 @@
+#include <gmock/gmock.h>
+
+#include "zeroconf-pcap.hpp"
+
+namespace
+{
+    const uint8_t RealPacket[] =
+    {
+        0x00, 0x00, 0x84, 0x00, 0x00, 0x01, 0x00, 0x05, 0x00, 0x00, 0x00, 0x00, 0x05, 0x5F, 0x68, 0x74,
+        0x74, 0x70, 0x04, 0x5F, 0x74, 0x63, 0x70, 0x05, 0x6C, 0x6F, 0x63, 0x61, 0x6C, 0x00, 0x00, 0x0C,
+        0x00, 0x01, 0xC0, 0x0C, 0x00, 0x0C, 0x00, 0x01, 0x00, 0x00, 0x00, 0x0A, 0x00, 0x10, 0x0D, 0x61,
+        0x70, 0x70, 0x6C, 0x65, 0x20, 0x6D, 0x61, 0x63, 0x62, 0x6F, 0x6F, 0x6B, 0xC0, 0x0C, 0xC0, 0x2E,
+        0x00, 0x10, 0x00, 0x01, 0x00, 0x00, 0x00, 0x0A, 0x00, 0x46, 0x45, 0x4C, 0x6F, 0x72, 0x65, 0x6D,
+        0x20, 0x69, 0x70, 0x73, 0x75, 0x6D, 0x20, 0x64, 0x6F, 0x6C, 0x6F, 0x72, 0x20, 0x73, 0x69, 0x74,
+        0x20, 0x61, 0x6D, 0x65, 0x74, 0x20, 0x63, 0x6F, 0x6E, 0x73, 0x65, 0x63, 0x74, 0x65, 0x74, 0x75,
+        0x72, 0x20, 0x61, 0x64, 0x69, 0x70, 0x69, 0x73, 0x63, 0x69, 0x6E, 0x67, 0x20, 0x65, 0x6C, 0x69,
+        0x74, 0x20, 0x73, 0x65, 0x64, 0x20, 0x64, 0x6F, 0x20, 0x65, 0x69, 0x75, 0x73, 0x6D, 0x6F, 0x64,
+        0xC0, 0x2E, 0x00, 0x21, 0x00, 0x01, 0x00, 0x00, 0x00, 0x0A, 0x00, 0x0E, 0x00, 0x00, 0x00, 0x00,
+        0x22, 0xB3, 0x05, 0x61, 0x70, 0x70, 0x6C, 0x65, 0xC0, 0x17, 0xC0, 0xA2, 0x00, 0x1C, 0x00, 0x01,
+        0x00, 0x00, 0x00, 0x0A, 0x00, 0x10, 0xFD, 0xAD, 0xC9, 0xE2, 0x23, 0x28, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0xC0, 0xA2, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x00, 0x0A,
+        0x00, 0x04, 0xC0, 0xA8, 0x00, 0x01
+    };
+
+    const uint8_t Query[] =
+    {
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x05, 0x5F, 0x68, 0x74,
+        0x74, 0x70, 0x04, 0x5F, 0x74, 0x63, 0x70, 0x05, 0x6C, 0x6F, 0x63, 0x61, 0x6C, 0x00, 0x00, 0x0C,
+        0x00, 0x01
+    };
+
+    void Put16(uint16_t value, std::vector<uint8_t>* result)
+    {
+        result->push_back(static_cast<uint8_t>(value >> 8));
+        result->push_back(static_cast<uint8_t>(value));
+    }
+
+    void PutHost32(uint32_t value, std::vector<uint8_t>* result)
+    {
+        auto p = reinterpret_cast<const uint8_t*>(&value);
+        result->insert(result->end(), p, p + sizeof(value));
+    }
+
+    // Ethernet, optionally VLAN tagged, IPv4 and UDP around the payload
+    std::vector<uint8_t> Frame4(uint8_t host, uint16_t srcPort, uint16_t dstPort, const uint8_t* payload, size_t size, bool vlan = false)
+    {
+        std::vector<uint8_t> result(12, 0);
+        if (vlan)
+        {
+            Put16(0x8100, &result);
+            Put16(10, &result);
+        }
+
+        Put16(0x0800, &result);
+
+        const uint8_t Ip[] = { 0x45, 0x00 };
+        result.insert(result.end(), std::begin(Ip), std::end(Ip));
+        Put16(static_cast<uint16_t>(20 + 8 + size), &result);
+
+        const uint8_t Rest[] = { 0, 0, 0, 0, 255, 17, 0, 0, 192, 168, 0, host, 224, 0, 0, 251 };
+        result.insert(result.end(), std::begin(Rest), std::end(Rest));
+
+        Put16(srcPort, &result);
+        Put16(dstPort, &result);
+        Put16(static_cast<uint16_t>(8 + size), &result);
+        Put16(0, &result);
+
+        result.insert(result.end(), payload, payload + size);
+        return result;
+    }
+
+    // Raw IPv6 and UDP around the payload, from fe80::host
+    std::vector<uint8_t> Frame6(uint8_t host, const uint8_t* payload, size_t size)
+    {
+        std::vector<uint8_t> result = { 0x60, 0, 0, 0 };
+        Put16(static_cast<uint16_t>(8 + size), &result);
+        result.push_back(17);
+        result.push_back(255);
+
+        std::vector<uint8_t> src(16, 0);
+        src[0] = 0xfe;
+        src[1] = 0x80;
+        src[15] = host;
+        result.insert(result.end(), src.begin(), src.end());
+
+        std::vector<uint8_t> dst(16, 0);
+        dst[0] = 0xff;
+        dst[1] = 0x02;
+        dst[15] = 0xfb;
+        result.insert(result.end(), dst.begin(), dst.end());
+
+        Put16(5353, &result);
+        Put16(5353, &result);
+        Put16(static_cast<uint16_t>(8 + size), &result);
+        Put16(0, &result);
+
+        result.insert(result.end(), payload, payload + size);
+        return result;
+    }
+
+    std::vector<uint8_t> Pcap(const std::vector<std::vector<uint8_t>>& frames, uint16_t linkType)
+    {
+        std::vector<uint8_t> result;
+        PutHost32(Zeroconf::Detail::PcapMagic, &result);
+        PutHost32(0x00040002, &result); // version 2.4
+        PutHost32(0, &result);
+        PutHost32(0, &result);
+        PutHost32(65535, &result);
+        PutHost32(linkType, &result);
+
+        for (auto& frame: frames)
+        {
+            PutHost32(0, &result);
+            PutHost32(0, &result);
+            PutHost32(static_cast<uint32_t>(frame.size()), &result);
+            PutHost32(static_cast<uint32_t>(frame.size()), &result);
+            result.insert(result.end(), frame.begin(), frame.end());
+        }
+
+        return result;
+    }
+
+    void PutBlock(uint32_t type, const std::vector<uint8_t>& body, std::vector<uint8_t>* result)
+    {
+        auto padded = (body.size() + 3) / 4 * 4;
+        PutHost32(type, result);
+        PutHost32(static_cast<uint32_t>(padded + 12), result);
+        result->insert(result->end(), body.begin(), body.end());
+        result->insert(result->end(), padded - body.size(), 0);
+        PutHost32(static_cast<uint32_t>(padded + 12), result);
+    }
+
+    // Second interface is raw IP, the first one is Ethernet
+    std::vector<uint8_t> Pcapng(const std::vector<std::vector<uint8_t>>& frames, const std::vector<uint32_t>& interfaces)
+    {
+        std::vector<uint8_t> result;
+
+        std::vector<uint8_t> shb;
+        PutHost32(Zeroconf::Detail::PcapngByteOrderMagic, &shb);
+        PutHost32(0x00000001, &shb); // version 1.0
+        shb.insert(shb.end(), 8, 0xff);
+        PutBlock(Zeroconf::Detail::PcapngSectionBlock, shb, &result);
+
+        const uint16_t LinkTypes[] = { Zeroconf::Detail::LinkTypeEthernet, Zeroconf::Detail::LinkTypeRaw };
+        for (auto linkType: LinkTypes)
+        {
+            std::vector<uint8_t> idb;
+            PutHost32(linkType, &idb);
+            PutHost32(65535, &idb);
+            PutBlock(Zeroconf::Detail::PcapngInterfaceBlock, idb, &result);
+        }
+
+        for (size_t i = 0; i < frames.size(); i++)
+        {
+            std::vector<uint8_t> epb;
+            PutHost32(interfaces[i], &epb);
+            PutHost32(0, &epb);
+            PutHost32(0, &epb);
+            PutHost32(static_cast<uint32_t>(frames[i].size()), &epb);
+            PutHost32(static_cast<uint32_t>(frames[i].size()), &epb);
+            epb.insert(epb.end(), frames[i].begin(), frames[i].end());
+            PutBlock(Zeroconf::Detail::PcapngEnhancedPacketBlock, epb, &result);
+        }
+
+        return result;
+    }
+}
+
+TEST(Test_Pcap, ExtractPayload)
+{
+    auto frame = Frame4(7, 5353, 5353, RealPacket, sizeof(RealPacket), true);
+
+    Zeroconf::Detail::capture_frame input = { Zeroconf::Detail::LinkTypeEthernet, &frame[0], frame.size() };
+    sockaddr_storage peer;
+    const uint8_t* payload = nullptr;
+    size_t size = 0;
+
+    ASSERT_TRUE(Zeroconf::Detail::ExtractMdns(input, &peer, &payload, &size));
+    EXPECT_EQ(sizeof(RealPacket), size);
+    EXPECT_EQ(0, memcmp(RealPacket, payload, size));
+    EXPECT_STREQ("192.168.0.7", Zeroconf::Detail::PeerAddress(peer).c_str());
+
+    // cut short
+    input.size -= 10;
+    EXPECT_FALSE(Zeroconf::Detail::ExtractMdns(input, &peer, &payload, &size));
+
+    // other port
+    frame = Frame4(7, 53, 53, RealPacket, sizeof(RealPacket));
+    input.data = &frame[0];
+    input.size = frame.size();
+    EXPECT_FALSE(Zeroconf::Detail::ExtractMdns(input, &peer, &payload, &size));
+}
+
+TEST(Test_Pcap, ReplayPcap)
+{
+    std::vector<std::vector<uint8_t>> frames;
+    for (size_t i = 0; i < 3000; i++)
+        frames.push_back(Frame4(static_cast<uint8_t>(1 + i % 3), 5353, 5353, RealPacket, sizeof(RealPacket), i % 2 == 0));
+
+    frames.push_back(Frame4(9, 5353, 5353, Query, sizeof(Query)));
+    frames.push_back(Frame4(9, 53, 53, RealPacket, sizeof(RealPacket)));
+    frames.push_back(Frame4(1, 5353, 5353, RealPacket, 100));
+
+    auto capture = Pcap(frames, Zeroconf::Detail::LinkTypeEthernet);
+
+    Zeroconf::Detail::capture_stats stats;
+    ASSERT_TRUE(Zeroconf::Detail::ReplayCapture(&capture[0], capture.size(), 4, &stats));
+
+    EXPECT_EQ(3003, stats.frames);
+    EXPECT_EQ(1, stats.queries);
+    EXPECT_EQ(3000, stats.responces);
+    EXPECT_EQ(1, stats.failed);
+    EXPECT_EQ(15000, stats.records);
+
+    ASSERT_EQ(3, stats.responders.size());
+    EXPECT_EQ(1000, stats.responders["192.168.0.1"].packets);
+    EXPECT_EQ(1, stats.responders["192.168.0.1"].failed);
+    EXPECT_EQ(5000, stats.responders["192.168.0.2"].records);
+    EXPECT_EQ(1000 * sizeof(RealPacket), stats.responders["192.168.0.3"].bytes);
+}
+
+TEST(Test_Pcap, ReplayPcapng)
+{
+    std::vector<std::vector<uint8_t>> frames;
+    frames.push_back(Frame4(1, 5353, 5353, RealPacket, sizeof(RealPacket)));
+    frames.push_back(Frame6(2, RealPacket, sizeof(RealPacket)));
+    frames.push_back(Frame6(2, RealPacket, sizeof(RealPacket) - 1)); // odd length gets padded
+
+    auto capture = Pcapng(frames, { 0, 1, 1 });
+
+    Zeroconf::Detail::capture_stats stats;
+    ASSERT_TRUE(Zeroconf::Detail::ReplayCapture(&capture[0], capture.size(), 2, &stats));
+
+    EXPECT_EQ(3, stats.frames);
+    EXPECT_EQ(2, stats.responces);
+    EXPECT_EQ(1, stats.failed);
+    EXPECT_EQ(1, stats.responders["192.168.0.1"].packets);
+    EXPECT_EQ(1, stats.responders["fe80::2"].packets);
+    EXPECT_EQ(1, stats.responders["fe80::2"].failed);
+}
+
+TEST(Test_Pcap, UnknownFormat)
+{
+    std::vector<uint8_t> data(64, 0x11);
+
+    Zeroconf::Detail::capture_stats stats;
+    EXPECT_FALSE(Zeroconf::Detail::ReplayCapture(&data[0], data.size(), 1, &stats));
+}
@@ -0,0 +1,156 @@
+#include <gmock/gmock.h>
+
+#include "zeroconf-detail.hpp"
+
+namespace
+{
+    //  0     1     2     3     4     5     6     7     8     9     10    11    12    13    14    15
+    //  3     f     o     o     3     b     a     r     0     3     b     a     z     ptr (0)     ptr (4)
+    const uint8_t Message[] =
+    {
+        0x03, 'f', 'o', 'o', 0x03, 'b', 'a', 'r', 0x00, 0x03, 'b', 'a', 'z', 0xc0, 0x00, 0xc0, 0x04
+    };
+}
+
+TEST(Test_ReadFqdn, Plain)
+{
+    std::string result;
+    EXPECT_EQ(9, Zeroconf::Detail::ReadFqdn(Message, sizeof(Message), 0, &result));
+    EXPECT_STREQ("foo.bar", result.c_str());
+
+    EXPECT_EQ(5, Zeroconf::Detail::ReadFqdn(Message, sizeof(Message), 4, &result));
+    EXPECT_STREQ("bar", result.c_str());
+
+    EXPECT_EQ(1, Zeroconf::Detail::ReadFqdn(Message, sizeof(Message), 8, &result));
+    EXPECT_TRUE(result.empty());
+}
+
+TEST(Test_ReadFqdn, Pointer)
+{
+    std::string result;
+    EXPECT_EQ(6, Zeroconf::Detail::ReadFqdn(Message, sizeof(Message), 9, &result));
+    EXPECT_STREQ("baz.foo.bar", result.c_str());
+
+    EXPECT_EQ(2, Zeroconf::Detail::ReadFqdn(Message, sizeof(Message), 15, &result));
+    EXPECT_STREQ("bar", result.c_str());
+}
+
+TEST(Test_ReadFqdn, ChainedPointers)
+{
+    std::vector<uint8_t> data(std::begin(Message), std::end(Message));
+
+    // 17: 3 q u x ptr(9) -> baz ptr(0) -> foo.bar
+    // 23: ptr(17)
+    const uint8_t Tail[] = { 0x03, 'q', 'u', 'x', 0xc0, 0x09, 0xc0, 0x11 };
+    data.insert(data.end(), std::begin(Tail), std::end(Tail));
+
+    std::string result;
+    EXPECT_EQ(2, Zeroconf::Detail::ReadFqdn(data, 23, &result));
+    EXPECT_STREQ("qux.baz.foo.bar", result.c_str());
+}
+
+TEST(Test_ReadFqdn, PointerBeyondFirst256Bytes)
+{
+    std::vector<uint8_t> data(300, 0);
+    data.insert(data.end(), std::begin(Message), std::end(Message));
+    data.push_back(0xc0 | (300 >> 8));
+    data.push_back(300 & 0xff);
+
+    std::string result;
+    EXPECT_EQ(2, Zeroconf::Detail::ReadFqdn(data, data.size() - 2, &result));
+    EXPECT_STREQ("foo.bar", result.c_str());
+}
+
+TEST(Test_ReadFqdn, Loops)
+{
+    std::string result;
+
+    // pointer to itself
+    const uint8_t Self[] = { 0x03, 'f', 'o', 'o', 0xc0, 0x04 };
+    EXPECT_EQ(0, Zeroconf::Detail::ReadFqdn(Self, sizeof(Self), 0, &result));
+
+    // pointer back to the start of the same name
+    const uint8_t Back[] = { 0x03, 'f', 'o', 'o', 0xc0, 0x00 };
+    EXPECT_EQ(0, Zeroconf::Detail::ReadFqdn(Back, sizeof(Back), 0, &result));
+
+    // two pointers referring to each other
+    const uint8_t Pair[] = { 0xc0, 0x02, 0xc0, 0x00 };
+    EXPECT_EQ(0, Zeroconf::Detail::ReadFqdn(Pair, sizeof(Pair), 0, &result));
+    EXPECT_EQ(0, Zeroconf::Detail::ReadFqdn(Pair, sizeof(Pair), 2, &result));
+
+    // forward pointer
+    const uint8_t Forward[] = { 0xc0, 0x02, 0x00 };
+    EXPECT_EQ(0, Zeroconf::Detail::ReadFqdn(Forward, sizeof(Forward), 0, &result));
+}
+
+TEST(Test_ReadFqdn, MaxHops)
+{
+    // every name is a single label followed by a pointer to the previous one
+    std::vector<uint8_t> data = { 0x01, 'a', 0x00 };
+    for (size_t i = 0; i < Zeroconf::Detail::MdnsMaxCompressionHops + 1; i++)
+    {
+        size_t prev = data.size() - (i == 0 ? 3 : 4);
+        data.push_back(0x01);
+        data.push_back('a');
+        data.push_back(0xc0);
+        data.push_back(static_cast<uint8_t>(prev));
+    }
+
+    std::string result;
+    EXPECT_EQ(4, Zeroconf::Detail::ReadFqdn(data, data.size() - 8, &result));
+    EXPECT_EQ(0, Zeroconf::Detail::ReadFqdn(data, data.size() - 4, &result));
+}
+
+TEST(Test_ReadFqdn, MaxLength)
+{
+    std::vector<uint8_t> data;
+    for (size_t i = 0; i < 4; i++)
+    {
+        data.push_back(63);
+        data.insert(data.end(), 63, 'a');
+    }
+    data.push_back(0);
+
+    std::string result;
+    EXPECT_EQ(0, Zeroconf::Detail::ReadFqdn(data, 0, &result));
+
+    data.erase(data.begin() + 1, data.begin() + 3);
+    data[0] = 61;
+    EXPECT_EQ(data.size(), Zeroconf::Detail::ReadFqdn(data, 0, &result));
+    EXPECT_EQ(253, result.size());
+}
+
+TEST(Test_ReadFqdn, Incomplete)
+{
+    std::string result;
+    for (size_t i = 0; i < 9; i++)
+        EXPECT_EQ(0, Zeroconf::Detail::ReadFqdn(Message, i, 0, &result));
+
+    EXPECT_EQ(0, Zeroconf::Detail::ReadFqdn(Message, sizeof(Message) - 1, 15, &result));
+    EXPECT_EQ(0, Zeroconf::Detail::ReadFqdn(std::vector<uint8_t>(), 0, &result));
+}
+
+TEST(Test_ReadFqdn, ReservedLabelType)
+{
+    static const uint8_t Tokens[] = { 0x40, 0x80 };
+
+    std::string result;
+    for (auto i: Tokens)
+    {
+        const uint8_t Data[] = { i, 0x00 };
+        EXPECT_EQ(0, Zeroconf::Detail::ReadFqdn(Data, sizeof(Data), 0, &result));
+    }
+}
+
+TEST(Test_ReadFqdn, ReusesBuffer)
+{
+    std::string result;
+    result.reserve(64);
+    auto p = result.data();
+
+    Zeroconf::Detail::ReadFqdn(Message, sizeof(Message), 9, &result);
+    EXPECT_EQ(p, result.data());
+    Zeroconf::Detail::ReadFqdn(Message, sizeof(Message), 0, &result);
+    EXPECT_EQ(p, result.data());
+    EXPECT_STREQ("foo.bar", result.c_str());
+}
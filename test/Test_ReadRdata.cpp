@@ -0,0 +1,177 @@
+#include <gmock/gmock.h>
+
+#include "zeroconf-detail.hpp"
+
+namespace
+{
+    const uint8_t RealPacket[] =
+    {
+        0x00, 0x00, 0x84, 0x00, 0x00, 0x01, 0x00, 0x05, 0x00, 0x00, 0x00, 0x00, 0x05, 0x5F, 0x68, 0x74,
+        0x74, 0x70, 0x04, 0x5F, 0x74, 0x63, 0x70, 0x05, 0x6C, 0x6F, 0x63, 0x61, 0x6C, 0x00, 0x00, 0x0C,
+        0x00, 0x01, 0xC0, 0x0C, 0x00, 0x0C, 0x00, 0x01, 0x00, 0x00, 0x00, 0x0A, 0x00, 0x10, 0x0D, 0x61,
+        0x70, 0x70, 0x6C, 0x65, 0x20, 0x6D, 0x61, 0x63, 0x62, 0x6F, 0x6F, 0x6B, 0xC0, 0x0C, 0xC0, 0x2E,
+        0x00, 0x10, 0x00, 0x01, 0x00, 0x00, 0x00, 0x0A, 0x00, 0x46, 0x45, 0x4C, 0x6F, 0x72, 0x65, 0x6D,
+        0x20, 0x69, 0x70, 0x73, 0x75, 0x6D, 0x20, 0x64, 0x6F, 0x6C, 0x6F, 0x72, 0x20, 0x73, 0x69, 0x74,
+        0x20, 0x61, 0x6D, 0x65, 0x74, 0x20, 0x63, 0x6F, 0x6E, 0x73, 0x65, 0x63, 0x74, 0x65, 0x74, 0x75,
+        0x72, 0x20, 0x61, 0x64, 0x69, 0x70, 0x69, 0x73, 0x63, 0x69, 0x6E, 0x67, 0x20, 0x65, 0x6C, 0x69,
+        0x74, 0x20, 0x73, 0x65, 0x64, 0x20, 0x64, 0x6F, 0x20, 0x65, 0x69, 0x75, 0x73, 0x6D, 0x6F, 0x64,
+        0xC0, 0x2E, 0x00, 0x21, 0x00, 0x01, 0x00, 0x00, 0x00, 0x0A, 0x00, 0x0E, 0x00, 0x00, 0x00, 0x00,
+        0x22, 0xB3, 0x05, 0x61, 0x70, 0x70, 0x6C, 0x65, 0xC0, 0x17, 0xC0, 0xA2, 0x00, 0x1C, 0x00, 0x01,
+        0x00, 0x00, 0x00, 0x0A, 0x00, 0x10, 0xFD, 0xAD, 0xC9, 0xE2, 0x23, 0x28, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0xC0, 0xA2, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x00, 0x0A,
+        0x00, 0x04, 0xC0, 0xA8, 0x00, 0x01
+    };
+
+    // blank packet, TXT record header and the strings starting at 29
+    const uint8_t TxtPacket[] = 
+    {
+        0x00, 0x00, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0xc0, 0x0c, 0x00, 0x10, 0x00, 0x01, 0x00, 0x00, 0x00, 0x0a, 0x00, 0x17,
+        0x07, 'p', 'a', 't', 'h', '=', '/', 'x',
+        0x00,
+        0x04, 'f', 'l', 'a', 'g',
+        0x04, 'e', 'm', 'p', '=',
+        0x03, '=', 'v', '1'
+    };
+
+    Zeroconf::Detail::mdns_responce ParseRealPacket()
+    {
+        Zeroconf::Detail::raw_responce input;
+        Zeroconf::Detail::mdns_responce output;
+        input.data.assign(std::begin(RealPacket), std::end(RealPacket));
+        Zeroconf::Detail::Parse(input, &output);
+        return output;
+    }
+}
+
+TEST(Test_ReadRdata, Offsets)
+{
+    auto output = ParseRealPacket();
+    ASSERT_EQ(5, output.records.size());
+
+    for (auto& rr: output.records)
+        EXPECT_EQ(rr.pos + rr.len, rr.rdpos + rr.rdlen);
+
+    EXPECT_EQ(46, output.records[0].rdpos);
+    EXPECT_EQ(16, output.records[0].rdlen);
+    EXPECT_EQ(210, output.records[4].rdpos);
+    EXPECT_EQ(4, output.records[4].rdlen);
+}
+
+TEST(Test_ReadRdata, A)
+{
+    auto output = ParseRealPacket();
+
+    in_addr addr;
+    ASSERT_TRUE(Zeroconf::Detail::ReadA(output, output.records[4], &addr));
+    EXPECT_EQ(htonl(0xc0a80001), addr.s_addr);
+
+    EXPECT_FALSE(Zeroconf::Detail::ReadA(output, output.records[3], &addr));
+}
+
+TEST(Test_ReadRdata, Aaaa)
+{
+    static const uint8_t Expected[] = 
+    { 
+        0xFD, 0xAD, 0xC9, 0xE2, 0x23, 0x28, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01 
+    };
+
+    auto output = ParseRealPacket();
+
+    in6_addr addr;
+    ASSERT_TRUE(Zeroconf::Detail::ReadAaaa(output, output.records[3], &addr));
+    EXPECT_EQ(0, memcmp(Expected, &addr, sizeof(addr)));
+
+    EXPECT_FALSE(Zeroconf::Detail::ReadAaaa(output, output.records[4], &addr));
+}
+
+TEST(Test_ReadRdata, Ptr)
+{
+    auto output = ParseRealPacket();
+
+    std::string target;
+    ASSERT_TRUE(Zeroconf::Detail::ReadPtr(output, output.records[0], &target));
+    EXPECT_STREQ("apple macbook._http._tcp.local", target.c_str());
+
+    EXPECT_FALSE(Zeroconf::Detail::ReadPtr(output, output.records[1], &target));
+}
+
+TEST(Test_ReadRdata, Srv)
+{
+    auto output = ParseRealPacket();
+
+    Zeroconf::Detail::mdns_srv srv;
+    ASSERT_TRUE(Zeroconf::Detail::ReadSrv(output, output.records[2], &srv));
+    EXPECT_EQ(0, srv.priority);
+    EXPECT_EQ(0, srv.weight);
+    EXPECT_EQ(8883, srv.port);
+    EXPECT_STREQ("apple.local", srv.target.c_str());
+
+    EXPECT_FALSE(Zeroconf::Detail::ReadSrv(output, output.records[0], &srv));
+}
+
+TEST(Test_ReadRdata, Txt)
+{
+    auto output = ParseRealPacket();
+
+    Zeroconf::Detail::mdns_txt txt;
+    auto reader = Zeroconf::Detail::ReadTxt(output, output.records[1]);
+    ASSERT_TRUE(reader.Next(&txt));
+    EXPECT_EQ("Lorem ipsum dolor sit amet consectetur adipiscing elit sed do eiusmod", txt.key.to_string());
+    EXPECT_FALSE(txt.hasValue);
+    EXPECT_FALSE(reader.Next(&txt));
+
+    reader = Zeroconf::Detail::ReadTxt(output, output.records[0]);
+    EXPECT_FALSE(reader.Next(&txt));
+}
+
+TEST(Test_ReadRdata, TxtKeyValues)
+{
+    Zeroconf::Detail::raw_responce input;
+    Zeroconf::Detail::mdns_responce output;
+    input.data.assign(std::begin(TxtPacket), std::end(TxtPacket));
+
+    ASSERT_TRUE(Zeroconf::Detail::Parse(input, &output));
+    ASSERT_EQ(1, output.records.size());
+
+    Zeroconf::Detail::mdns_txt txt;
+    auto reader = Zeroconf::Detail::ReadTxt(output, output.records[0]);
+
+    ASSERT_TRUE(reader.Next(&txt));
+    EXPECT_EQ("path", txt.key.to_string());
+    EXPECT_EQ("/x", txt.value.to_string());
+    EXPECT_TRUE(txt.hasValue);
+
+    ASSERT_TRUE(reader.Next(&txt));
+    EXPECT_EQ("flag", txt.key.to_string());
+    EXPECT_FALSE(txt.hasValue);
+
+    ASSERT_TRUE(reader.Next(&txt));
+    EXPECT_EQ("emp", txt.key.to_string());
+    EXPECT_TRUE(txt.value.empty());
+    EXPECT_TRUE(txt.hasValue);
+
+    ASSERT_TRUE(reader.Next(&txt));
+    EXPECT_TRUE(txt.key.empty());
+    EXPECT_EQ("v1", txt.value.to_string());
+
+    EXPECT_FALSE(reader.Next(&txt));
+}
+
+TEST(Test_ReadRdata, TxtOverrun)
+{
+    Zeroconf::Detail::raw_responce input;
+    Zeroconf::Detail::mdns_responce output;
+    input.data.assign(std::begin(TxtPacket), std::end(TxtPacket));
+    input.data[48] = 0x04; // last string runs past the record
+
+    ASSERT_TRUE(Zeroconf::Detail::Parse(input, &output));
+
+    Zeroconf::Detail::mdns_txt txt;
+    auto reader = Zeroconf::Detail::ReadTxt(output, output.records[0]);
+    for (size_t i = 0; i < 3; i++)
+        EXPECT_TRUE(reader.Next(&txt));
+
+    EXPECT_FALSE(reader.Next(&txt));
+    EXPECT_FALSE(reader.Next(&txt));
+}
@@ -0,0 +1,404 @@
+#include <gmock/gmock.h>
+
+#include "zeroconf-detail.hpp"
+
+#ifndef WIN32
+#include <arpa/inet.h>
+#include <sys/resource.h>
+#endif
+
+namespace
+{
+    // Pair of UDP sockets on the loopback, the second one is bound to an ephemeral port
+    struct loopback
+    {
+        int sender;
+        int receiver;
+        sockaddr_in addr;
+
+        loopback()
+        {
+            sender = socket(AF_INET, SOCK_DGRAM, 0);
+            receiver = socket(AF_INET, SOCK_DGRAM, 0);
+
+            memset(&addr, 0, sizeof(addr));
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            bind(receiver, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+
+            socklen_t len = sizeof(addr);
+            getsockname(receiver, reinterpret_cast<sockaddr*>(&addr), &len);
+        }
+
+        ~loopback()
+        {
+            Zeroconf::Detail::CloseSocket(sender);
+            Zeroconf::Detail::CloseSocket(receiver);
+        }
+
+        void Send(uint8_t tag, size_t size)
+        {
+            std::vector<uint8_t> data(size, tag);
+            sendto(sender, reinterpret_cast<const char*>(&data[0]), data.size(), 0, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+        }
+    };
+}
+
+TEST(Test_Receive, RingDrainsBurst)
+{
+    loopback lo;
+    for (uint8_t i = 1; i <= 5; i++)
+        lo.Send(i, 10 * i);
+
+    Zeroconf::Detail::receive_ring ring(4, 64);
+    std::vector<std::vector<uint8_t>> received;
+
+    while (received.size() < 5)
+    {
+        size_t count = 0;
+        ASSERT_TRUE(ring.Fill(lo.receiver, &count));
+        ASSERT_LE(count, ring.Capacity());
+
+        for (size_t i = 0; i < count; i++)
+        {
+            EXPECT_EQ(AF_INET, ring.Peer(i).ss_family);
+            received.emplace_back(ring.Data(i), ring.Data(i) + ring.Size(i));
+        }
+    }
+
+    for (size_t i = 0; i < received.size(); i++)
+    {
+        EXPECT_EQ(10 * (i + 1), received[i].size());
+        EXPECT_EQ(i + 1, received[i][0]);
+    }
+}
+
+TEST(Test_Receive, RingTruncatesToSlotLength)
+{
+    loopback lo;
+    lo.Send(0xab, 100);
+
+    Zeroconf::Detail::receive_ring ring(2, 32);
+
+    size_t count = 0;
+    ASSERT_TRUE(ring.Fill(lo.receiver, &count));
+    ASSERT_EQ(1, count);
+    EXPECT_EQ(32, ring.Size(0));
+    EXPECT_TRUE(ring.Truncated(0));
+}
+
+TEST(Test_Receive, TruncatedDatagramDropped)
+{
+    loopback lo;
+    lo.Send(1, 100);
+    lo.Send(2, 32);
+
+    Zeroconf::Detail::scan_state scan(1);
+    Zeroconf::Detail::receive_ring ring(4, 32);
+
+    // only the one that fits, and a whole 9000 bytes with the default length
+    std::vector<uint8_t> tags;
+    ASSERT_TRUE(Zeroconf::Detail::Receive(std::vector<int>(1, lo.receiver), &scan, &ring, [&](size_t, const sockaddr_storage&, const uint8_t* data, size_t)
+    {
+        tags.push_back(data[0]);
+        return false;
+    }));
+
+    EXPECT_THAT(tags, testing::ElementsAre(2));
+
+    lo.Send(3, 9000);
+
+    Zeroconf::Detail::receive_ring large;
+    size_t count = 0;
+    ASSERT_TRUE(large.Fill(lo.receiver, &count));
+    ASSERT_EQ(1, count);
+    EXPECT_EQ(9000, large.Size(0));
+    EXPECT_FALSE(large.Truncated(0));
+}
+
+TEST(Test_Receive, CallbackPerDatagram)
+{
+    loopback lo;
+    for (uint8_t i = 0; i < 3; i++)
+        lo.Send(i, 16);
+
+    std::vector<Zeroconf::Detail::raw_responce> result;
+    ASSERT_TRUE(Zeroconf::Detail::Receive(lo.receiver, 1, &result));
+    ASSERT_EQ(3, result.size());
+    EXPECT_EQ(2, result[2].data[0]);
+    EXPECT_EQ(16, result[2].data.size());
+}
+
+TEST(Test_Receive, CallbackStopsScan)
+{
+    loopback lo;
+    for (uint8_t i = 0; i < 3; i++)
+        lo.Send(i, 16);
+
+    size_t calls = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    Zeroconf::Detail::receive_ring ring;
+    ASSERT_TRUE(Zeroconf::Detail::Receive(lo.receiver, 5, &ring, [&](const sockaddr_storage&, const uint8_t*, size_t)
+    {
+        calls++;
+        return false;
+    }));
+
+    EXPECT_EQ(1, calls);
+    EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(5));
+}
+
+TEST(Test_Receive, ScanStateDeadline)
+{
+    typedef Zeroconf::Detail::scan_state::clock clock;
+    auto now = clock::now();
+
+    Zeroconf::Detail::scan_state scan(3, Zeroconf::Detail::completion_policy(), now);
+    EXPECT_EQ(3000, scan.Left(now).count());
+    EXPECT_EQ(1, scan.Left(now + std::chrono::microseconds(2999001)).count());
+    EXPECT_TRUE(scan.Done(now + std::chrono::seconds(3)));
+
+    Zeroconf::Detail::completion_policy policy;
+    policy.deadline = std::chrono::milliseconds(40);
+
+    Zeroconf::Detail::scan_state fast(3, policy, now);
+    EXPECT_EQ(40, fast.Left(now).count());
+    EXPECT_TRUE(fast.Done(now + std::chrono::milliseconds(40)));
+}
+
+TEST(Test_Receive, ScanStateQuietPeriod)
+{
+    typedef Zeroconf::Detail::scan_state::clock clock;
+    auto now = clock::now();
+
+    Zeroconf::Detail::completion_policy policy;
+    policy.quietPeriod = std::chrono::milliseconds(100);
+
+    Zeroconf::Detail::scan_state scan(3, policy, now);
+    EXPECT_EQ(100, scan.Left(now).count());
+
+    scan.Received(now + std::chrono::milliseconds(80));
+    EXPECT_EQ(100, scan.Left(now + std::chrono::milliseconds(80)).count());
+    EXPECT_FALSE(scan.Done(now + std::chrono::milliseconds(150)));
+    EXPECT_TRUE(scan.Done(now + std::chrono::milliseconds(180)));
+
+    // the deadline still wins
+    scan.Received(now + std::chrono::milliseconds(2950));
+    EXPECT_EQ(50, scan.Left(now + std::chrono::milliseconds(2950)).count());
+}
+
+TEST(Test_Receive, ScanStateRetransmit)
+{
+    typedef Zeroconf::Detail::scan_state::clock clock;
+    auto now = clock::now();
+
+    Zeroconf::Detail::scan_state scan(8, Zeroconf::Detail::completion_policy(), now);
+    EXPECT_EQ(1000, scan.UntilRetransmit(now).count());
+    EXPECT_EQ(0, scan.UntilRetransmit(now + std::chrono::seconds(1)).count());
+
+    // 1s, 3s, 7s, the next one would fall after the end
+    scan.Retransmitted(now + std::chrono::seconds(1));
+    EXPECT_EQ(2000, scan.UntilRetransmit(now + std::chrono::seconds(1)).count());
+    scan.Retransmitted(now + std::chrono::seconds(3));
+    EXPECT_EQ(4000, scan.UntilRetransmit(now + std::chrono::seconds(3)).count());
+    scan.Retransmitted(now + std::chrono::seconds(7));
+    EXPECT_EQ(std::chrono::milliseconds::max(), scan.UntilRetransmit(now + std::chrono::seconds(7)));
+
+    Zeroconf::Detail::completion_policy once;
+    once.retransmit = std::chrono::milliseconds(0);
+
+    Zeroconf::Detail::scan_state quiet(8, once, now);
+    EXPECT_EQ(std::chrono::milliseconds::max(), quiet.UntilRetransmit(now));
+}
+
+TEST(Test_Receive, RetransmitStopsWhenDone)
+{
+    loopback lo;
+
+    Zeroconf::Detail::completion_policy policy;
+    policy.deadline = std::chrono::milliseconds(300);
+    policy.retransmit = std::chrono::milliseconds(20);
+    policy.peers = 1;
+
+    Zeroconf::Detail::scan_state scan(5, policy);
+    Zeroconf::Detail::receive_ring ring;
+
+    // re-sent at 20ms and 60ms, the answer to the second one completes the scan before 140ms
+    size_t resent = 0;
+    ASSERT_TRUE(Zeroconf::Detail::Receive(std::vector<int>(1, lo.receiver), &scan, &ring, [&](size_t, const sockaddr_storage& peer, const uint8_t*, size_t)
+    {
+        return scan.Answered(peer);
+    }, [&]()
+    {
+        if (++resent == 2)
+            lo.Send(1, 16);
+
+        return true;
+    }));
+
+    EXPECT_EQ(2, resent);
+    EXPECT_TRUE(scan.Done());
+}
+
+TEST(Test_Receive, ScanStateDistinctPeers)
+{
+    Zeroconf::Detail::completion_policy policy;
+    policy.peers = 2;
+
+    sockaddr_storage a = {0};
+    auto in = reinterpret_cast<sockaddr_in*>(&a);
+    in->sin_family = AF_INET;
+    in->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    in->sin_port = htons(5353);
+
+    sockaddr_storage b = a;
+    reinterpret_cast<sockaddr_in*>(&b)->sin_port = htons(5354);
+
+    sockaddr_storage c = a;
+    reinterpret_cast<sockaddr_in*>(&c)->sin_addr.s_addr = htonl(INADDR_LOOPBACK + 1);
+
+    Zeroconf::Detail::scan_state scan(3, policy);
+    EXPECT_TRUE(scan.Answered(a));
+    EXPECT_TRUE(scan.Answered(b)); // same host
+    EXPECT_FALSE(scan.Done());
+    EXPECT_FALSE(scan.Answered(c));
+    EXPECT_TRUE(scan.Done());
+}
+
+TEST(Test_Receive, QuietPeriodEndsScan)
+{
+    loopback lo;
+    lo.Send(1, 16);
+
+    Zeroconf::Detail::completion_policy policy;
+    policy.quietPeriod = std::chrono::milliseconds(50);
+
+    Zeroconf::Detail::scan_state scan(5, policy);
+    Zeroconf::Detail::receive_ring ring;
+
+    size_t calls = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    ASSERT_TRUE(Zeroconf::Detail::Receive(lo.receiver, &scan, &ring, [&](const sockaddr_storage&, const uint8_t*, size_t)
+    {
+        calls++;
+        return true;
+    }));
+
+    EXPECT_EQ(1, calls);
+    EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(1));
+}
+
+TEST(Test_Receive, SourcePerSocket)
+{
+    loopback first;
+    loopback second;
+    first.Send(1, 16);
+    second.Send(2, 16);
+    second.Send(2, 16);
+
+    std::vector<int> fds = { first.receiver, second.receiver };
+    std::vector<size_t> sources;
+
+    Zeroconf::Detail::completion_policy policy;
+    policy.quietPeriod = std::chrono::milliseconds(50);
+
+    Zeroconf::Detail::scan_state scan(5, policy);
+    Zeroconf::Detail::receive_ring ring;
+
+    ASSERT_TRUE(Zeroconf::Detail::Receive(fds, &scan, &ring, [&](size_t source, const sockaddr_storage&, const uint8_t* data, size_t)
+    {
+        EXPECT_EQ(source + 1, data[0]);
+        sources.push_back(source);
+        return true;
+    }));
+
+    std::sort(sources.begin(), sources.end());
+    EXPECT_THAT(sources, testing::ElementsAre(0, 1, 1));
+}
+
+TEST(Test_Receive, MulticastAddress)
+{
+    auto v4 = Zeroconf::Detail::MulticastAddress(AF_INET, 3);
+    auto in = reinterpret_cast<const sockaddr_in*>(&v4);
+    EXPECT_EQ(AF_INET, in->sin_family);
+    EXPECT_EQ(htons(5353), in->sin_port);
+    EXPECT_EQ(htonl(0xE00000FB), in->sin_addr.s_addr);
+
+    auto v6 = Zeroconf::Detail::MulticastAddress(AF_INET6, 3);
+    auto in6 = reinterpret_cast<const sockaddr_in6*>(&v6);
+    EXPECT_EQ(AF_INET6, in6->sin6_family);
+    EXPECT_EQ(3, in6->sin6_scope_id);
+    EXPECT_EQ(0xff, in6->sin6_addr.s6_addr[0]);
+    EXPECT_EQ(0xfb, in6->sin6_addr.s6_addr[15]);
+}
+
+#ifndef WIN32
+TEST(Test_Receive, InterfaceSocket)
+{
+    std::vector<Zeroconf::Detail::mdns_interface> interfaces;
+    ASSERT_TRUE(Zeroconf::Detail::ListInterfaces(&interfaces));
+
+    for (auto& itf: interfaces)
+    {
+        EXPECT_NE(0, itf.index);
+        EXPECT_TRUE(itf.address.ss_family == AF_INET || itf.address.ss_family == AF_INET6);
+    }
+
+    Zeroconf::Detail::mdns_interface lo;
+    lo.index = if_nametoindex("lo");
+    lo.name = "lo";
+    memset(&lo.address, 0, sizeof(lo.address));
+    auto in = reinterpret_cast<sockaddr_in*>(&lo.address);
+    in->sin_family = AF_INET;
+    in->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    int fd = -1;
+    ASSERT_TRUE(Zeroconf::Detail::CreateSocket(lo, &fd));
+
+    sockaddr_in local;
+    socklen_t len = sizeof(local);
+    getsockname(fd, reinterpret_cast<sockaddr*>(&local), &len);
+    EXPECT_EQ(htonl(INADDR_LOOPBACK), local.sin_addr.s_addr);
+    EXPECT_NE(0, local.sin_port);
+
+    Zeroconf::Detail::CloseSocket(fd);
+}
+
+TEST(Test_Receive, SocketPastFdSetSize)
+{
+    EXPECT_TRUE(Zeroconf::Detail::Selectable(FD_SETSIZE - 1));
+    EXPECT_FALSE(Zeroconf::Detail::Selectable(FD_SETSIZE));
+
+    // takes every descriptor below FD_SETSIZE, if the limit allows more
+    rlimit limit;
+    ASSERT_EQ(0, getrlimit(RLIMIT_NOFILE, &limit));
+
+    auto saved = limit;
+    if (limit.rlim_max != RLIM_INFINITY && limit.rlim_max <= FD_SETSIZE + 16)
+        return;
+
+    limit.rlim_cur = FD_SETSIZE + 16;
+    ASSERT_EQ(0, setrlimit(RLIMIT_NOFILE, &limit));
+
+    std::vector<int> taken(1, socket(AF_INET, SOCK_DGRAM, 0));
+    int fd;
+    while ((fd = dup(taken[0])) >= 0 && fd < FD_SETSIZE)
+        taken.push_back(fd);
+
+    EXPECT_EQ(FD_SETSIZE, fd);
+    close(fd);
+
+    int created = -1;
+    EXPECT_FALSE(Zeroconf::Detail::CreateSocket(&created));
+
+    Zeroconf::Detail::socket_set sockets;
+    EXPECT_FALSE(sockets.Open(std::vector<Zeroconf::Detail::mdns_interface>(), Zeroconf::Detail::BroadcastAddress()));
+
+    for (auto item: taken)
+        close(item);
+
+    setrlimit(RLIMIT_NOFILE, &saved);
+}
+#endif
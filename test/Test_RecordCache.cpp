@@ -0,0 +1,279 @@
+#include <gmock/gmock.h>
+
+#include "zeroconf-detail.hpp"
+
+namespace
+{
+    const uint8_t RealPacket[] =
+    {
+        0x00, 0x00, 0x84, 0x00, 0x00, 0x01, 0x00, 0x05, 0x00, 0x00, 0x00, 0x00, 0x05, 0x5F, 0x68, 0x74,
+        0x74, 0x70, 0x04, 0x5F, 0x74, 0x63, 0x70, 0x05, 0x6C, 0x6F, 0x63, 0x61, 0x6C, 0x00, 0x00, 0x0C,
+        0x00, 0x01, 0xC0, 0x0C, 0x00, 0x0C, 0x00, 0x01, 0x00, 0x00, 0x00, 0x0A, 0x00, 0x10, 0x0D, 0x61,
+        0x70, 0x70, 0x6C, 0x65, 0x20, 0x6D, 0x61, 0x63, 0x62, 0x6F, 0x6F, 0x6B, 0xC0, 0x0C, 0xC0, 0x2E,
+        0x00, 0x10, 0x00, 0x01, 0x00, 0x00, 0x00, 0x0A, 0x00, 0x46, 0x45, 0x4C, 0x6F, 0x72, 0x65, 0x6D,
+        0x20, 0x69, 0x70, 0x73, 0x75, 0x6D, 0x20, 0x64, 0x6F, 0x6C, 0x6F, 0x72, 0x20, 0x73, 0x69, 0x74,
+        0x20, 0x61, 0x6D, 0x65, 0x74, 0x20, 0x63, 0x6F, 0x6E, 0x73, 0x65, 0x63, 0x74, 0x65, 0x74, 0x75,
+        0x72, 0x20, 0x61, 0x64, 0x69, 0x70, 0x69, 0x73, 0x63, 0x69, 0x6E, 0x67, 0x20, 0x65, 0x6C, 0x69,
+        0x74, 0x20, 0x73, 0x65, 0x64, 0x20, 0x64, 0x6F, 0x20, 0x65, 0x69, 0x75, 0x73, 0x6D, 0x6F, 0x64,
+        0xC0, 0x2E, 0x00, 0x21, 0x00, 0x01, 0x00, 0x00, 0x00, 0x0A, 0x00, 0x0E, 0x00, 0x00, 0x00, 0x00,
+        0x22, 0xB3, 0x05, 0x61, 0x70, 0x70, 0x6C, 0x65, 0xC0, 0x17, 0xC0, 0xA2, 0x00, 0x1C, 0x00, 0x01,
+        0x00, 0x00, 0x00, 0x0A, 0x00, 0x10, 0xFD, 0xAD, 0xC9, 0xE2, 0x23, 0x28, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0xC0, 0xA2, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x00, 0x0A,
+        0x00, 0x04, 0xC0, 0xA8, 0x00, 0x01
+    };
+
+    // Offsets of the TTL fields in the real packet
+    const size_t TtlOffsets[] = { 40, 68, 150, 176, 204 };
+
+    typedef Zeroconf::Detail::record_cache::clock clock;
+
+    Zeroconf::Detail::mdns_responce ParsePacket(uint32_t ttl = 10, uint16_t rclass = 1)
+    {
+        Zeroconf::Detail::raw_responce input;
+        Zeroconf::Detail::mdns_responce output;
+        input.data.assign(std::begin(RealPacket), std::end(RealPacket));
+        memset(&input.peer, 0, sizeof(input.peer));
+
+        for (auto pos: TtlOffsets)
+        {
+            input.data[pos - 2] = static_cast<uint8_t>(rclass >> 8);
+            input.data[pos - 1] = static_cast<uint8_t>(rclass);
+            input.data[pos] = static_cast<uint8_t>(ttl >> 24);
+            input.data[pos + 1] = static_cast<uint8_t>(ttl >> 16);
+            input.data[pos + 2] = static_cast<uint8_t>(ttl >> 8);
+            input.data[pos + 3] = static_cast<uint8_t>(ttl);
+        }
+
+        Zeroconf::Detail::Parse(input, &output);
+        return output;
+    }
+}
+
+TEST(Test_RecordCache, ParsedTtlAndClass)
+{
+    auto output = ParsePacket(0x01020304, 0x8001);
+    ASSERT_EQ(5, output.records.size());
+
+    for (auto& rr: output.records)
+    {
+        EXPECT_EQ(0x01020304, rr.ttl);
+        EXPECT_EQ(0x8001, rr.rclass);
+    }
+}
+
+TEST(Test_RecordCache, LookupAndExpire)
+{
+    Zeroconf::Detail::record_cache cache;
+    auto now = clock::now();
+
+    cache.Insert(ParsePacket(), now);
+    EXPECT_EQ(5, cache.Size());
+
+    std::vector<Zeroconf::Detail::record_cache::entry> entries;
+    ASSERT_TRUE(cache.Lookup("apple.LOCAL", 1, 1, &entries, now));
+    ASSERT_EQ(1, entries.size());
+    EXPECT_EQ(4, entries[0].index);
+    EXPECT_EQ(now + std::chrono::seconds(10), entries[0].expires);
+
+    EXPECT_FALSE(cache.Lookup("apple.local", 28, 2, &entries, now));
+    EXPECT_FALSE(cache.Lookup("apple.local", 1, 1, &entries, now + std::chrono::seconds(10)));
+    EXPECT_EQ(0, cache.Size());
+}
+
+TEST(Test_RecordCache, ResolveCountsTtlDown)
+{
+    Zeroconf::Detail::record_cache cache;
+    auto now = clock::now();
+
+    cache.Insert(ParsePacket(), now);
+
+    std::vector<Zeroconf::Detail::mdns_responce> result;
+    ASSERT_TRUE(cache.Resolve("_http._tcp.local", 12, &result, now + std::chrono::seconds(3)));
+    ASSERT_EQ(1, result.size());
+    ASSERT_EQ(5, result[0].records.size());
+    EXPECT_EQ(7, result[0].records[0].ttl);
+
+    EXPECT_FALSE(cache.Resolve("_ipp._tcp.local", 12, &result, now));
+    EXPECT_FALSE(cache.Resolve("_http._tcp.local", 12, &result, now + std::chrono::seconds(11)));
+}
+
+TEST(Test_RecordCache, SameDataReplaced)
+{
+    Zeroconf::Detail::record_cache cache;
+    auto now = clock::now();
+
+    cache.Insert(ParsePacket(10), now);
+    cache.Insert(ParsePacket(100), now + std::chrono::seconds(5));
+    EXPECT_EQ(5, cache.Size());
+
+    std::vector<Zeroconf::Detail::record_cache::entry> entries;
+    EXPECT_TRUE(cache.Lookup("apple.local", 1, 1, &entries, now + std::chrono::seconds(50)));
+}
+
+TEST(Test_RecordCache, ScheduleKeepsToEntries)
+{
+    Zeroconf::Detail::record_cache cache;
+    auto now = clock::now();
+
+    // a scan after another refreshes the same records
+    for (size_t i = 0; i < 1000; i++)
+        cache.Insert(ParsePacket(), now + std::chrono::milliseconds(i));
+
+    EXPECT_EQ(5, cache.Size());
+    EXPECT_LE(cache.Scheduled(), 2 * 5 + 64 + 5);
+
+    std::vector<Zeroconf::Detail::record_cache::entry> entries;
+    EXPECT_TRUE(cache.Lookup("apple.local", 1, 1, &entries, now + std::chrono::milliseconds(10500)));
+    EXPECT_FALSE(cache.Lookup("apple.local", 1, 1, &entries, now + std::chrono::milliseconds(11000)));
+}
+
+TEST(Test_RecordCache, Goodbye)
+{
+    Zeroconf::Detail::record_cache cache;
+    auto now = clock::now();
+
+    cache.Insert(ParsePacket(10), now);
+    cache.Insert(ParsePacket(0), now);
+    EXPECT_EQ(0, cache.Size());
+}
+
+TEST(Test_RecordCache, CacheFlush)
+{
+    Zeroconf::Detail::record_cache cache;
+    auto now = clock::now();
+
+    auto changed = ParsePacket(10);
+    changed.data[changed.records[4].rdpos + 3] = 0x02; // 192.168.0.2
+
+    cache.Insert(changed, now);
+    cache.Insert(ParsePacket(10, 0x8001), now + std::chrono::seconds(2));
+
+    std::vector<Zeroconf::Detail::record_cache::entry> entries;
+    ASSERT_TRUE(cache.Lookup("apple.local", 1, 1, &entries, now + std::chrono::seconds(2)));
+    ASSERT_EQ(1, entries.size());
+    EXPECT_EQ(0x01, entries[0].source->data[entries[0].source->records[4].rdpos + 3]);
+}
+
+TEST(Test_RecordCache, ResolveFromCache)
+{
+    Zeroconf::Detail::record_cache cache;
+    cache.Insert(ParsePacket(60));
+
+    Zeroconf::Detail::resolve_options options;
+    options.cache = &cache;
+
+    auto start = clock::now();
+
+    std::vector<Zeroconf::Detail::mdns_responce> result;
+    ASSERT_TRUE(Zeroconf::Detail::Resolve("_http._tcp.local", 3, options, &result));
+    ASSERT_EQ(1, result.size());
+    EXPECT_EQ(5, result[0].records.size());
+
+    EXPECT_LT(clock::now() - start, std::chrono::seconds(1));
+}
+
+TEST(Test_RecordCache, ResolveFromCacheCompletes)
+{
+    Zeroconf::Detail::record_cache cache;
+    for (uint8_t host = 1; host <= 2; host++)
+    {
+        auto responce = ParsePacket(60);
+        responce.data[47] = static_cast<uint8_t>('a' + host); // an instance of its own
+
+        auto in = reinterpret_cast<sockaddr_in*>(&responce.peer);
+        in->sin_family = AF_INET;
+        in->sin_addr.s_addr = htonl(0x7F000000 | host);
+        cache.Insert(responce);
+    }
+
+    Zeroconf::Detail::resolve_options options;
+    options.cache = &cache;
+
+    std::vector<Zeroconf::Detail::mdns_responce> result;
+    ASSERT_TRUE(Zeroconf::Detail::Resolve("_http._tcp.local", 3, options, &result));
+    EXPECT_EQ(2, result.size());
+
+    // the first host completes the scan, whether it answers from the network or from the cache
+    options.completion.peers = 1;
+    ASSERT_TRUE(Zeroconf::Detail::Resolve("_http._tcp.local", 3, options, &result));
+    EXPECT_EQ(1, result.size());
+}
+
+TEST(Test_RecordCache, KnownAnswersOverHalfTtl)
+{
+    Zeroconf::Detail::record_cache cache;
+    auto now = clock::now();
+
+    cache.Insert(ParsePacket(10), now);
+
+    std::vector<Zeroconf::Detail::mdns_known_answer> known;
+    ASSERT_TRUE(cache.KnownAnswers("_http._tcp.local", 12, &known, now + std::chrono::seconds(4)));
+    ASSERT_EQ(1, known.size());
+    EXPECT_EQ(0, known[0].index);
+    EXPECT_EQ(6, known[0].ttl);
+
+    EXPECT_FALSE(cache.KnownAnswers("_http._tcp.local", 12, &known, now + std::chrono::seconds(5)));
+}
+
+TEST(Test_RecordCache, WriteKnownAnswers)
+{
+    auto source = std::make_shared<const Zeroconf::Detail::mdns_responce>(ParsePacket(100));
+
+    std::vector<Zeroconf::Detail::mdns_known_answer> known;
+    for (size_t i = 0; i < source->records.size(); i++)
+        known.push_back(Zeroconf::Detail::mdns_known_answer { source, i, 50 });
+
+    std::vector<Zeroconf::Detail::mdns_question> questions = { { "_http._tcp.local", 12 } };
+    std::vector<std::vector<uint8_t>> packets;
+    ASSERT_TRUE(Zeroconf::Detail::WriteQueries(questions, known, 0, 512, &packets));
+    ASSERT_EQ(1, packets.size());
+    EXPECT_EQ(0, packets[0][2] & 0x02);
+    EXPECT_EQ(5, packets[0][7]);
+
+    // read back as a responce
+    auto data = packets[0];
+    data[2] = 0x84;
+
+    Zeroconf::Detail::mdns_responce output;
+    ASSERT_TRUE(Zeroconf::Detail::Parse(&data[0], data.size(), &output));
+    output.data = data;
+    ASSERT_EQ(5, output.records.size());
+
+    for (size_t i = 0; i < output.records.size(); i++)
+    {
+        EXPECT_EQ(source->records[i].name, output.records[i].name);
+        EXPECT_EQ(50, output.records[i].ttl);
+        EXPECT_TRUE(Zeroconf::Detail::SameRecordData(*source, source->records[i], output, output.records[i]));
+    }
+
+    EXPECT_EQ(sizeof(RealPacket), data.size()); // compressed as well as the original
+}
+
+TEST(Test_RecordCache, KnownAnswersSplitWithTruncatedBit)
+{
+    auto source = std::make_shared<const Zeroconf::Detail::mdns_responce>(ParsePacket(100));
+
+    std::vector<Zeroconf::Detail::mdns_known_answer> known;
+    for (size_t n = 0; n < 10; n++)
+    {
+        for (size_t i = 0; i < source->records.size(); i++)
+            known.push_back(Zeroconf::Detail::mdns_known_answer { source, i, 50 });
+    }
+
+    std::vector<Zeroconf::Detail::mdns_question> questions = { { "_http._tcp.local", 12 } };
+    std::vector<std::vector<uint8_t>> packets;
+    ASSERT_TRUE(Zeroconf::Detail::WriteQueries(questions, known, 0, 256, &packets));
+    ASSERT_GT(packets.size(), 2);
+
+    size_t ancount = 0;
+    for (size_t i = 0; i < packets.size(); i++)
+    {
+        auto& packet = packets[i];
+        EXPECT_LE(packet.size(), 256);
+        EXPECT_EQ(i == 0 ? 1 : 0, packet[5]);
+        EXPECT_EQ(i != packets.size() - 1, (packet[2] & 0x02) != 0);
+        ancount += (packet[6] << 8) | packet[7];
+    }
+
+    EXPECT_EQ(known.size(), ancount);
+}
@@ -0,0 +1,551 @@
+#include <gmock/gmock.h>
+
+#include "zeroconf-simulator.hpp"
+
+namespace
+{
+    const char* Service = "_sim._tcp.local";
+
+    std::vector<Zeroconf::Detail::simulated_responder> Responders(size_t count)
+    {
+        std::vector<Zeroconf::Detail::simulated_responder> result;
+        for (size_t i = 0; i < count; i++)
+        {
+            auto host = Zeroconf::Detail::simulator::ResponderAddress(i);
+            result.push_back(Zeroconf::Detail::SimulatedService(Service, "node-" + std::to_string(i), host));
+        }
+
+        return result;
+    }
+
+    Zeroconf::Detail::resolve_options Options(const Zeroconf::Detail::simulator& sim)
+    {
+        Zeroconf::Detail::resolve_options result;
+        result.cachePolicy = Zeroconf::Detail::CachePolicy::Bypass;
+        result.destination = sim.Address();
+        result.completion.deadline = std::chrono::milliseconds(500);
+        return result;
+    }
+
+    // Checks the queries of a scan re-sent 50, 150, 350 and 750ms after the first one, how many of them
+    // went out before the deadline depends on the load of the machine, what they carried does not
+    void ExpectKnownAnswerRetransmits(const Zeroconf::Detail::simulator& sim, const std::vector<Zeroconf::Detail::mdns_responce>& result)
+    {
+        auto& known = sim.KnownAnswers();
+        ASSERT_GE(known.size(), 2);
+        ASSERT_LE(known.size(), 5);
+        EXPECT_EQ(sim.Queries(), known.size());
+
+        // every query lists whatever was heard before it
+        EXPECT_EQ(0, known[0]);
+        for (size_t i = 1; i < known.size(); i++)
+            EXPECT_LE(known[i - 1], known[i]);
+
+        EXPECT_GT(known.back(), 0);
+        EXPECT_GT(sim.Suppressed(), 0);
+
+        // whoever answered is told so by the next query and does not answer again
+        EXPECT_LE(result.size(), sim.Sent());
+        for (auto& responce: result)
+            EXPECT_EQ(1, responce.count);
+    }
+}
+
+TEST(Test_Resolve, AllResponders)
+{
+    Zeroconf::Detail::simulator sim;
+    ASSERT_TRUE(sim.Start(Responders(3), Zeroconf::Detail::simulator_options()));
+
+    auto options = Options(sim);
+    options.completion.peers = 3;
+
+    std::vector<Zeroconf::Detail::mdns_responce> result;
+    ASSERT_TRUE(Zeroconf::Detail::Resolve(Service, 1, options, &result));
+    ASSERT_EQ(3, result.size());
+
+    std::vector<std::string> targets;
+    for (auto& responce: result)
+    {
+        ASSERT_EQ(4, responce.records.size());
+        EXPECT_STREQ(Service, responce.qname.c_str());
+
+        std::string target;
+        ASSERT_TRUE(Zeroconf::Detail::ReadPtr(responce, responce.records[0], &target));
+        targets.push_back(target);
+
+        in_addr addr;
+        ASSERT_TRUE(Zeroconf::Detail::ReadA(responce, responce.records[3], &addr));
+        EXPECT_EQ(0, memcmp(&addr, &reinterpret_cast<const sockaddr_in*>(&responce.peer)->sin_addr, sizeof(addr)));
+    }
+
+    EXPECT_THAT(targets, testing::UnorderedElementsAre(
+        "node-0._sim._tcp.local", "node-1._sim._tcp.local", "node-2._sim._tcp.local"));
+    EXPECT_EQ(1, sim.Queries());
+}
+
+TEST(Test_Resolve, FirstAnswerEndsScan)
+{
+    Zeroconf::Detail::simulator sim;
+    ASSERT_TRUE(sim.Start(Responders(5), Zeroconf::Detail::simulator_options()));
+
+    // far enough from the deadline that only a scan waiting for it fails
+    auto options = Options(sim);
+    options.completion.deadline = std::chrono::seconds(10);
+
+    auto start = std::chrono::steady_clock::now();
+
+    size_t calls = 0;
+    ASSERT_TRUE(Zeroconf::Detail::Resolve(Service, 30, options, [&](Zeroconf::Detail::mdns_responce&)
+    {
+        calls++;
+        return false;
+    }));
+
+    EXPECT_EQ(1, calls);
+    EXPECT_EQ(1, sim.Queries());
+    EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(5));
+}
+
+TEST(Test_Resolve, JitterBurstAndLoss)
+{
+    Zeroconf::Detail::simulator_options simOptions;
+    simOptions.minDelay = std::chrono::milliseconds(1);
+    simOptions.maxDelay = std::chrono::milliseconds(20);
+    simOptions.burst = 2;
+    simOptions.loss = 0.5;
+
+    Zeroconf::Detail::simulator sim;
+    ASSERT_TRUE(sim.Start(Responders(40), simOptions));
+
+    auto options = Options(sim);
+    options.completion.quietPeriod = std::chrono::milliseconds(100);
+
+    std::vector<Zeroconf::Detail::mdns_responce> result;
+    ASSERT_TRUE(Zeroconf::Detail::Resolve(Service, 1, options, &result));
+
+    EXPECT_GT(sim.Lost(), 0);
+    EXPECT_EQ(2 * (40 - sim.Lost()), sim.Sent());
+
+    // every burst shows up once
+    EXPECT_EQ(40 - sim.Lost(), result.size());
+    for (auto& responce: result)
+        EXPECT_EQ(2, responce.count);
+}
+
+TEST(Test_Resolve, RetransmitWithKnownAnswers)
+{
+    Zeroconf::Detail::simulator_options simOptions;
+    simOptions.loss = 0.5;
+
+    Zeroconf::Detail::simulator sim;
+    ASSERT_TRUE(sim.Start(Responders(40), simOptions));
+
+    auto options = Options(sim);
+    options.completion.deadline = std::chrono::milliseconds(800);
+    options.completion.retransmit = std::chrono::milliseconds(50);
+
+    std::vector<Zeroconf::Detail::mdns_responce> result;
+    ASSERT_TRUE(Zeroconf::Detail::Resolve(Service, 1, options, &result));
+    sim.Stop();
+
+    ExpectKnownAnswerRetransmits(sim, result);
+
+    // the ones that missed a query get another chance,
+    // even a slow machine sends the one 50ms after the first
+    EXPECT_GT(result.size(), 20);
+}
+
+TEST(Test_Resolve, LargeResponce)
+{
+    auto responders = Responders(1);
+
+    // a TXT record of 2000 bytes, in strings of 200
+    auto& txt = responders[0].records[2];
+    txt.rdata.clear();
+    for (size_t i = 0; i < 10; i++)
+    {
+        txt.rdata.push_back(199);
+        txt.rdata.insert(txt.rdata.end(), 199, 'x');
+    }
+
+    Zeroconf::Detail::simulator sim;
+    ASSERT_TRUE(sim.Start(responders, Zeroconf::Detail::simulator_options()));
+
+    auto options = Options(sim);
+    options.completion.peers = 1;
+
+    std::vector<Zeroconf::Detail::mdns_responce> result;
+    ASSERT_TRUE(Zeroconf::Detail::Resolve(Service, 1, options, &result));
+    ASSERT_EQ(1, result.size());
+    ASSERT_EQ(4, result[0].records.size());
+    EXPECT_EQ(2000, result[0].records[2].rdlen);
+
+    // or dropped by a smaller limit
+    options.maxMessageSize = 1500;
+    ASSERT_TRUE(Zeroconf::Detail::Resolve(Service, 1, options, &result));
+    EXPECT_TRUE(result.empty());
+}
+
+TEST(Test_Resolve, TruncatedResponces)
+{
+    // the PTR, SRV, TXT and A records go in a part each
+    Zeroconf::Detail::simulator_options simOptions;
+    simOptions.maxMessageSize = 100;
+    simOptions.burst = 2;
+
+    Zeroconf::Detail::simulator sim;
+    ASSERT_TRUE(sim.Start(Responders(10), simOptions));
+
+    auto options = Options(sim);
+    options.completion.quietPeriod = std::chrono::milliseconds(100);
+
+    std::vector<Zeroconf::Detail::mdns_responce> result;
+    ASSERT_TRUE(Zeroconf::Detail::Resolve(Service, 1, options, &result));
+    EXPECT_EQ(2 * 4 * 10, sim.Sent());
+
+    ASSERT_EQ(10, result.size());
+    for (auto& responce: result)
+    {
+        EXPECT_EQ(2, responce.count);
+        EXPECT_FALSE(responce.truncated);
+        EXPECT_STREQ(Service, responce.qname.c_str());
+
+        ASSERT_EQ(4, responce.records.size());
+
+        in_addr addr;
+        ASSERT_TRUE(Zeroconf::Detail::ReadA(responce, responce.records[3], &addr));
+        EXPECT_EQ(0, memcmp(&addr, &reinterpret_cast<const sockaddr_in*>(&responce.peer)->sin_addr, sizeof(addr)));
+
+        Zeroconf::Detail::mdns_srv srv;
+        ASSERT_TRUE(Zeroconf::Detail::ReadSrv(responce, responce.records[1], &srv));
+        EXPECT_EQ(8080, srv.port);
+    }
+}
+
+TEST(Test_Resolve, ResponceWithoutLastPart)
+{
+    std::vector<Zeroconf::Detail::mdns_responce> parts(2);
+    sockaddr_storage peer = {0};
+    peer.ss_family = AF_INET;
+
+    for (size_t i = 0; i < parts.size(); i++)
+    {
+        uint8_t buffer[512];
+        Zeroconf::Detail::message_builder builder(buffer, sizeof(buffer));
+        builder.Reset(0, Zeroconf::Detail::MdnsResponseFlag | Zeroconf::Detail::MdnsTruncatedFlag);
+        builder.AddQuestion(std::string(Service), Zeroconf::Detail::MdnsTypePtr);
+
+        const uint8_t Address[] = { 127, 0, 0, static_cast<uint8_t>(i) };
+        builder.AddRecord(Zeroconf::Detail::MessageSection::Answer, std::string("host.local"), 
+            Zeroconf::Detail::MdnsTypeA, Zeroconf::Detail::MdnsClassIn | 0x8000, 120, Address, sizeof(Address));
+
+        ASSERT_TRUE(Zeroconf::Detail::Parse(peer, buffer, builder.Size(), &parts[i]));
+    }
+
+    Zeroconf::Detail::responce_assembler assembler;
+    EXPECT_FALSE(assembler.Add(0, 1, &parts[0]));
+    EXPECT_FALSE(assembler.Add(0, 1, &parts[0]));
+    EXPECT_FALSE(assembler.Add(0, 2, &parts[1]));
+    EXPECT_EQ(1, assembler.Pending());
+
+    size_t calls = 0;
+    EXPECT_TRUE(assembler.Flush([&](size_t, uint64_t hash, Zeroconf::Detail::mdns_responce& responce)
+    {
+        calls++;
+        EXPECT_EQ(2, hash);
+        EXPECT_FALSE(responce.truncated);
+        EXPECT_STREQ(Service, responce.qname.c_str());
+
+        // the cache-flush bit is kept
+        EXPECT_EQ(2, responce.records.size());
+        for (auto& rr: responce.records)
+            EXPECT_EQ(Zeroconf::Detail::MdnsClassIn | 0x8000, rr.rclass);
+
+        return true;
+    }));
+
+    EXPECT_EQ(1, calls);
+    EXPECT_EQ(0, assembler.Pending());
+}
+
+TEST(Test_Resolve, PartsWaitForTheRest)
+{
+    uint8_t buffer[512];
+    Zeroconf::Detail::message_builder builder(buffer, sizeof(buffer));
+    builder.Reset(0, Zeroconf::Detail::MdnsResponseFlag | Zeroconf::Detail::MdnsTruncatedFlag);
+    builder.AddQuestion(std::string(Service), Zeroconf::Detail::MdnsTypePtr);
+
+    sockaddr_storage peer = {0};
+    peer.ss_family = AF_INET;
+
+    Zeroconf::Detail::mdns_responce part;
+    ASSERT_TRUE(Zeroconf::Detail::Parse(peer, buffer, builder.Size(), &part));
+
+    auto now = Zeroconf::Detail::responce_assembler::clock::now();
+
+    Zeroconf::Detail::responce_assembler assembler;
+    EXPECT_FALSE(assembler.Add(0, 1, &part, now));
+
+    size_t calls = 0;
+    auto callback = [&](size_t, uint64_t, Zeroconf::Detail::mdns_responce&)
+    {
+        calls++;
+        return true;
+    };
+
+    EXPECT_TRUE(assembler.Expire(callback, now + std::chrono::milliseconds(400)));
+    EXPECT_EQ(0, calls);
+    EXPECT_EQ(1, assembler.Pending());
+
+    EXPECT_TRUE(assembler.Expire(callback, now + Zeroconf::Detail::MdnsTruncatedWait));
+    EXPECT_EQ(1, calls);
+    EXPECT_EQ(0, assembler.Pending());
+}
+
+TEST(Test_Resolve, OtherService)
+{
+    Zeroconf::Detail::simulator sim;
+    ASSERT_TRUE(sim.Start(Responders(2), Zeroconf::Detail::simulator_options()));
+
+    auto options = Options(sim);
+    options.completion.deadline = std::chrono::milliseconds(100);
+
+    std::vector<Zeroconf::Detail::mdns_responce> result;
+    ASSERT_TRUE(Zeroconf::Detail::Resolve("_other._tcp.local", 1, options, &result));
+    EXPECT_TRUE(result.empty());
+    EXPECT_EQ(1, sim.Queries());
+}
+
+TEST(Test_Resolve, EncodedQuery)
+{
+    static constexpr auto Query = Zeroconf::Detail::EncodeQuery("_sim._tcp.local");
+
+    Zeroconf::Detail::simulator sim;
+    ASSERT_TRUE(sim.Start(Responders(2), Zeroconf::Detail::simulator_options()));
+
+    auto options = Options(sim);
+    options.completion.peers = 2;
+
+    std::vector<Zeroconf::Detail::mdns_responce> result;
+    ASSERT_TRUE(Zeroconf::Detail::Resolve(Query, 1, options, &result));
+    ASSERT_EQ(2, result.size());
+    EXPECT_STREQ(Service, result[0].qname.c_str());
+    EXPECT_EQ(1, sim.Queries());
+}
+
+TEST(Test_Resolve, CachedAnswerNotDeliveredTwice)
+{
+    Zeroconf::Detail::simulator_options simOptions;
+    simOptions.suppress = false;
+
+    Zeroconf::Detail::simulator sim;
+    ASSERT_TRUE(sim.Start(Responders(3), simOptions));
+
+    Zeroconf::Detail::record_cache cache;
+
+    auto options = Options(sim);
+    options.cachePolicy = Zeroconf::Detail::CachePolicy::Refresh;
+    options.cache = &cache;
+    options.completion.deadline = std::chrono::milliseconds(300);
+
+    std::vector<Zeroconf::Detail::mdns_responce> result;
+    ASSERT_TRUE(Zeroconf::Detail::Resolve(Service, 1, options, &result));
+    ASSERT_EQ(3, result.size());
+
+    // the known answers come from the cache, the hosts answer all the same
+    ASSERT_TRUE(Zeroconf::Detail::Resolve(Service, 1, options, &result));
+    EXPECT_EQ(2, sim.Queries());
+    EXPECT_EQ(0, sim.Suppressed());
+
+    ASSERT_EQ(3, result.size());
+    for (auto& responce: result)
+        EXPECT_EQ(2, responce.count);
+}
+
+TEST(Test_Resolve, EncodedQueryRetransmitWithKnownAnswers)
+{
+    static constexpr auto Query = Zeroconf::Detail::EncodeQuery("_sim._tcp.local");
+
+    Zeroconf::Detail::simulator_options simOptions;
+    simOptions.loss = 0.5;
+
+    Zeroconf::Detail::simulator sim;
+    ASSERT_TRUE(sim.Start(Responders(40), simOptions));
+
+    auto options = Options(sim);
+    options.completion.deadline = std::chrono::milliseconds(800);
+    options.completion.retransmit = std::chrono::milliseconds(50);
+
+    std::vector<Zeroconf::Detail::mdns_responce> result;
+    ASSERT_TRUE(Zeroconf::Detail::Resolve(Query, 1, options, &result));
+    sim.Stop();
+
+    ExpectKnownAnswerRetransmits(sim, result);
+}
+
+TEST(Test_Resolve, RepeatedRecords)
+{
+    auto build = [](uint16_t id, bool extra, std::vector<uint8_t>* result)
+    {
+        uint8_t buffer[512];
+        Zeroconf::Detail::message_builder builder(buffer, sizeof(buffer));
+        builder.Reset(id, Zeroconf::Detail::MdnsResponseFlag);
+        builder.AddQuestion(std::string("_sim._tcp.local"), Zeroconf::Detail::MdnsTypePtr);
+
+        builder.BeginRecord(std::string("_sim._tcp.local"), Zeroconf::Detail::MdnsTypePtr, 1, 120);
+        builder.WriteName(std::string("Node._SIM._tcp.local"));
+        builder.EndRecord(Zeroconf::Detail::MessageSection::Answer);
+
+        if (extra)
+        {
+            const uint8_t Address[] = { 127, 0, 0, 2 };
+            builder.AddRecord(Zeroconf::Detail::MessageSection::Additional, std::string("node.local"), 1, 1, 120, Address, 4);
+        }
+
+        result->assign(builder.Data(), builder.Data() + builder.Size());
+    };
+
+    sockaddr_storage first = {0}, second = {0};
+    reinterpret_cast<sockaddr_in*>(&first)->sin_family = AF_INET;
+    reinterpret_cast<sockaddr_in*>(&first)->sin_addr.s_addr = htonl(0x7F000002);
+    reinterpret_cast<sockaddr_in*>(&second)->sin_family = AF_INET;
+    reinterpret_cast<sockaddr_in*>(&second)->sin_addr.s_addr = htonl(0x7F000003);
+
+    std::vector<uint8_t> a, b, c;
+    build(0, false, &a);
+    build(7, false, &b); // another packet with the same record, the name in another case
+    build(0, true, &c);  // brings a new record
+
+    Zeroconf::Detail::answer_filter filter;
+    Zeroconf::Detail::mdns_responce parsed;
+
+    auto add = [&](const sockaddr_storage& peer, const std::vector<uint8_t>& packet)
+    {
+        auto hash = Zeroconf::Detail::answer_filter::PacketHash(peer, &packet[0], packet.size());
+        auto original = filter.FindPacket(hash);
+        if (original != Zeroconf::Detail::NoAnswer)
+            return original;
+
+        EXPECT_TRUE(Zeroconf::Detail::Parse(peer, &packet[0], packet.size(), &parsed));
+        return filter.Add(hash, parsed);
+    };
+
+    EXPECT_EQ(Zeroconf::Detail::NoAnswer, add(first, a));
+    EXPECT_EQ(0, add(first, a));
+    EXPECT_EQ(0, add(first, b));
+    EXPECT_EQ(Zeroconf::Detail::NoAnswer, add(first, c));
+
+    // another host with the same records answers too
+    EXPECT_EQ(Zeroconf::Detail::NoAnswer, add(second, a));
+    EXPECT_EQ(2, add(second, b));
+    EXPECT_EQ(Zeroconf::Detail::NoAnswer, add(second, c));
+}
+
+TEST(Test_Resolve, GoodbyeIsNotRepeat)
+{
+    auto build = [](uint32_t ttl, std::vector<uint8_t>* result)
+    {
+        uint8_t buffer[512];
+        Zeroconf::Detail::message_builder builder(buffer, sizeof(buffer));
+        builder.Reset(0, Zeroconf::Detail::MdnsResponseFlag);
+        builder.AddQuestion(std::string("_sim._tcp.local"), Zeroconf::Detail::MdnsTypePtr);
+
+        builder.BeginRecord(std::string("_sim._tcp.local"), Zeroconf::Detail::MdnsTypePtr, 1, ttl);
+        builder.WriteName(std::string("node._sim._tcp.local"));
+        builder.EndRecord(Zeroconf::Detail::MessageSection::Answer);
+
+        result->assign(builder.Data(), builder.Data() + builder.Size());
+    };
+
+    sockaddr_storage peer = {0};
+    reinterpret_cast<sockaddr_in*>(&peer)->sin_family = AF_INET;
+    reinterpret_cast<sockaddr_in*>(&peer)->sin_addr.s_addr = htonl(0x7F000002);
+
+    std::vector<uint8_t> announce, refresh, goodbye;
+    build(120, &announce);
+    build(60, &refresh);
+    build(0, &goodbye);
+
+    Zeroconf::Detail::answer_filter filter;
+    Zeroconf::Detail::mdns_responce parsed;
+
+    auto add = [&](const std::vector<uint8_t>& packet)
+    {
+        auto hash = Zeroconf::Detail::answer_filter::PacketHash(peer, &packet[0], packet.size());
+        EXPECT_TRUE(Zeroconf::Detail::Parse(peer, &packet[0], packet.size(), &parsed));
+        return filter.Add(hash, parsed);
+    };
+
+    EXPECT_EQ(Zeroconf::Detail::NoAnswer, add(announce));
+    EXPECT_EQ(0, add(refresh));
+    EXPECT_EQ(Zeroconf::Detail::NoAnswer, add(goodbye));
+}
+
+TEST(Test_Resolve, PipelineKeepsOrder)
+{
+    std::vector<std::vector<uint8_t>> packets(50);
+    for (size_t i = 0; i < packets.size(); i++)
+    {
+        uint8_t buffer[512];
+        Zeroconf::Detail::message_builder builder(buffer, sizeof(buffer));
+        builder.Reset(static_cast<uint16_t>(i), i % 7 == 3 ? 0 : Zeroconf::Detail::MdnsResponseFlag); // some are broken
+        builder.AddQuestion(std::string("_sim._tcp.local"), Zeroconf::Detail::MdnsTypePtr);
+        packets[i].assign(builder.Data(), builder.Data() + builder.Size());
+    }
+
+    Zeroconf::Detail::parse_pipeline pipeline(3, 8);
+    ASSERT_TRUE(pipeline.Start());
+    EXPECT_EQ(6, pipeline.Depth());
+
+    std::vector<size_t> order;
+    auto merge = [&](Zeroconf::Detail::parse_pipeline::slot& item)
+    {
+        size_t id = item.responce.data[1];
+        EXPECT_EQ(id % 7 != 3, item.parsed);
+        EXPECT_EQ(id % 2, item.source);
+        order.push_back(id);
+        return true;
+    };
+
+    sockaddr_storage peer = {0};
+    for (size_t i = 0; i < packets.size(); i++)
+    {
+        ASSERT_TRUE(pipeline.Merge(merge, pipeline.Depth() - 1));
+        pipeline.Push(i % 2, peer, &packets[i][0], packets[i].size());
+    }
+
+    ASSERT_TRUE(pipeline.Merge(merge, 0));
+    EXPECT_EQ(0, pipeline.Pending());
+
+    ASSERT_EQ(packets.size(), order.size());
+    for (size_t i = 0; i < order.size(); i++)
+        EXPECT_EQ(i, order[i]);
+}
+
+TEST(Test_Resolve, ParserThreads)
+{
+    Zeroconf::Detail::simulator_options simOptions;
+    simOptions.burst = 2;
+
+    Zeroconf::Detail::simulator sim;
+    ASSERT_TRUE(sim.Start(Responders(40), simOptions));
+
+    auto options = Options(sim);
+    options.parserThreads = 3;
+    options.completion.quietPeriod = std::chrono::milliseconds(100);
+
+    std::vector<Zeroconf::Detail::mdns_responce> result;
+    ASSERT_TRUE(Zeroconf::Detail::Resolve(Service, 1, options, &result));
+
+    ASSERT_EQ(40, result.size());
+    for (auto& responce: result)
+    {
+        EXPECT_EQ(2, responce.count);
+        EXPECT_EQ(4, responce.records.size());
+    }
+
+    // nothing is handed out after the scan is complete
+    options.completion.peers = 5;
+    ASSERT_TRUE(Zeroconf::Detail::Resolve(Service, 1, options, &result));
+    EXPECT_EQ(5, result.size());
+}
@@ -0,0 +1,281 @@
+#include <gmock/gmock.h>
+
+#include <thread>
+
+#include "zeroconf-responder.hpp"
+
+#ifndef WIN32
+#include <arpa/inet.h>
+#endif
+
+namespace
+{
+    // Loopback socket standing in for a querier
+    struct querier
+    {
+        int fd;
+        sockaddr_storage addr;
+
+        querier()
+        {
+            fd = socket(AF_INET, SOCK_DGRAM, 0);
+
+            memset(&addr, 0, sizeof(addr));
+            auto in = reinterpret_cast<sockaddr_in*>(&addr);
+            in->sin_family = AF_INET;
+            in->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(sockaddr_in));
+
+            socklen_t len = sizeof(addr);
+            getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len);
+
+            timeval tv = {1, 0};
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&tv), sizeof(tv));
+        }
+
+        ~querier()
+        {
+            Zeroconf::Detail::CloseSocket(fd);
+        }
+
+        bool Receive(Zeroconf::Detail::mdns_responce* result)
+        {
+            std::vector<uint8_t> data(512);
+            auto cb = recv(fd, reinterpret_cast<char*>(&data[0]), static_cast<int>(data.size()), 0);
+            if (cb <= 0)
+                return false;
+
+            return Zeroconf::Detail::Parse(addr, &data[0], cb, result);
+        }
+
+        // Multicast responces carry no question, which Parse expects, so their records are walked here
+        bool Receive(std::vector<Zeroconf::Detail::mdns_record>* result)
+        {
+            std::vector<uint8_t> data(512);
+            auto cb = recv(fd, reinterpret_cast<char*>(&data[0]), static_cast<int>(data.size()), 0);
+            if (cb < 12 || data[4] != 0 || data[5] != 0)
+                return false;
+
+            data.resize(cb);
+            result->clear();
+
+            size_t count = (data[6] << 8 | data[7]) + (data[10] << 8 | data[11]);
+            size_t pos = 12;
+
+            for (size_t i = 0; i < count; i++)
+            {
+                Zeroconf::Detail::mdns_record rr;
+                auto length = Zeroconf::Detail::ReadFqdn(data, pos, &rr.name);
+                if (length == 0 || pos + length + 10 > data.size())
+                    return false;
+
+                auto p = &data[pos + length];
+                rr.type = static_cast<uint16_t>(p[0] << 8 | p[1]);
+                rr.rclass = static_cast<uint16_t>(p[2] << 8 | p[3]);
+                rr.ttl = static_cast<uint32_t>(p[4] << 24 | p[5] << 16 | p[6] << 8 | p[7]);
+                rr.rdlen = static_cast<uint16_t>(p[8] << 8 | p[9]);
+
+                pos += length + 10 + rr.rdlen;
+                result->push_back(rr);
+            }
+
+            return pos == data.size();
+        }
+    };
+
+    Zeroconf::Detail::service_info Printer(const std::string& instance)
+    {
+        Zeroconf::Detail::service_info result;
+        result.instance = instance;
+        result.type = "_ipp._tcp.local";
+        result.host = "printer.local";
+        result.port = 631;
+        result.txt.push_back("rp=ipp/print");
+        result.address.s_addr = htonl(0xC0A80005);
+        return result;
+    }
+
+    sockaddr_storage Loopback(uint16_t port)
+    {
+        sockaddr_storage result = {0};
+        auto in = reinterpret_cast<sockaddr_in*>(&result);
+        in->sin_family = AF_INET;
+        in->sin_port = htons(port);
+        in->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        return result;
+    }
+
+    uint16_t Port(int fd)
+    {
+        sockaddr_in addr;
+        socklen_t len = sizeof(addr);
+        getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len);
+        return ntohs(addr.sin_port);
+    }
+}
+
+TEST(Test_Responder, LegacyUnicast)
+{
+    Zeroconf::Detail::responder responder;
+    ASSERT_TRUE(responder.Open(0));
+    ASSERT_TRUE(responder.Register(Printer("Office")));
+
+    querier client;
+    std::vector<uint8_t> query;
+    Zeroconf::Detail::WriteQuery("_IPP._tcp.local", Zeroconf::Detail::MdnsTypePtr, 0x1234, &query);
+    ASSERT_TRUE(Zeroconf::Detail::Send(client.fd, &query[0], query.size(), Loopback(Port(responder.Fd()))));
+
+    ASSERT_TRUE(responder.Poll(1000));
+    EXPECT_EQ(1, responder.Answered());
+
+    Zeroconf::Detail::mdns_responce answer;
+    ASSERT_TRUE(client.Receive(&answer));
+
+    EXPECT_EQ(0x12, answer.data[0]);
+    EXPECT_EQ(0x34, answer.data[1]);
+    EXPECT_STREQ("_ipp._tcp.local", answer.qname.c_str());
+    ASSERT_EQ(4, answer.records.size());
+
+    std::string target;
+    ASSERT_TRUE(Zeroconf::Detail::ReadPtr(answer, answer.records[0], &target));
+    EXPECT_STREQ("Office._ipp._tcp.local", target.c_str());
+
+    Zeroconf::Detail::mdns_srv srv;
+    ASSERT_TRUE(Zeroconf::Detail::ReadSrv(answer, answer.records[1], &srv));
+    EXPECT_EQ(631, srv.port);
+    EXPECT_STREQ("printer.local", srv.target.c_str());
+
+    Zeroconf::Detail::mdns_txt txt;
+    auto reader = Zeroconf::Detail::ReadTxt(answer, answer.records[2]);
+    ASSERT_TRUE(reader.Next(&txt));
+    EXPECT_STREQ("rp", txt.key.to_string().c_str());
+
+    in_addr addr;
+    ASSERT_TRUE(Zeroconf::Detail::ReadA(answer, answer.records[3], &addr));
+    EXPECT_EQ(htonl(0xC0A80005), addr.s_addr);
+
+    for (auto& rr: answer.records)
+    {
+        EXPECT_EQ(10, rr.ttl);
+        EXPECT_EQ(Zeroconf::Detail::MdnsClassIn, rr.rclass);
+    }
+}
+
+TEST(Test_Responder, MulticastAnswer)
+{
+    querier group;
+
+    Zeroconf::Detail::responder responder;
+    responder.SetGroup(group.addr);
+    ASSERT_TRUE(responder.Open(0));
+    ASSERT_TRUE(responder.Register(Printer("Office")));
+
+    // the announcement
+    std::vector<Zeroconf::Detail::mdns_record> records;
+    ASSERT_TRUE(group.Receive(&records));
+    EXPECT_EQ(4, records.size());
+
+    std::vector<uint8_t> query;
+    Zeroconf::Detail::WriteQuery("Office._ipp._tcp.local", Zeroconf::Detail::MdnsTypeSrv, 0, &query);
+
+    EXPECT_EQ(1, responder.Handle(Loopback(5353), &query[0], query.size()));
+    ASSERT_TRUE(group.Receive(&records));
+
+    // the SRV and its host address
+    ASSERT_EQ(2, records.size());
+    EXPECT_EQ(Zeroconf::Detail::MdnsTypeSrv, records[0].type);
+    EXPECT_STREQ("Office._ipp._tcp.local", records[0].name.c_str());
+    EXPECT_EQ(Zeroconf::Detail::MdnsTypeA, records[1].type);
+    EXPECT_EQ(120, records[0].ttl);
+    EXPECT_EQ(Zeroconf::Detail::MdnsClassIn | Zeroconf::Detail::MdnsCacheFlushBit, records[0].rclass);
+}
+
+TEST(Test_Responder, InstancesShareType)
+{
+    Zeroconf::Detail::responder responder;
+    ASSERT_TRUE(responder.Register(Printer("Office")));
+    ASSERT_TRUE(responder.Register(Printer("Lobby")));
+    EXPECT_FALSE(responder.Register(Printer("lobby")));
+    ASSERT_TRUE(responder.Open(0));
+
+    querier client;
+    std::vector<uint8_t> query;
+    Zeroconf::Detail::WriteQuery("_ipp._tcp.local", Zeroconf::Detail::MdnsTypePtr, 1, &query);
+
+    EXPECT_EQ(1, responder.Handle(client.addr, &query[0], query.size()));
+
+    Zeroconf::Detail::mdns_responce answer;
+    ASSERT_TRUE(client.Receive(&answer));
+    EXPECT_EQ(2, answer.data[7]); // ancount
+    EXPECT_EQ(8, answer.records.size());
+
+    ASSERT_TRUE(responder.Unregister("Lobby", "_ipp._tcp.local"));
+    EXPECT_EQ(1, responder.Handle(client.addr, &query[0], query.size()));
+    ASSERT_TRUE(client.Receive(&answer));
+    EXPECT_EQ(1, answer.data[7]);
+}
+
+TEST(Test_Responder, Goodbye)
+{
+    querier group;
+
+    Zeroconf::Detail::responder responder;
+    responder.SetGroup(group.addr);
+    ASSERT_TRUE(responder.Open(0));
+    ASSERT_TRUE(responder.Register(Printer("Office")));
+
+    std::vector<Zeroconf::Detail::mdns_record> records;
+    ASSERT_TRUE(group.Receive(&records));
+
+    ASSERT_TRUE(responder.Unregister("Office", "_ipp._tcp.local"));
+    ASSERT_TRUE(group.Receive(&records));
+    ASSERT_EQ(4, records.size());
+
+    for (auto& rr: records)
+        EXPECT_EQ(0, rr.ttl);
+
+    std::vector<uint8_t> query;
+    Zeroconf::Detail::WriteQuery("_ipp._tcp.local", Zeroconf::Detail::MdnsTypePtr, 1, &query);
+    EXPECT_EQ(0, responder.Handle(group.addr, &query[0], query.size()));
+}
+
+TEST(Test_Responder, IgnoresUnknownAndMalformed)
+{
+    Zeroconf::Detail::responder responder;
+    ASSERT_TRUE(responder.Register(Printer("Office")));
+    ASSERT_TRUE(responder.Open(0));
+
+    auto peer = Loopback(9);
+
+    std::vector<uint8_t> query;
+    Zeroconf::Detail::WriteQuery("_http._tcp.local", Zeroconf::Detail::MdnsTypePtr, 1, &query);
+    EXPECT_EQ(0, responder.Handle(peer, &query[0], query.size()));
+
+    Zeroconf::Detail::WriteQuery("_ipp._tcp.local", Zeroconf::Detail::MdnsTypePtr, 1, &query);
+    for (size_t i = 0; i < query.size(); i++)
+        EXPECT_EQ(0, responder.Handle(peer, &query[0], i));
+
+    query[2] = 0x84; // a responce
+    EXPECT_EQ(0, responder.Handle(peer, &query[0], query.size()));
+}
+
+TEST(Test_Responder, ResolveFindsService)
+{
+    Zeroconf::Detail::responder responder;
+    ASSERT_TRUE(responder.Open(0));
+    ASSERT_TRUE(responder.Register(Printer("Office")));
+
+    std::thread thread([&]() { responder.Poll(1000); });
+
+    Zeroconf::Detail::resolve_options options;
+    options.cachePolicy = Zeroconf::Detail::CachePolicy::Bypass;
+    options.destination = Loopback(Port(responder.Fd()));
+    options.completion.peers = 1;
+
+    std::vector<Zeroconf::Detail::mdns_responce> result;
+    ASSERT_TRUE(Zeroconf::Detail::Resolve("_ipp._tcp.local", 1, options, &result));
+    thread.join();
+
+    ASSERT_EQ(1, result.size());
+    EXPECT_EQ(4, result[0].records.size());
+}
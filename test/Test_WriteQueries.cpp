@@ -0,0 +1,237 @@
+#include <gmock/gmock.h>
+
+#include "zeroconf-detail.hpp"
+
+using testing::ElementsAre;
+
+namespace
+{
+    std::vector<std::string> ReadQuestions(const std::vector<uint8_t>& packet)
+    {
+        std::vector<std::string> result;
+
+        size_t qdcount = (packet[4] << 8) | packet[5];
+        size_t pos = 12;
+
+        for (size_t i = 0; i < qdcount; i++)
+        {
+            std::string name;
+            size_t cb = Zeroconf::Detail::ReadFqdn(packet, pos, &name);
+            if (cb == 0)
+                break;
+
+            pos += cb;
+            result.push_back(name + "/" + std::to_string((packet[pos] << 8) | packet[pos + 1]));
+            pos += 4;
+        }
+
+        EXPECT_EQ(packet.size(), pos);
+        return result;
+    }
+}
+
+TEST(Test_WriteQueries, CompressedFqdn)
+{
+    uint8_t buffer[64];
+    Zeroconf::Detail::message_builder builder(buffer, sizeof(buffer));
+    builder.Reset(0, 0);
+
+    ASSERT_TRUE(builder.WriteName(std::string("_http._tcp.local")));
+    ASSERT_TRUE(builder.WriteName(std::string("_ipp._TCP.local.")));
+    ASSERT_TRUE(builder.WriteName(std::string("local")));
+
+    std::vector<uint8_t> result(builder.Data() + 12, builder.Data() + builder.Size());
+    EXPECT_THAT(result, ElementsAre(
+        0x05, '_', 'h', 't', 't', 'p', 0x04, '_', 't', 'c', 'p', 0x05, 'l', 'o', 'c', 'a', 'l', 0x00,
+        0x04, '_', 'i', 'p', 'p', 0xc0, 0x12,
+        0xc0, 0x17));
+}
+
+TEST(Test_WriteQueries, WrongFqdn)
+{
+    uint8_t buffer[128];
+    Zeroconf::Detail::message_builder builder(buffer, sizeof(buffer));
+    builder.Reset(0, 0);
+
+    EXPECT_FALSE(builder.WriteName(std::string("")));
+    EXPECT_FALSE(builder.WriteName(std::string("..")));
+    EXPECT_FALSE(builder.WriteName(std::string(64, 'a') + ".local"));
+    EXPECT_TRUE(builder.WriteName(std::string(63, 'a') + ".local"));
+}
+
+TEST(Test_WriteQueries, BuilderCompresses)
+{
+    uint8_t buffer[64];
+    Zeroconf::Detail::message_builder builder(buffer, sizeof(buffer));
+    builder.Reset(0x1234, 0);
+
+    ASSERT_TRUE(builder.AddQuestion(std::string("_http._tcp.local"), 12));
+    ASSERT_TRUE(builder.AddQuestion(std::string("_ipp._TCP.local."), 12));
+    ASSERT_TRUE(builder.WriteName(std::string("LOCAL")));
+
+    std::vector<uint8_t> result(builder.Data(), builder.Data() + builder.Size());
+    EXPECT_THAT(result, ElementsAre(
+        0x12, 0x34, 0x00, 0x00, 0x00, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x05, '_', 'h', 't', 't', 'p', 0x04, '_', 't', 'c', 'p', 0x05, 'l', 'o', 'c', 'a', 'l', 0x00, 0x00, 0x0c, 0x00, 0x01,
+        0x04, '_', 'i', 'p', 'p', 0xc0, 0x12, 0x00, 0x0c, 0x00, 0x01,
+        0xc0, 0x17));
+
+    EXPECT_FALSE(builder.WriteName(std::string("")));
+    EXPECT_FALSE(builder.WriteName(std::string("..")));
+    EXPECT_FALSE(builder.WriteName(std::string(64, 'a') + ".local"));
+    EXPECT_EQ(result.size(), builder.Size());
+}
+
+TEST(Test_WriteQueries, BuilderOverflowAndRollback)
+{
+    uint8_t buffer[40];
+    Zeroconf::Detail::message_builder builder(buffer, sizeof(buffer));
+    builder.Reset(0, 0);
+
+    ASSERT_TRUE(builder.AddQuestion(std::string("_http._tcp.local"), 12)); // 12 + 22 bytes
+    auto mark = builder.Mark();
+
+    // a pointer and the footer fit, a new label does not
+    EXPECT_FALSE(builder.AddQuestion(std::string("_ipp._tcp.local"), 12));
+    EXPECT_EQ(34, builder.Size());
+    EXPECT_EQ(1, builder.Questions());
+
+    ASSERT_TRUE(builder.AddQuestion(std::string("_tcp.local"), 12));
+    EXPECT_EQ(40, builder.Size());
+    EXPECT_EQ(2, buffer[5]);
+
+    builder.Rollback(mark);
+    EXPECT_EQ(34, builder.Size());
+    EXPECT_EQ(1, builder.Questions());
+    EXPECT_EQ(1, buffer[5]);
+}
+
+TEST(Test_WriteQueries, BuilderRecord)
+{
+    uint8_t buffer[128];
+    Zeroconf::Detail::message_builder builder(buffer, sizeof(buffer));
+    builder.Reset(0, Zeroconf::Detail::MdnsResponseFlag);
+
+    ASSERT_TRUE(builder.AddQuestion(std::string("_http._tcp.local"), 12));
+    ASSERT_TRUE(builder.BeginRecord(std::string("_http._tcp.local"), 12, 1, 120));
+    ASSERT_TRUE(builder.WriteName(std::string("web._http._tcp.local")));
+    builder.EndRecord(Zeroconf::Detail::MessageSection::Answer);
+
+    const uint8_t Address[] = { 192, 168, 0, 1 };
+    ASSERT_TRUE(builder.AddRecord(Zeroconf::Detail::MessageSection::Additional, std::string("web.local"), 1, 1, 120, Address, sizeof(Address)));
+
+    Zeroconf::Detail::mdns_responce output;
+    ASSERT_TRUE(Zeroconf::Detail::Parse(builder.Data(), builder.Size(), &output));
+    output.data.assign(builder.Data(), builder.Data() + builder.Size());
+    ASSERT_EQ(2, output.records.size());
+    EXPECT_STREQ("_http._tcp.local", output.records[0].name.c_str());
+    EXPECT_EQ(120, output.records[0].ttl);
+    EXPECT_STREQ("web.local", output.records[1].name.c_str());
+
+    std::string name;
+    ASSERT_TRUE(Zeroconf::Detail::ReadPtr(output, output.records[0], &name));
+    EXPECT_STREQ("web._http._tcp.local", name.c_str());
+    EXPECT_EQ(1, builder.Records(Zeroconf::Detail::MessageSection::Additional));
+}
+
+TEST(Test_WriteQueries, EncodeQuery)
+{
+    static constexpr auto Http = Zeroconf::Detail::EncodeQuery("_http._tcp.local");
+    static_assert(Http.size() == 12 + 18 + 4, "unexpected query size");
+    static_assert(Http[12] == 5 && Http[18] == 4 && Http[23] == 5 && Http[29] == 0, "unexpected labels");
+
+    std::vector<uint8_t> expected;
+    Zeroconf::Detail::WriteQuery("_http._tcp.local", Zeroconf::Detail::MdnsTypePtr, 0, &expected);
+    EXPECT_EQ(expected, std::vector<uint8_t>(Http.begin(), Http.end()));
+
+    constexpr auto Host = Zeroconf::Detail::EncodeQuery("a.local", Zeroconf::Detail::MdnsTypeAaaa);
+    Zeroconf::Detail::WriteQuery("a.local", Zeroconf::Detail::MdnsTypeAaaa, 0, &expected);
+    EXPECT_EQ(expected, std::vector<uint8_t>(Host.begin(), Host.end()));
+
+    // malformed names do not compile in constant expressions, at run time they throw
+    EXPECT_THROW(Zeroconf::Detail::EncodeQuery("_http..local"), std::invalid_argument);
+    EXPECT_THROW(Zeroconf::Detail::EncodeQuery("local."), std::invalid_argument);
+    EXPECT_THROW(Zeroconf::Detail::EncodeQuery(
+        "a123456789b123456789c123456789d123456789e123456789f123456789abcd.local"), std::invalid_argument);
+}
+
+TEST(Test_WriteQueries, SinglePacket)
+{
+    std::vector<Zeroconf::Detail::mdns_question> questions = 
+    {
+        { "_http._tcp.local", 12 },
+        { "_ipp._tcp.local", 12 },
+        { "_ssh._tcp.local", 12 },
+        { "host.local", 1 }
+    };
+
+    std::vector<std::vector<uint8_t>> result;
+    ASSERT_TRUE(Zeroconf::Detail::WriteQueries(questions, 0x1234, 512, &result));
+    ASSERT_EQ(1, result.size());
+
+    EXPECT_EQ(0x12, result[0][0]);
+    EXPECT_EQ(0x34, result[0][1]);
+    EXPECT_THAT(ReadQuestions(result[0]), ElementsAre(
+        "_http._tcp.local/12", "_ipp._tcp.local/12", "_ssh._tcp.local/12", "host.local/1"));
+
+    // 12 header + 22 first question + 3 * (1 + 4 + 2 + 4) for the others
+    EXPECT_EQ(12 + 22 + 11 + 11 + 11, result[0].size());
+}
+
+TEST(Test_WriteQueries, SplitIntoPackets)
+{
+    std::vector<Zeroconf::Detail::mdns_question> questions;
+    for (size_t i = 0; i < 100; i++)
+        questions.push_back(Zeroconf::Detail::mdns_question { "_service" + std::to_string(i) + "._tcp.local", 12 });
+
+    std::vector<std::vector<uint8_t>> result;
+    ASSERT_TRUE(Zeroconf::Detail::WriteQueries(questions, 0, 128, &result));
+    ASSERT_GT(result.size(), 1);
+
+    size_t index = 0;
+    for (auto& packet: result)
+    {
+        EXPECT_LE(packet.size(), 128);
+
+        for (auto& q: ReadQuestions(packet))
+            EXPECT_EQ(questions[index++].name + "/12", q);
+    }
+
+    EXPECT_EQ(questions.size(), index);
+}
+
+TEST(Test_WriteQueries, WrongQuestion)
+{
+    std::vector<Zeroconf::Detail::mdns_question> questions = { { "foo.local", 1 }, { "", 1 } };
+
+    std::vector<std::vector<uint8_t>> result;
+    EXPECT_FALSE(Zeroconf::Detail::WriteQueries(questions, 0, 512, &result));
+}
+
+TEST(Test_WriteQueries, ParseMultipleQuestions)
+{
+    std::vector<Zeroconf::Detail::mdns_question> questions = { { "_http._tcp.local", 12 }, { "_ipp._tcp.local", 12 } };
+
+    std::vector<std::vector<uint8_t>> packets;
+    ASSERT_TRUE(Zeroconf::Detail::WriteQueries(questions, 0, 512, &packets));
+
+    // echo the questions and answer the second one
+    auto data = packets[0];
+    data[2] = 0x84;
+
+    const uint8_t Answer[] = { 0xc0, 0x22, 0x00, 0x0c, 0x00, 0x01, 0x00, 0x00, 0x00, 0x0a, 0x00, 0x02, 0xc0, 0x22 };
+    data.insert(data.end(), std::begin(Answer), std::end(Answer));
+
+    Zeroconf::Detail::mdns_responce output;
+    ASSERT_TRUE(Zeroconf::Detail::Parse(&data[0], data.size(), &output));
+    EXPECT_STREQ("_http._tcp.local", output.qname.c_str());
+    ASSERT_EQ(1, output.records.size());
+    EXPECT_STREQ("_ipp._tcp.local", output.records[0].name.c_str());
+
+    output.data = data;
+    EXPECT_TRUE(Zeroconf::Detail::Answers(output, "_http._tcp.local", 12));
+    EXPECT_TRUE(Zeroconf::Detail::Answers(output, "_IPP._tcp.local", 12));
+    EXPECT_FALSE(Zeroconf::Detail::Answers(output, "_ipp._tcp.local", 1));
+    EXPECT_TRUE(Zeroconf::Detail::Answers(output, "_ipp._tcp.local", 255));
+    EXPECT_FALSE(Zeroconf::Detail::Answers(output, "_ssh._tcp.local", 12));
+}
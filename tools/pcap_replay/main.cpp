@@ -0,0 +1,126 @@
+#include <string>
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+
+#include "zeroconf-pcap.hpp"
+
+// Replays the mDNS traffic of a pcap or pcapng capture through the parser.
+// Prints the throughput and per-responder figures, or one JSON document with --json.
+
+namespace
+{
+    void PrintLog(Zeroconf::Detail::Log::LogLevel level, const std::string& message)
+    {
+        if (level == Zeroconf::Detail::Log::LogLevel::Error)
+            std::cerr << "E: " << message << std::endl;
+    }
+
+    void PrintTable(const Zeroconf::Detail::capture_stats& stats)
+    {
+        auto packets = stats.responces + stats.failed;
+
+        std::cout 
+            << "frames:      " << stats.frames << std::endl
+            << "queries:     " << stats.queries << std::endl
+            << "responces:   " << stats.responces << std::endl
+            << "failed:      " << stats.failed << std::endl
+            << "records:     " << stats.records << std::endl
+            << "bytes:       " << stats.bytes << std::endl
+            << std::fixed << std::setprecision(3)
+            << "seconds:     " << stats.seconds << std::endl
+            << std::setprecision(0)
+            << "packets/s:   " << packets / stats.seconds << std::endl
+            << "MB/s:        " << stats.bytes / stats.seconds / 1e6 << std::endl
+            << std::endl;
+
+        std::cout 
+            << std::left << std::setw(40) << "responder"
+            << std::right << std::setw(12) << "packets" 
+            << std::setw(12) << "records" 
+            << std::setw(12) << "bytes" 
+            << std::setw(12) << "failed" << std::endl;
+
+        for (auto& item: stats.responders)
+        {
+            std::cout 
+                << std::left << std::setw(40) << item.first
+                << std::right << std::setw(12) << item.second.packets
+                << std::setw(12) << item.second.records
+                << std::setw(12) << item.second.bytes
+                << std::setw(12) << item.second.failed << std::endl;
+        }
+    }
+
+    void PrintJson(const Zeroconf::Detail::capture_stats& stats)
+    {
+        auto packets = stats.responces + stats.failed;
+
+        std::cout 
+            << "{\"frames\":" << stats.frames
+            << ",\"queries\":" << stats.queries
+            << ",\"responces\":" << stats.responces
+            << ",\"failed\":" << stats.failed
+            << ",\"records\":" << stats.records
+            << ",\"bytes\":" << stats.bytes
+            << std::fixed << std::setprecision(6)
+            << ",\"seconds\":" << stats.seconds
+            << std::setprecision(1)
+            << ",\"packets_per_sec\":" << packets / stats.seconds
+            << ",\"responders\":[" << std::endl;
+
+        size_t i = 0;
+        for (auto& item: stats.responders)
+        {
+            std::cout 
+                << "  {\"address\":\"" << item.first << "\""
+                << ",\"packets\":" << item.second.packets
+                << ",\"records\":" << item.second.records
+                << ",\"bytes\":" << item.second.bytes
+                << ",\"failed\":" << item.second.failed
+                << "}" << (++i < stats.responders.size() ? "," : "") << std::endl;
+        }
+
+        std::cout << "]}" << std::endl;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    std::string path;
+    size_t workers = 0;
+    bool json = false;
+    bool usage = argc < 2;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--json")
+            json = true;
+        else if (arg == "--workers" && i + 1 < argc)
+            workers = std::strtoul(argv[++i], nullptr, 10);
+        else if (path.empty() && arg[0] != '-')
+            path = arg;
+        else
+            usage = true;
+    }
+
+    if (usage || path.empty())
+    {
+        std::cerr << "Usage: pcap_replay <capture> [--workers N] [--json]" << std::endl;
+        return 1;
+    }
+
+    Zeroconf::Detail::Log::SetLogCallback(PrintLog);
+
+    Zeroconf::Detail::capture_stats stats;
+    if (!Zeroconf::Detail::ReplayCapture(path, workers, &stats))
+        return 1;
+
+    if (json)
+        PrintJson(stats);
+    else
+        PrintTable(stats);
+
+    return 0;
+}